@@ -117,9 +117,10 @@ static inline void pi_ram_close(struct pi_device *device);
 
 /** \brief Allocate RAM memory
  *
- * The allocated memory is 4-bytes aligned. The allocator uses some meta-data
- * stored in the chip memory for every allocation so it is advisable to do as
- * few allocations as possible to lower the memory overhead.
+ * The allocated memory is aligned on the allocator granule, which is at
+ * least 32 bytes and grows with the RAM size so that the allocator meta-data
+ * stored in the chip memory is a bitmap of at most 4KB, whatever the number of
+ * allocations. Allocated sizes are rounded up to the granule.
  *
  * \param device    The device structure of the device where to allocate the
  *   memory.
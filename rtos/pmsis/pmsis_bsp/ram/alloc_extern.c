@@ -40,201 +40,277 @@
 #include <stdio.h>
 #include "extern_alloc.h"
 
-// Allocate at least 4 bytes to avoid misaligned accesses when parsing free blocks 
-// and actually 8 to fit free chunk header size and make sure a e free block to always have
-// at least the size of the header.
-// This also requires the initial chunk to be correctly aligned.
-#define MIN_CHUNK_SIZE 8
+#ifndef EXTERN_ALLOC_MIN_GRANULE_LOG2
+#define EXTERN_ALLOC_MIN_GRANULE_LOG2 5
+#endif
+
+// Bounds the bitmap to 4KB of L2
+#ifndef EXTERN_ALLOC_MAX_GRANULES
+#define EXTERN_ALLOC_MAX_GRANULES (32*1024)
+#endif
 
 #define ALIGN_UP(addr,size)   (((addr) + (size) - 1) & ~((size) - 1))
 #define ALIGN_DOWN(addr,size) ((addr) & ~((size) - 1))
 
-#define Max(x, y) (((x)>(y))?(x):(y))
-
 /*
-  A semi general purpose memory allocator based on the assumption that when something is freed it's size is known.
-  The rationnal is to get rid of the usual meta data overhead attached to traditionnal memory allocators.
+  Next-fit allocator for external memories. As for the other allocators, the size
+  of a chunk is given back when it is freed.
+
+  As the external memory cannot be accessed directly, the metadata is a bitmap in L2
+  with one bit per granule, which is set when the granule is free. Free areas are
+  found by scanning the bitmap 32 granules at a time with bit scans, starting where
+  the previous allocation ended, so that the allocated areas at the beginning of the
+  memory are not scanned again by each allocation. Aligned allocations directly look
+  for an aligned area, so no head or tail is split and given back.
 */
 
-static inline void __free_chunk(alloc_chunk_extern_t *pt)
-{
-  pmsis_l2_malloc_free((void *)pt, sizeof(alloc_chunk_extern_t));
-}
-
-static inline alloc_chunk_extern_t *__alloc_chunk()
+static inline int __map_words(extern_alloc_t *a)
 {
-  return (alloc_chunk_extern_t *)pmsis_l2_malloc(sizeof(alloc_chunk_extern_t));
+  return (a->nb_granules + 31) >> 5;
 }
 
-void extern_alloc_info(extern_alloc_t *a, int *_size, void **first_chunk, int *_nb_chunks)
+// Return the index of the first granule after index which is free (or allocated
+// if free is 0), or the number of granules if there is none.
+static int __next_granule(extern_alloc_t *a, int index, int free)
 {
-  if (first_chunk) *first_chunk = a->first_free;
+  int nb_granules = a->nb_granules;
 
-  if (_size || _nb_chunks) {
-    int size = 0;
-    int nb_chunks = 0;
-
-    alloc_chunk_extern_t *pt = a->first_free;
-
-    for (pt = a->first_free; pt; pt = pt->next) {
-      size += pt->size;
-      nb_chunks++;
+  while (index < nb_granules)
+  {
+    uint32_t word = a->map[index >> 5];
+    if (!free)
+      word = ~word;
+    word &= ~0U << (index & 31);
+
+    if (word)
+    {
+      index = (index & ~31) + __builtin_ctz(word);
+      return index < nb_granules ? index : nb_granules;
     }
 
-    if (_size) *_size = size;
-    if (_nb_chunks) *_nb_chunks = nb_chunks;
+    index = (index & ~31) + 32;
   }
+
+  return nb_granules;
 }
 
-void extern_alloc_dump(extern_alloc_t *a)
+static void __set_granules(extern_alloc_t *a, int index, int nb, int free)
 {
-  alloc_chunk_extern_t *pt = a->first_free;
+  while (nb > 0)
+  {
+    int bit = index & 31;
+    int count = 32 - bit < nb ? 32 - bit : nb;
+    uint32_t mask = (count == 32 ? ~0U : ((1U << count) - 1)) << bit;
 
-  printf("======== Memory allocator state: ============\n");
-  for (pt = a->first_free; pt; pt = pt->next) {
-    printf("DUMP CHUNK %p ALLOC %p\n", pt, a);
-    printf("Free Block at %8X, size: %5d, Next: %8X ", pt->addr, pt->size, (unsigned int) pt->next);
-    if (pt == pt->next) {
-      printf(" CORRUPTED\n"); break;
-    } else printf("\n");
+    if (free)
+      a->map[index >> 5] |= mask;
+    else
+      a->map[index >> 5] &= ~mask;
+
+    index += count;
+    nb -= count;
   }
-  printf("=============================================\n");
 }
 
-int extern_alloc_init(extern_alloc_t *a, void *addr, int size)
+static inline unsigned int __granule_addr(extern_alloc_t *a, int index)
 {
-  if (size)
-  {
-    unsigned int staaddr = ALIGN_UP((int)addr, MIN_CHUNK_SIZE);
-    alloc_chunk_extern_t *chunk = __alloc_chunk();
-    if (chunk == NULL) return -1;
-    size = size - (staaddr - (unsigned int)addr);
-    if (size > 0) {
-      a->first_free = chunk;
-      chunk->size = ALIGN_DOWN(size, MIN_CHUNK_SIZE);
-      chunk->next = NULL;
-      chunk->addr = staaddr;
-    }
-  }
-  else
+  return a->base + (index << a->granule_log2);
+}
+
+// Look for the first free area between from and to where an area of nb granules,
+// starting on the specified alignment, fits.
+static int __find_fit(extern_alloc_t *a, int from, int to, int nb, int align)
+{
+  int index = __next_granule(a, from, 1);
+
+  while (index < to)
   {
-    a->first_free = NULL;
+    int end = __next_granule(a, index, 0);
+    int start = index;
+
+    if (align)
+      start = (ALIGN_UP(__granule_addr(a, index), align) - a->base) >> a->granule_log2;
+
+    if (end - start >= nb)
+      return start;
+
+    index = __next_granule(a, end, 1);
   }
-  return 0;
+
+  return -1;
 }
 
+static int __find_next_fit(extern_alloc_t *a, int nb, int align)
+{
+  int index = __find_fit(a, a->next_fit, a->nb_granules, nb, align);
+  if (index < 0)
+    index = __find_fit(a, 0, a->next_fit, nb, align);
+  return index;
+}
 
+// Return 1 if none of the specified granules is free
+static int __granules_allocated(extern_alloc_t *a, int index, int nb)
+{
+  int next_free = __next_granule(a, index, 1);
+  return next_free >= index + nb;
+}
 
-void extern_alloc_deinit(extern_alloc_t *a)
+void extern_alloc_get_stats(extern_alloc_t *a, extern_alloc_stats_t *stats)
 {
-  __free_chunk(a->first_free);
+  memset(stats, 0, sizeof(extern_alloc_stats_t));
+
+  if (a->map == NULL)
+    return;
+
+  int index = __next_granule(a, 0, 1);
+  while (index < a->nb_granules)
+  {
+    int end = __next_granule(a, index, 0);
+    int size = (end - index) << a->granule_log2;
+
+    stats->nb_free_chunks++;
+    if (size > stats->largest_free_chunk)
+      stats->largest_free_chunk = size;
+
+    index = __next_granule(a, end, 1);
+  }
+
+  stats->free_size = a->free_size;
+  stats->metadata_size = __map_words(a) * sizeof(uint32_t);
+  if (stats->free_size)
+    stats->fragmentation = 1000 - (int)(((long long)stats->largest_free_chunk * 1000) / stats->free_size);
 }
 
+void extern_alloc_info(extern_alloc_t *a, int *_size, void **first_chunk, int *_nb_chunks)
+{
+  if (first_chunk)
+  {
+    int index = a->map ? __next_granule(a, 0, 1) : 0;
+    *first_chunk = index < a->nb_granules ? (void *)__granule_addr(a, index) : NULL;
+  }
 
+  if (_size || _nb_chunks)
+  {
+    extern_alloc_stats_t stats;
+    extern_alloc_get_stats(a, &stats);
+    if (_size) *_size = stats.free_size;
+    if (_nb_chunks) *_nb_chunks = stats.nb_free_chunks;
+  }
+}
 
-int extern_alloc(extern_alloc_t *a, int size, void **chunk)
+void extern_alloc_dump(extern_alloc_t *a)
 {
-  alloc_chunk_extern_t *pt = a->first_free, *prev = 0;
-
-  size = ALIGN_UP(size, MIN_CHUNK_SIZE);
-
-  while (pt && (pt->size < size)) { prev = pt; pt = pt->next; }
-
-  if (pt) {
-    if (pt->size == size) {
-      // Special case where the whole block disappears
-      // This special case is interesting to support when we allocate aligned pages, to limit fragmentation
-      if (prev) prev->next = pt->next; else a->first_free = pt->next;
-      void *addr = (void *)pt->addr;
-      __free_chunk(pt);
-      *chunk = addr;
-      return 0;
-    } else {
-      // The free block is bigger than needed
-      // Return the end of the block in order to just update the free block size
-      void *result = (void *)((char *)pt->addr + pt->size - size);
-      pt->size = pt->size - size;
-      *chunk = result;
-      return 0;
+  printf("======== Memory allocator state: ============\n");
+  if (a->map)
+  {
+    int index = __next_granule(a, 0, 1);
+    while (index < a->nb_granules)
+    {
+      int end = __next_granule(a, index, 0);
+      printf("Free Block at %8X, size: %5d\n", __granule_addr(a, index), (end - index) << a->granule_log2);
+      index = __next_granule(a, end, 1);
     }
-  } else {
-    //warning("Not enough memory to allocate\n");
-    *chunk = (void *)0xffffffff;
-    return -1;
   }
+  printf("=============================================\n");
 }
 
-int extern_alloc_align(extern_alloc_t *a, int size, int align, void **chunk)
+int extern_alloc_init(extern_alloc_t *a, void *addr, int size)
 {
+  a->map = NULL;
+  a->nb_granules = 0;
+  a->free_size = 0;
+  a->next_fit = 0;
+  a->granule_log2 = EXTERN_ALLOC_MIN_GRANULE_LOG2;
+
+  if (size <= 0)
+    return 0;
+
+  while ((size >> a->granule_log2) > EXTERN_ALLOC_MAX_GRANULES)
+    a->granule_log2++;
 
-  if (align < (int)sizeof(alloc_chunk_extern_t)) return extern_alloc(a, size, chunk);
+  int granule = 1 << a->granule_log2;
+  unsigned int start = ALIGN_UP((unsigned int)addr, granule);
+  unsigned int end = ALIGN_DOWN((unsigned int)addr + size, granule);
 
-  // As the user must give back the size of the allocated chunk when freeing it, we must allocate
-  // an aligned chunk with exactly the right size
-  // To do so, we allocate a bigger chunk and we free what is before and what is after
+  if (end <= start)
+    return 0;
 
-  // We reserve enough space to free the remaining room before and after the aligned chunk
-  int size_align = size + align + sizeof(alloc_chunk_extern_t) * 2;
-  unsigned int result;
-  if (extern_alloc(a, size_align, (void **)&result))
+  a->base = start;
+  a->nb_granules = (end - start) >> a->granule_log2;
+
+  a->map = pmsis_l2_malloc(__map_words(a) * sizeof(uint32_t));
+  if (a->map == NULL)
     return -1;
 
-  unsigned int result_align = (result + align - 1) & -align;
-  unsigned int headersize = result_align - result;
+  // Granules after the end of the memory in the last word are considered allocated
+  memset(a->map, 0, __map_words(a) * sizeof(uint32_t));
+  __set_granules(a, 0, a->nb_granules, 1);
+  a->free_size = a->nb_granules << a->granule_log2;
+
+  return 0;
+}
+
+
+
+void extern_alloc_deinit(extern_alloc_t *a)
+{
+  if (a->map)
+  {
+    pmsis_l2_malloc_free(a->map, __map_words(a) * sizeof(uint32_t));
+    a->map = NULL;
+  }
+}
+
+
 
-  // In case we don't get an aligned chunk at first, we must free the room before the first aligned one
-  if (headersize != 0) {
+int extern_alloc_align(extern_alloc_t *a, int size, int align, void **chunk)
+{
+  if (align <= (1 << a->granule_log2))
+    align = 0;
 
-    // If we don't have enough room before the aligned chunk for freeing the header, take the next aligned one
-    if (result_align - result < sizeof(alloc_chunk_extern_t)) result_align += align;
+  int nb = size <= 0 ? 1 : ALIGN_UP(size, 1 << a->granule_log2) >> a->granule_log2;
+  int index = a->map ? __find_next_fit(a, nb, align) : -1;
 
-    // Free the header
-    extern_free(a, headersize, (void *)result);
+  if (index < 0)
+  {
+    *chunk = (void *)0xffffffff;
+    return -1;
   }
 
-  // Now free what remains after
-  extern_free(a, size_align - headersize - size, (unsigned char *)(result_align + size));
+  __set_granules(a, index, nb, 0);
+  a->free_size -= nb << a->granule_log2;
+  a->next_fit = index + nb < a->nb_granules ? index + nb : 0;
+
+  *chunk = (void *)__granule_addr(a, index);
 
-  *chunk = (void *)result_align;
   return 0;
 }
 
-int __attribute__((noinline)) extern_free(extern_alloc_t *a, int size, void *addr)
+int extern_alloc(extern_alloc_t *a, int size, void **chunk)
+{
+  return extern_alloc_align(a, size, 0, chunk);
+}
 
+int __attribute__((noinline)) extern_free(extern_alloc_t *a, int size, void *addr)
 {
-  alloc_chunk_extern_t *chunk;
-  alloc_chunk_extern_t *next = a->first_free, *prev = 0;
-  size = ALIGN_UP(size, MIN_CHUNK_SIZE);
+  unsigned int chunk = (unsigned int)addr;
 
-  while (next && next->addr < (unsigned int)addr) {
-    prev = next; next = next->next; 
-  }
+  if (a->map == NULL || chunk < a->base || ((chunk - a->base) & ((1 << a->granule_log2) - 1)))
+    return -1;
 
-  if (next && ((char *)addr + size) == (char *)next->addr) {
-    /* Coalesce with next */
-    next->size = size + next->size;
-    next->addr = (unsigned int)addr;
-    chunk = next;
-  } else {
-    chunk = __alloc_chunk();
-    if (chunk == NULL) return -1;
-    chunk->size = size;
-    chunk->next = next;
-    chunk->addr = (unsigned int)addr;
-  }
+  int index = (chunk - a->base) >> a->granule_log2;
+  int nb = size <= 0 ? 1 : ALIGN_UP(size, 1 << a->granule_log2) >> a->granule_log2;
 
-  if (prev) {
-    if (((char *)prev->addr + prev->size) == (char *)addr) {
-      /* Coalesce with previous */
-      prev->size += chunk->size;
-      prev->next = chunk->next;
-      __free_chunk(chunk);
-    } else {
-      prev->next = chunk;
-    }
-  } else {
-    a->first_free = chunk;
-  }
+  if (index + nb > a->nb_granules)
+    return -1;
+
+  // Reject double frees and frees overlapping a free area, which would
+  // otherwise silently corrupt the free size
+  if (!__granules_allocated(a, index, nb))
+    return -1;
+
+  __set_granules(a, index, nb, 1);
+  a->free_size += nb << a->granule_log2;
 
   return 0;
 }
@@ -18,16 +18,31 @@
 #define __EXTERN_ALLOC_H__
 
 
-typedef struct alloc_block_extern_s {
-  int                      size;
-  struct alloc_block_extern_s *next;
-  unsigned int             addr;
-} alloc_chunk_extern_t;
-
+// Allocated and free memory is tracked with a bitmap stored in L2, with one
+// bit per granule, set when the granule is free. The granule is the smallest
+// power of 2 giving at most EXTERN_ALLOC_MAX_GRANULES granules, so that the L2
+// footprint does not depend on the number of allocations.
+// This bounds the bitmap to 4KB but the granule grows with the memory size,
+// e.g. 256 bytes for 8MB and 2KB for 64MB, and each allocation is rounded up
+// to it. Memories holding many small buffers should raise
+// EXTERN_ALLOC_MAX_GRANULES to trade L2 for less wasted external memory.
 typedef struct {
-  alloc_chunk_extern_t *first_free;
+  uint32_t *map;
+  unsigned int base;
+  int nb_granules;
+  int granule_log2;
+  int free_size;
+  int next_fit;     // Granule where the next allocation starts looking
 } extern_alloc_t;
 
+typedef struct {
+  int free_size;           // Total amount of free memory
+  int nb_free_chunks;      // Number of contiguous free areas
+  int largest_free_chunk;  // Size of the biggest free area
+  int fragmentation;       // Per-mille of free memory not in the biggest area
+  int metadata_size;       // Size of the bitmap in L2
+} extern_alloc_stats_t;
+
 
 /// @cond IMPLEM
 
@@ -45,6 +60,8 @@ void extern_alloc_info(extern_alloc_t *a, int *size, void **first_chunk, int *nb
 
 void extern_alloc_dump(extern_alloc_t *a);
 
+void extern_alloc_get_stats(extern_alloc_t *a, extern_alloc_stats_t *stats);
+
 
 /// @endcond
 
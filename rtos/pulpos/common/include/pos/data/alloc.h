@@ -24,6 +24,62 @@
 
 #ifndef LANGUAGE_ASSEMBLY
 
+typedef struct
+{
+  	int free_size;              // Total amount of free memory
+  	int nb_free_chunks;         // Number of free blocks
+  	int largest_free_chunk;     // Size of the biggest free block
+  	int fragmentation;          // Per-mille of free memory not in the biggest block
+  	unsigned int nb_alloc;
+  	unsigned int nb_free;
+  	unsigned int nb_failed;
+  	unsigned int alloc_cycles_max;
+  	unsigned int alloc_cycles_total;
+  	unsigned int free_cycles_max;
+  	unsigned int free_cycles_total;
+} pos_alloc_stats_t;
+
+#ifdef POS_CONFIG_ALLOC_TLSF
+
+// Two-level segregated fit allocator. Free blocks are kept in lists indexed
+// by a first level (power of 2) and a second level (linear subdivision) so
+// that a suitable block is found in constant time with 2 bit scans.
+#define POS_ALLOC_TLSF_SL_LOG2  3
+#define POS_ALLOC_TLSF_SL_COUNT (1 << POS_ALLOC_TLSF_SL_LOG2)
+#define POS_ALLOC_TLSF_FL_COUNT 20
+
+typedef struct pos_alloc_block_s
+{
+  	int                      size;
+  	struct pos_alloc_block_s *next;
+  	struct pos_alloc_block_s *prev;
+} pos_alloc_chunk_t;
+
+typedef struct
+{
+  	uint32_t fl_bitmap;
+  	uint8_t sl_bitmap[POS_ALLOC_TLSF_FL_COUNT];
+  	pos_alloc_chunk_t *blocks[POS_ALLOC_TLSF_FL_COUNT][POS_ALLOC_TLSF_SL_COUNT];
+  	// One bit per granule, set on the first and last granules of each free
+  	// block, so that neighbours can be coalesced without any header in the
+  	// allocated blocks.
+  	uint32_t *free_map;
+  	char *base;
+  	char *end;
+#ifdef POS_CONFIG_ALLOC_STATS
+  	pos_alloc_stats_t stats;
+#endif
+#ifdef ARCHI_MEMORY_POWER
+  	uint32_t track_pwd;
+  	uint32_t *pwd_count;
+  	uint32_t *ret_count;
+  	uint32_t bank_size_log2;
+  	uint32_t first_bank_addr;
+#endif
+} pos_alloc_t;
+
+#else
+
 typedef struct pos_alloc_block_s
 {
   	int                      size;
@@ -33,6 +89,9 @@ typedef struct pos_alloc_block_s
 typedef struct 
 {
   	pos_alloc_chunk_t *first_free;
+#ifdef POS_CONFIG_ALLOC_STATS
+  	pos_alloc_stats_t stats;
+#endif
 #ifdef ARCHI_MEMORY_POWER
   	uint32_t track_pwd;
   	uint32_t *pwd_count;
@@ -42,6 +101,37 @@ typedef struct
 #endif
 } pos_alloc_t;
 
+#endif
+
+
+typedef struct pos_obj_pool_item_s
+{
+  	struct pos_obj_pool_item_s *next;
+} pos_obj_pool_item_t;
+
+// Pool of fixed-size objects. Objects which have never been allocated are
+// taken from next_unused so that the pool can be statically initialized.
+typedef struct
+{
+  	pos_obj_pool_item_t *first_free;
+  	char *next_unused;
+  	char *base;
+  	char *end;
+  	int obj_size;
+  	// Heap used when the pool is empty, can be NULL
+  	void *(*fallback_alloc)(int size);
+  	void (*fallback_free)(void *chunk, int size);
+  	// Test-and-set lock, only used for pools shared by cluster cores
+  	int lock;
+} pos_obj_pool_t;
+
+// Per-core cache of free objects, to limit contention on cluster pools
+typedef struct
+{
+  	pos_obj_pool_item_t *first_free;
+  	int nb_free;
+} pos_obj_pool_cache_t;
+
 
 struct pi_cl_alloc_req_s
 {
@@ -50,6 +50,44 @@ typedef struct pos_cluster_t {
 extern PI_CL_L1_TINY pos_cluster_call_pool_t pos_cluster_pool;
 
 
+// Part of a persistent cluster queue shared with the cluster, allocated in
+// cluster L1 so that the resident master polls it locally.
+// head is only written by the FC and tail only by the cluster.
+typedef struct
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t notif_pending;
+    struct pi_cluster_task *ring[];
+} pos_cluster_queue_shared_t;
+
+
+// Subset of the cluster cores running its own kernel, with its own
+// hardware barrier
+typedef struct
+{
+    void (*entry)(void *);
+    void *arg;
+    uint32_t core_mask;
+    uint8_t barrier;
+    uint8_t leader;
+    uint8_t done;
+} pi_cl_subteam_t;
+
+
+typedef struct pi_cluster_queue_s {
+    pos_cluster_queue_shared_t *shared;
+    struct pi_device *device;
+    struct pi_cluster_task *resident;
+    uint32_t nb_entries;
+    // Number of tasks pushed and number of completions handled by the FC
+    uint32_t head;
+    uint32_t completed;
+    pi_task_t notif_task;
+    pi_task_t end_task;
+} pi_cluster_queue_t;
+
+
 #endif
 
 #define POS_CLUSTER_CALL_POOL_T_FIRST_CALL_FC_FOR_CL    (0*4)
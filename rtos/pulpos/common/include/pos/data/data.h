@@ -32,6 +32,10 @@
 #define POS_EVENT_CLUSTER_CALL_EVT 1
 #define POS_EVENT_CLUSTER_SYNC     2
 #define POS_EVENT_CLUSTER_TASK     3
+// Used by the OpenMP runtime to wake-up threads waiting for tasks
+#define POS_EVENT_CLUSTER_OMP      4
+// Used to wake-up cores waiting for asynchronous DMA transfers
+#define POS_EVENT_CLUSTER_DMA      5
 
 #define POS_EVENT_FC_ENQUEUE 1
 
@@ -65,8 +69,23 @@
 
 struct pi_task_implem
 {
-    unsigned int time;
-} __attribute__((packed));
+    // Expiration time in timer ticks. Only the low 32 bits are kept, the
+    // upper ones are given by the timer wheel time.
+    uint32_t time;
+    // Period in timer ticks for periodic tasks, 0 otherwise
+    uint32_t period;
+    // Next task in the timer wheel slot list, and the pointer to this task in
+    // the list, or NULL if it is not waiting
+    struct pi_task *timer_next;
+    struct pi_task **timer_pprev;
+    // Set while a periodic task is in the scheduler queue, to not push it twice
+    uint8_t queued;
+    // Scheduling priority, see pi_task_prio_e
+    int8_t priority;
+#ifdef POS_CONFIG_SCHED_STATS
+    uint32_t push_time;
+#endif
+};
 
 
 #define CLUSTER_TASK_CUSTOM 1
@@ -30,6 +30,42 @@ typedef struct
     uint32_t value;
 } pos_cl_mutex_t;
 
+#if defined(ARCHI_HAS_CLUSTER)
+
+typedef union
+{
+    int32_t i32;
+    uint32_t u32;
+    float f32;
+} pi_cl_barrier_slot_t;
+
+// Barrier between an arbitrary set of cluster cores
+typedef struct
+{
+    uint32_t core_mask;
+    uint32_t lock;
+    // Event unit barrier, or -1 for the software barrier
+    int8_t hw_barrier;
+    uint8_t nb_cores;
+    uint8_t count;
+    uint8_t sense;
+    // Sense of the last episode of each core, also selecting the bank of
+    // reduction slots
+    uint8_t core_sense[ARCHI_CLUSTER_NB_PE];
+    pi_cl_barrier_slot_t slots[2][ARCHI_CLUSTER_NB_PE];
+} pi_cl_barrier_t;
+
+// FIFO lock, waiters sleep until their ticket is served
+typedef struct
+{
+    uint32_t lock;
+    uint32_t next;
+    uint32_t serving;
+    uint8_t owner[ARCHI_CLUSTER_NB_PE];
+} pi_cl_ticket_lock_t;
+
+#endif
+
 #endif
 
 #endif
\ No newline at end of file
@@ -25,9 +25,41 @@
 
 #include "pmsis/task.h"
 
+// Number of task priority levels, each one has its own queue
+#ifndef POS_SCHED_NB_PRIO
+#define POS_SCHED_NB_PRIO 4
+#endif
+
+typedef enum
+{
+  PI_TASK_PRIO_LOW      = -1,
+  PI_TASK_PRIO_NORMAL   = 0,    // Default priority
+  PI_TASK_PRIO_HIGH     = 1,
+  PI_TASK_PRIO_CRITICAL = 2,
+} pi_task_prio_e;
+
+typedef struct
+{
+  pi_task_t *first;
+  pi_task_t *last;
+} pos_sched_queue_t;
+
+typedef struct
+{
+  unsigned int nb_tasks;
+  unsigned int latency_total;   // In cycles, from the push to the execution
+  unsigned int latency_max;
+} pos_sched_stats_t;
+
+// Tasks pushed from assembly handlers, which are sorted into the priority
+// queues by the scheduler.
 extern PI_FC_TINY pi_task_t *pos_sched_first;
 extern PI_FC_TINY pi_task_t *pos_sched_last;
 
+// Ready tasks, per priority, and bitmap of the non-empty queues
+extern PI_FC_TINY uint32_t pos_sched_prio_map;
+extern PI_FC_L1 pos_sched_queue_t pos_sched_queues[POS_SCHED_NB_PRIO];
+
 
 #endif
 
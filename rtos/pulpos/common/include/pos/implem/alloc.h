@@ -35,6 +35,48 @@ void *pos_alloc_align(pos_alloc_t *a, int size, int align);
 
 void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size);
 
+void pos_alloc_get_stats(pos_alloc_t *a, pos_alloc_stats_t *stats);
+
+#ifdef POS_CONFIG_ALLOC_STATS
+
+// Latencies are measured with the cycle counter of the performance
+// counters, which must have been started with pi_perf_start.
+#ifndef POS_ALLOC_TIMESTAMP
+#if defined(TIMER_VERSION) && TIMER_VERSION >= 2
+#define POS_ALLOC_TIMESTAMP() pi_perf_read(PI_PERF_CYCLES)
+#else
+#define POS_ALLOC_TIMESTAMP() 0
+#endif
+#endif
+
+#define POS_ALLOC_STATS_START() unsigned int __pos_alloc_start = POS_ALLOC_TIMESTAMP()
+
+static inline void pos_alloc_stats_account(unsigned int start, unsigned int *max, unsigned int *total, unsigned int *count)
+{
+  unsigned int cycles = POS_ALLOC_TIMESTAMP() - start;
+  if (cycles > *max)
+    *max = cycles;
+  *total += cycles;
+  (*count)++;
+}
+
+#define POS_ALLOC_STATS_ALLOC(a, result) \
+  do { \
+    if ((result) == NULL) (a)->stats.nb_failed++; \
+    pos_alloc_stats_account(__pos_alloc_start, &(a)->stats.alloc_cycles_max, &(a)->stats.alloc_cycles_total, &(a)->stats.nb_alloc); \
+  } while(0)
+
+#define POS_ALLOC_STATS_FREE(a) \
+  pos_alloc_stats_account(__pos_alloc_start, &(a)->stats.free_cycles_max, &(a)->stats.free_cycles_total, &(a)->stats.nb_free)
+
+#else
+
+#define POS_ALLOC_STATS_START()
+#define POS_ALLOC_STATS_ALLOC(a, result)
+#define POS_ALLOC_STATS_FREE(a)
+
+#endif
+
 static inline void *pi_cl_l2_malloc_wait(pi_cl_alloc_req_t *req)
 {
   while((*(volatile char *)&req->done) == 0)
@@ -25,6 +25,33 @@
 void pos_cluster_push_fc_event(pi_task_t *event);
 
 
+/*
+ * Persistent cluster queue
+ *
+ * A resident cluster task is started once and then executes the cluster
+ * tasks pushed to the queue, so that each offload only costs a few stores
+ * instead of a full cluster task dispatch. The queued tasks run on the
+ * cluster master with the stacks and cores of the resident task, and
+ * their entry can fork to the team as usual.
+ * Pushing is lock-free and does not disable interrupts, but is only
+ * allowed from one FC context at a time, and not from interrupt handlers.
+ * Completions are notified to the FC in batches, with at most one
+ * notification in flight.
+ */
+
+// Start the resident task on the cluster. The resident task must be
+// initialized with pi_cluster_task, its entry is overwritten, and its stack
+// and core settings apply to all queued tasks.
+int pi_cluster_queue_open(struct pi_device *device, pi_cluster_queue_t *queue, struct pi_cluster_task *resident, int nb_entries);
+
+// Push a task to the queue. The completion task, which can be NULL, is
+// pushed when the task is done. Returns -1 if the queue is full.
+int pi_cluster_queue_push(pi_cluster_queue_t *queue, struct pi_cluster_task *task, pi_task_t *done);
+
+// Wait until all pushed tasks are done, then stop the resident task
+void pi_cluster_queue_close(pi_cluster_queue_t *queue);
+
+
 static inline void pos_cluster_notif_req_done(int cid)
 {
     eu_evt_trig(eu_evt_trig_cluster_addr(cid, POS_EVENT_CLUSTER_CALL_EVT), 0);
@@ -29,6 +29,68 @@ struct pi_cl_dma_cmd_s
 };
 
 
+/*
+ * ND transfers
+ *
+ * A tile of up to 4 dimensions is described by the size of its contiguous
+ * lines, and for each outer dimension, from the innermost one, the number
+ * of items and their stride in external memory. The tile is contiguous in
+ * cluster memory.
+ * The transfer is split into as few hardware commands as possible, with
+ * no size limit, and all of them share the same counter so that the whole
+ * tile is waited with a single pi_cl_dma_cmd_wait.
+ * A descriptor with empty lines or with more than PI_CL_DMA_ND_MAX_DIMS
+ * dimensions is rejected with -1, and then no transfer must be waited.
+ */
+
+#define PI_CL_DMA_ND_MAX_DIMS 4
+
+typedef struct pi_cl_dma_nd_s
+{
+  uint32_t ext;
+  uint32_t loc;
+  uint32_t line_size;
+  uint32_t length[PI_CL_DMA_ND_MAX_DIMS-1];
+  uint32_t stride[PI_CL_DMA_ND_MAX_DIMS-1];
+  uint8_t nb_dims;
+  uint8_t dir;
+} pi_cl_dma_nd_t;
+
+int pos_cl_dma_nd(pi_cl_dma_nd_t *desc, pi_cl_dma_cmd_t *cmd);
+
+
+/*
+ * Asynchronous transfers
+ *
+ * The transfer raises an interrupt on the cluster master when it is done.
+ * If a callback was set, it is executed by the interrupt handler, or by a
+ * core waiting for a transfer if it sees it first, otherwise
+ * the transfer is put in the completion queue, from where it can be
+ * retrieved with pi_cl_dma_wait_any, or waited individually with
+ * pi_cl_dma_async_wait. Callbacks must be short as they are executed with
+ * interrupts disabled.
+ */
+
+typedef struct pi_cl_dma_async_s
+{
+  struct pi_cl_dma_async_s *next;
+  void (*callback)(void *arg);
+  void *arg;
+  int id;
+  uint8_t done;
+} pi_cl_dma_async_t;
+
+void pi_cl_dma_async_cmd(uint32_t ext, uint32_t loc, uint32_t size, pi_cl_dma_dir_e dir, pi_cl_dma_async_t *copy);
+
+void pi_cl_dma_async_cmd_2d(uint32_t ext, uint32_t loc, uint32_t size, uint32_t stride, uint32_t length, pi_cl_dma_dir_e dir, pi_cl_dma_async_t *copy);
+
+void pi_cl_dma_async_wait(pi_cl_dma_async_t *copy);
+
+// Wait until a transfer without callback is done and return it, or return
+// NULL if there is none in flight
+pi_cl_dma_async_t *pi_cl_dma_wait_any();
+
+
 static inline void __cl_dma_flush()
 {
   plp_dma_barrier();
@@ -95,38 +157,6 @@ static inline void __cl_dma_memcpy_safe(unsigned int ext, unsigned int loc, unsi
 }
 
 
-#if 0
-static inline void __cl_dma_memcpy_irq(unsigned int ext, unsigned int loc, unsigned short size, pi_cl_dma_dir_e dir, int merge, pi_cl_dma_cmd_t *copy)
-{
-  eu_mutex_lock_from_id(0);
-  
-  int id = -1;
-  if (!merge) id = plp_dma_counter_alloc();
-  unsigned int cmd = plp_dma_getCmd(dir, size, PLP_DMA_1D, PLP_DMA_NO_TRIG_EVT, PLP_DMA_TRIG_IRQ, PLP_DMA_SHARED);
-  // Prevent the compiler from pushing the transfer before all previous
-  // stores are done
-  __asm__ __volatile__ ("" : : : "memory");
-  plp_dma_cmd_push(cmd, loc, ext);
-  if (!merge) copy->id = id;
-
-  if (pos_cluster_dma_first)
-  {
-    pos_cluster_dma_last->next = copy;
-  }
-  else
-  {
-    pos_cluster_dma_first = copy;    
-  }
-
-  copy->next = NULL;
-  pos_cluster_dma_last = NULL;  
-
-  eu_mutex_unlock_from_id(0);
-}
-#endif
-
-
-
 static inline void __cl_dma_memcpy_2d(unsigned int ext, unsigned int loc, unsigned int size, unsigned int stride, unsigned short length, pi_cl_dma_dir_e dir, int merge, pi_cl_dma_cmd_t *copy)
 {
   eu_mutex_lock_from_id(0);
@@ -189,6 +219,38 @@ static inline void pi_cl_dma_cmd_2d(uint32_t ext, uint32_t loc, uint32_t size, u
 }
 
 
+static inline pi_cl_dma_async_t *pi_cl_dma_async_init(pi_cl_dma_async_t *copy)
+{
+  copy->callback = NULL;
+  return copy;
+}
+
+
+static inline pi_cl_dma_async_t *pi_cl_dma_async_callback(pi_cl_dma_async_t *copy, void (*callback)(void *arg), void *arg)
+{
+  copy->callback = callback;
+  copy->arg = arg;
+  return copy;
+}
+
+
+static inline int pi_cl_dma_cmd_nd(pi_cl_dma_nd_t *desc, pi_cl_dma_cmd_t *cmd)
+{
+  return pos_cl_dma_nd(desc, cmd);
+}
+
+
+static inline int pi_cl_dma_cmd_3d(uint32_t ext, uint32_t loc, uint32_t line_size, uint32_t stride1, uint32_t length1, uint32_t stride2, uint32_t length2, pi_cl_dma_dir_e dir, pi_cl_dma_cmd_t *cmd)
+{
+  pi_cl_dma_nd_t desc = {
+    .ext = ext, .loc = loc, .line_size = line_size,
+    .length = { length1, length2 }, .stride = { stride1, stride2 },
+    .nb_dims = 3, .dir = dir
+  };
+  return pos_cl_dma_nd(&desc, cmd);
+}
+
+
 static inline void pi_cl_dma_cmd_wait(pi_cl_dma_cmd_t *cmd)
 {
   __cl_dma_wait((pi_cl_dma_cmd_t *)cmd);
@@ -124,6 +124,7 @@ static inline void pmsis_exit(int err)
 #include "kernel.h"
 #include "dma.h"
 #include "lock.h"
+#include "obj_pool.h"
 
 // #ifdef ARCHI_UDMA_HAS_HYPER
 // #include "pos/implem/hyperbus-v2.h"
@@ -101,4 +101,229 @@ static inline void pos_cl_mutex_unlock(pos_cl_mutex_t *mutex)
 }
 
 
-#endif
\ No newline at end of file
+#if defined(ARCHI_HAS_CLUSTER)
+
+/*
+ * Cluster synchronization
+ *
+ * Barriers between any set of cluster cores, possibly combining one value
+ * from each core, and FIFO ticket locks. Waiting cores sleep on the
+ * POS_EVENT_CLUSTER_SYNC event and are only woken up by the core which
+ * releases them. Without the software events of the event unit, the cores
+ * spin instead.
+ * The counters are protected by the L1 test-and-set lock of each object, not
+ * by a global mutex, so barriers and ticket locks can be used while holding
+ * a team critical section or another cluster lock. They must thus be
+ * allocated in the cluster L1.
+ *
+ * A barrier can also be mapped to an event unit barrier, which is the
+ * fastest. Only the last POS_CL_NB_SYNC_HW_BARRIERS ones can be used, the
+ * others belong to the main team and to the sub-teams.
+ */
+
+#if defined(EU_VERSION) && EU_VERSION >= 3
+#define POS_CL_SYNC_HAS_EU 1
+#endif
+
+
+static inline void pos_cl_sync_lock(uint32_t *lock)
+{
+    while(pos_tas_lock_32((uint32_t)lock) == -1)
+    {
+    }
+    hal_compiler_barrier();
+}
+
+
+static inline void pos_cl_sync_unlock(uint32_t *lock)
+{
+    hal_compiler_barrier();
+    pos_tas_unlock_32((uint32_t)lock, 0);
+}
+
+
+static inline void pos_cl_sync_wait()
+{
+#ifdef POS_CL_SYNC_HAS_EU
+    eu_evt_maskWaitAndClr(1<<POS_EVENT_CLUSTER_SYNC);
+#endif
+}
+
+
+static inline void pos_cl_sync_wakeup(uint32_t core_mask)
+{
+#ifdef POS_CL_SYNC_HAS_EU
+    if (core_mask)
+        eu_evt_trig(eu_evt_trig_addr(POS_EVENT_CLUSTER_SYNC), core_mask);
+#endif
+}
+
+
+// hw_barrier is the event unit barrier to use, from
+// POS_CL_FIRST_SYNC_HW_BARRIER to ARCHI_EU_NB_HW_BARRIERS-1, or -1 for the
+// software one
+static inline int pi_cl_barrier_init(pi_cl_barrier_t *barrier, uint32_t core_mask, int hw_barrier)
+{
+    if (hw_barrier >= ARCHI_EU_NB_HW_BARRIERS ||
+        (hw_barrier >= 0 && hw_barrier < POS_CL_FIRST_SYNC_HW_BARRIER))
+        return -1;
+
+    barrier->core_mask = core_mask;
+    barrier->lock = 0;
+    barrier->nb_cores = __builtin_popcount(core_mask);
+    barrier->count = 0;
+    barrier->sense = 0;
+    for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+    {
+        barrier->core_sense[i] = 0;
+    }
+
+#ifdef POS_CL_SYNC_HAS_EU
+    barrier->hw_barrier = hw_barrier;
+    if (hw_barrier >= 0)
+        eu_bar_setup_mask(eu_bar_addr(hw_barrier), core_mask, core_mask);
+#else
+    barrier->hw_barrier = -1;
+#endif
+
+    return 0;
+}
+
+
+static inline void pos_cl_barrier_wait(pi_cl_barrier_t *barrier, int core_id, int sense)
+{
+    hal_compiler_barrier();
+
+#ifdef POS_CL_SYNC_HAS_EU
+    if (barrier->hw_barrier >= 0)
+    {
+        eu_bar_trig_wait_clr(eu_bar_addr(barrier->hw_barrier));
+        hal_compiler_barrier();
+        return;
+    }
+#endif
+
+    pos_cl_sync_lock(&barrier->lock);
+    int last = ++barrier->count == barrier->nb_cores;
+    if (last)
+        barrier->count = 0;
+    pos_cl_sync_unlock(&barrier->lock);
+
+    // The other cores cannot enter the next episode before the sense is
+    // flipped, so the count can be reset before
+    if (last)
+    {
+        *(volatile uint8_t *)&barrier->sense = sense;
+        pos_cl_sync_wakeup(barrier->core_mask & ~(1 << core_id));
+    }
+    else
+    {
+        while (*(volatile uint8_t *)&barrier->sense != sense)
+        {
+            pos_cl_sync_wait();
+        }
+    }
+
+    hal_compiler_barrier();
+}
+
+
+// Returns the sense of the new episode, which selects the reduction slots
+static inline int pos_cl_barrier_flip(pi_cl_barrier_t *barrier, int core_id)
+{
+    int sense = barrier->core_sense[core_id] ^ 1;
+    barrier->core_sense[core_id] = sense;
+    return sense;
+}
+
+
+static inline void pi_cl_barrier_wait(pi_cl_barrier_t *barrier)
+{
+    int core_id = pi_core_id();
+    pos_cl_barrier_wait(barrier, core_id, pos_cl_barrier_flip(barrier, core_id));
+}
+
+
+/*
+ * Barrier with reduction. Each core publishes its value in its slot and,
+ * after the barrier, combines the slots of all the cores by itself, which
+ * is cheaper than broadcasting the result for a few cores. The slots of
+ * the next episode are in the other bank, so a slow core can still read
+ * them while the others continue.
+ */
+
+#define POS_CL_BARRIER_REDUCE(name, type, field, expr)                                  \
+static inline type pi_cl_barrier_reduce_##name(pi_cl_barrier_t *barrier, type value)    \
+{                                                                                       \
+    int core_id = pi_core_id();                                                         \
+    int sense = pos_cl_barrier_flip(barrier, core_id);                                  \
+    pi_cl_barrier_slot_t *slots = barrier->slots[sense];                                \
+                                                                                        \
+    slots[core_id].field = value;                                                       \
+    pos_cl_barrier_wait(barrier, core_id, sense);                                       \
+                                                                                        \
+    uint32_t mask = barrier->core_mask;                                                 \
+    type a = slots[__builtin_ctz(mask)].field;                                          \
+    mask &= mask - 1;                                                                   \
+    while (mask)                                                                        \
+    {                                                                                   \
+        type b = slots[__builtin_ctz(mask)].field;                                      \
+        a = (expr);                                                                     \
+        mask &= mask - 1;                                                               \
+    }                                                                                   \
+                                                                                        \
+    return a;                                                                           \
+}
+
+POS_CL_BARRIER_REDUCE(add_i32, int32_t, i32, a + b)
+POS_CL_BARRIER_REDUCE(min_i32, int32_t, i32, a < b ? a : b)
+POS_CL_BARRIER_REDUCE(max_i32, int32_t, i32, a > b ? a : b)
+POS_CL_BARRIER_REDUCE(add_u32, uint32_t, u32, a + b)
+POS_CL_BARRIER_REDUCE(add_f32, float, f32, a + b)
+POS_CL_BARRIER_REDUCE(min_f32, float, f32, a < b ? a : b)
+POS_CL_BARRIER_REDUCE(max_f32, float, f32, a > b ? a : b)
+
+
+static inline void pi_cl_ticket_lock_init(pi_cl_ticket_lock_t *lock)
+{
+    lock->lock = 0;
+    lock->next = 0;
+    lock->serving = 0;
+}
+
+
+static inline void pi_cl_ticket_lock(pi_cl_ticket_lock_t *lock)
+{
+    pos_cl_sync_lock(&lock->lock);
+    uint32_t ticket = lock->next;
+    // The owner must be visible before the ticket is taken, as it is used
+    // by the unlock to wake up only the next core
+    lock->owner[ticket % ARCHI_CLUSTER_NB_PE] = pi_core_id();
+    hal_compiler_barrier();
+    *(volatile uint32_t *)&lock->next = ticket + 1;
+    pos_cl_sync_unlock(&lock->lock);
+
+    while (*(volatile uint32_t *)&lock->serving != ticket)
+    {
+        pos_cl_sync_wait();
+    }
+
+    hal_compiler_barrier();
+}
+
+
+static inline void pi_cl_ticket_unlock(pi_cl_ticket_lock_t *lock)
+{
+    hal_compiler_barrier();
+
+    uint32_t ticket = lock->serving + 1;
+    *(volatile uint32_t *)&lock->serving = ticket;
+
+    // A core taking the ticket after this check sees it already served
+    if (*(volatile uint32_t *)&lock->next != ticket)
+        pos_cl_sync_wakeup(1 << lock->owner[ticket % ARCHI_CLUSTER_NB_PE]);
+}
+
+#endif
+
+#endif
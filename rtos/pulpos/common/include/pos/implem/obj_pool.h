@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __POS_IMPLEM_OBJ_POOL_H__
+#define __POS_IMPLEM_OBJ_POOL_H__
+
+/*
+ * Pools of fixed-size objects, for control blocks which are frequently
+ * allocated and freed. Getting and putting an object is constant time and
+ * does not fragment the heaps. The objects must be at least as big as a
+ * pointer, as the free list is stored in the free objects.
+ *
+ * Example, for a pool of 4 file descriptors in L2, which falls back to the
+ * L2 heap when all of them are used:
+ *   POS_OBJ_POOL(file_pool, my_file_t, 4, PI_L2, pi_l2_malloc, pi_l2_free);
+ */
+
+#define POS_OBJ_POOL(name, type, nb, mem_attr, alloc, free)        \
+  static mem_attr type name##_objs[nb];                            \
+  static mem_attr pos_obj_pool_t name = {                          \
+    .first_free = NULL,                                            \
+    .next_unused = (char *)name##_objs,                            \
+    .base = (char *)name##_objs,                                   \
+    .end = (char *)&name##_objs[nb],                               \
+    .obj_size = sizeof(type),                                      \
+    .fallback_alloc = alloc,                                       \
+    .fallback_free = free,                                         \
+    .lock = 0                                                      \
+  }
+
+// Initialize a pool at runtime, for pools in memories which lose their
+// content, like the cluster L1 when the cluster is powered down
+static inline void pos_obj_pool_init(pos_obj_pool_t *pool, void *objs, int nb, int obj_size)
+{
+  pool->first_free = NULL;
+  pool->next_unused = (char *)objs;
+  pool->base = (char *)objs;
+  pool->end = (char *)objs + nb*obj_size;
+  pool->obj_size = obj_size;
+  pool->fallback_alloc = NULL;
+  pool->fallback_free = NULL;
+  pool->lock = 0;
+}
+
+#ifndef POS_OBJ_POOL_CACHE_BATCH
+#define POS_OBJ_POOL_CACHE_BATCH 4
+#endif
+
+
+static inline void *pos_obj_pool_pop(pos_obj_pool_t *pool)
+{
+  pos_obj_pool_item_t *item = pool->first_free;
+  if (item)
+  {
+    pool->first_free = item->next;
+    return (void *)item;
+  }
+
+  if (pool->next_unused < pool->end)
+  {
+    void *result = (void *)pool->next_unused;
+    pool->next_unused += pool->obj_size;
+    return result;
+  }
+
+  return NULL;
+}
+
+
+static inline void pos_obj_pool_push(pos_obj_pool_t *pool, void *obj)
+{
+  pos_obj_pool_item_t *item = (pos_obj_pool_item_t *)obj;
+  item->next = pool->first_free;
+  pool->first_free = item;
+}
+
+
+static inline int pos_obj_pool_owns(pos_obj_pool_t *pool, void *obj)
+{
+  return (char *)obj >= pool->base && (char *)obj < pool->end;
+}
+
+
+// Get an object from the fabric controller
+static inline void *pos_obj_pool_get(pos_obj_pool_t *pool)
+{
+  int irq = disable_irq();
+  void *result = pos_obj_pool_pop(pool);
+  restore_irq(irq);
+
+  if (result == NULL && pool->fallback_alloc)
+    result = pool->fallback_alloc(pool->obj_size);
+
+  return result;
+}
+
+
+// Give back an object from the fabric controller
+static inline void pos_obj_pool_put(pos_obj_pool_t *pool, void *obj)
+{
+  if (pos_obj_pool_owns(pool, obj))
+  {
+    int irq = disable_irq();
+    pos_obj_pool_push(pool, obj);
+    restore_irq(irq);
+  }
+  else if (pool->fallback_free)
+  {
+    pool->fallback_free(obj, pool->obj_size);
+  }
+}
+
+
+#if defined(ARCHI_HAS_CLUSTER)
+
+/*
+ * Cluster side. The pool must be declared in cluster L1 so that its lock can
+ * use the test-and-set alias. Each core keeps a few free objects in its own
+ * cache and only takes the lock to exchange a batch with the pool.
+ * There is no heap fallback as the cluster cannot allocate by itself.
+ */
+
+static inline void pos_obj_pool_lock(pos_obj_pool_t *pool)
+{
+  while (pos_tas_lock_32((unsigned int)&pool->lock) == -1)
+  {
+  }
+}
+
+
+static inline void pos_obj_pool_unlock(pos_obj_pool_t *pool)
+{
+  pos_tas_unlock_32((unsigned int)&pool->lock, 0);
+}
+
+
+static inline void *pos_obj_pool_cl_get(pos_obj_pool_t *pool, pos_obj_pool_cache_t *caches)
+{
+  pos_obj_pool_cache_t *cache = &caches[hal_core_id()];
+
+  if (cache->first_free == NULL)
+  {
+    pos_obj_pool_lock(pool);
+    for (int i=0; i<POS_OBJ_POOL_CACHE_BATCH; i++)
+    {
+      pos_obj_pool_item_t *item = (pos_obj_pool_item_t *)pos_obj_pool_pop(pool);
+      if (item == NULL)
+        break;
+      item->next = cache->first_free;
+      cache->first_free = item;
+      cache->nb_free++;
+    }
+    pos_obj_pool_unlock(pool);
+
+    if (cache->first_free == NULL)
+      return NULL;
+  }
+
+  pos_obj_pool_item_t *item = cache->first_free;
+  cache->first_free = item->next;
+  cache->nb_free--;
+
+  return (void *)item;
+}
+
+
+static inline void pos_obj_pool_cl_put(pos_obj_pool_t *pool, pos_obj_pool_cache_t *caches, void *obj)
+{
+  pos_obj_pool_cache_t *cache = &caches[hal_core_id()];
+  pos_obj_pool_item_t *item = (pos_obj_pool_item_t *)obj;
+
+  item->next = cache->first_free;
+  cache->first_free = item;
+  cache->nb_free++;
+
+  if (cache->nb_free > 2*POS_OBJ_POOL_CACHE_BATCH)
+  {
+    pos_obj_pool_lock(pool);
+    for (int i=0; i<POS_OBJ_POOL_CACHE_BATCH; i++)
+    {
+      item = cache->first_free;
+      cache->first_free = item->next;
+      pos_obj_pool_push(pool, item);
+    }
+    cache->nb_free -= POS_OBJ_POOL_CACHE_BATCH;
+    pos_obj_pool_unlock(pool);
+  }
+}
+
+#endif
+
+#endif
@@ -22,6 +22,22 @@
 #define __POS_IMPLEM_PE_H__
 
 
+// The event unit barrier area has room for more barriers than the ones
+// which are implemented
+#ifndef ARCHI_EU_NB_HW_BARRIERS
+#define ARCHI_EU_NB_HW_BARRIERS 8
+#endif
+
+// Event unit barriers 0 and 1 are used by the main team, the next ones by the
+// sub-teams and the last POS_CL_NB_SYNC_HW_BARRIERS ones are left for the
+// cluster barriers, so that a sub-team and a cluster barrier never share one.
+#ifndef POS_CL_NB_SYNC_HW_BARRIERS
+#define POS_CL_NB_SYNC_HW_BARRIERS 2
+#endif
+
+#define POS_CL_FIRST_SYNC_HW_BARRIER (ARCHI_EU_NB_HW_BARRIERS - POS_CL_NB_SYNC_HW_BARRIERS)
+
+
 static inline void pos_team_cc_barrier()
 {
 #ifdef ARCHI_CC_CORE_ID
@@ -154,6 +170,110 @@ static inline void pi_cluster_pe_piped_task_push(pi_cluster_pe_task_t *task, pi_
     eu_mutex_unlock_from_id(0);
 }
 
+/*
+ * Sub-teams
+ *
+ * The cluster can be split into sub-teams, each running a different kernel
+ * concurrently and synchronizing with its own event unit barrier, for
+ * example to overlap a DMA-bound layer on 2 cores with compute on the
+ * other ones. Sub-teams are forked by the cluster master while the other
+ * cores are idle, and the master can either be part of one of them or
+ * keep running its own code until it joins them.
+ * The HW barriers 0 and 1 are used by the main team, sub-team i uses
+ * barrier 2+i, and the last ones are kept for the cluster barriers.
+ */
+
+#define PI_CL_NB_SUBTEAMS (POS_CL_FIRST_SYNC_HW_BARRIER - 2)
+
+void pos_cl_subteam_entry(pi_cl_subteam_t *team);
+
+
+// Also used to resize a sub-team, which must not be running
+static inline int pi_cl_subteam_init(pi_cl_subteam_t *team, int id, uint32_t core_mask)
+{
+    // The leader is the first core of the mask, so a sub-team needs at
+    // least one core
+    if (id < 0 || id >= PI_CL_NB_SUBTEAMS || core_mask == 0)
+        return -1;
+
+    team->core_mask = core_mask;
+    team->barrier = 2 + id;
+    team->leader = __builtin_ctz(core_mask);
+    eu_bar_setup_mask(eu_bar_addr(team->barrier), core_mask, core_mask);
+
+    return 0;
+}
+
+
+static inline int pi_cl_subteam_nb_cores(pi_cl_subteam_t *team)
+{
+    return __builtin_popcount(team->core_mask);
+}
+
+
+// Index of the calling core in the sub-team, from 0 to nb_cores-1
+static inline int pi_cl_subteam_rank(pi_cl_subteam_t *team)
+{
+    return __builtin_popcount(team->core_mask & ((1 << pi_core_id()) - 1));
+}
+
+
+static inline void pi_cl_subteam_barrier(pi_cl_subteam_t *team)
+{
+    hal_compiler_barrier();
+    eu_bar_trig_wait_clr(eu_bar_addr(team->barrier));
+    hal_compiler_barrier();
+}
+
+
+// Start the kernel on the sub-team cores other than the master, and
+// return immediately
+static inline void pi_cl_subteam_fork_async(pi_cl_subteam_t *team, void (*entry)(void *), void *arg)
+{
+    uint32_t slave_mask = team->core_mask & ~(1 << pi_core_id());
+
+    team->entry = entry;
+    team->arg = arg;
+    team->done = 0;
+
+    if (slave_mask)
+    {
+        // The main team configuration is kept for pi_cl_team_fork calls
+        // which do not reconfigure it
+        unsigned int team_config = eu_dispatch_team_config_read();
+        hal_compiler_barrier();
+        eu_dispatch_team_config(slave_mask);
+        // Bit 0 tells the slaves to go back to the dispatch loop without
+        // the end of fork barrier, which is done by the entry
+        eu_dispatch_push((int)pos_cl_subteam_entry | 1);
+        eu_dispatch_push((int)team);
+        eu_dispatch_team_config(team_config);
+    }
+}
+
+
+// Wait until the sub-team kernel is done
+static inline void pi_cl_subteam_join(pi_cl_subteam_t *team)
+{
+    while (*(volatile uint8_t *)&team->done == 0)
+    {
+        eu_evt_maskWaitAndClr(1<<POS_EVENT_CLUSTER_CALL_EVT);
+    }
+}
+
+
+static inline void pi_cl_subteam_fork(pi_cl_subteam_t *team, void (*entry)(void *), void *arg)
+{
+    pi_cl_subteam_fork_async(team, entry, arg);
+
+    if (team->core_mask & (1 << pi_core_id()))
+        pos_cl_subteam_entry(team);
+
+    pi_cl_subteam_join(team);
+}
+
+
+
 #endif
 
 
@@ -30,6 +30,20 @@ void pos_task_handle_blocking(void *arg);
 void pos_task_handle();
 void pos_task_remote_enqueue();
 
+// Push the task every period_us micro-seconds, starting one period from now,
+// until it is cancelled. An occurrence is skipped if the previous one has not
+// been executed yet, and the occurrences missed because the timer interrupt
+// was handled late are skipped too.
+// As for pi_task_push_delayed_us, a task which is still waiting must be
+// cancelled before being pushed again.
+void pi_task_push_periodic_us(pi_task_t *task, uint32_t period_us);
+
+// Cancel a delayed or periodic task which has not expired yet.
+// Return 0 if it was cancelled or -1 if it was not waiting. The task must
+// have been initialized with pi_task_block or pi_task_callback, or already
+// pushed with a delay.
+int pi_task_cancel_delayed(pi_task_t *task);
+
 
 static inline void pi_task_destroy(pi_task_t *task)
 {
@@ -53,21 +67,43 @@ static inline struct pi_task *pi_task_block(struct pi_task *task)
 	task->arg[0] = (uint32_t)pos_task_handle_blocking;
 	task->arg[1] = (uint32_t)task;
   	task->done = 0;
+  	task->implem.timer_pprev = NULL;
+  	task->implem.priority = PI_TASK_PRIO_NORMAL;
   	return task;
 }
 
+#ifdef POS_CONFIG_SCHED_STATS
+void pos_sched_stats_push(pi_task_t *task);
+#endif
+
+// Return the statistics of the tasks executed with the specified priority
+void pos_sched_get_stats(int priority, pos_sched_stats_t *stats);
+
+static inline int pos_sched_prio_index(pi_task_t *task)
+{
+    return (task->implem.priority - PI_TASK_PRIO_LOW) & (POS_SCHED_NB_PRIO - 1);
+}
+
 static inline void __attribute__((always_inline)) pos_task_push_locked(pi_task_t *task)
 {
+    int prio = pos_sched_prio_index(task);
+    pos_sched_queue_t *queue = &pos_sched_queues[prio];
+
+#ifdef POS_CONFIG_SCHED_STATS
+    pos_sched_stats_push(task);
+#endif
+
   	task->next = NULL;
-  	if (pos_sched_first)
+  	if (queue->first)
   	{
-    	pos_sched_last->next = task;
+    	queue->last->next = task;
   	}
   	else
   	{
-    	pos_sched_first = task;
+    	queue->first = task;
+    	pos_sched_prio_map |= 1 << prio;
   	}
-  	pos_sched_last = task;
+  	queue->last = task;
 }
 
 
@@ -83,6 +119,18 @@ static inline struct pi_task *pi_task_callback(struct pi_task *task, void (*call
 {
     task->arg[0] = (uint32_t)callback;
     task->arg[1] = (uint32_t)arg;
+    task->implem.timer_pprev = NULL;
+    task->implem.priority = PI_TASK_PRIO_NORMAL;
+    return task;
+}
+
+
+// Set the priority of the task, which must be done after the task is
+// initialized. Ready tasks are executed by decreasing priority, and in
+// order of arrival for the same priority.
+static inline struct pi_task *pi_task_priority(struct pi_task *task, int priority)
+{
+    task->implem.priority = priority;
     return task;
 }
 
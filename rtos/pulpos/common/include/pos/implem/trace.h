@@ -53,11 +53,37 @@
 #define WARNING_ABORT()
 #endif
 
+#if defined(POS_CONFIG_TRACE_BINARY) && POS_CONFIG_TRACE_BINARY == 1
+
+/*
+ * Binary traces. Messages are not formatted on the target, only the offset
+ * of the format string and the arguments are recorded, see kernel/trace.c.
+ * The format strings are only kept in the ELF file, in the non-loaded
+ * section .pos_trace_fmt, and pos-trace formats the messages on the host.
+ * Arguments are recorded as 32 bits words, so there can be at most 8 of
+ * them and they cannot be 64 bits integers or floating-point numbers.
+ */
+
+void pos_trace_record(uint32_t fmt, int nb_args, ...);
+
+#define POS_TRACE_NB_ARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define POS_TRACE_NB_ARGS(x...) POS_TRACE_NB_ARGS_(0, ##x, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+#define POS_MSG(fmt, x...) \
+  do { \
+    static const char __pos_trace_fmt[] __attribute__((section(".pos_trace_fmt"), used)) = fmt; \
+    pos_trace_record((uint32_t)__pos_trace_fmt, POS_TRACE_NB_ARGS(x), ##x); \
+  } while(0)
+
+#else
+
 #define POS_MSG(fmt, x...) \
   do { \
     printf("[\033[35mPOS(%d,%d)\033[0m] " fmt, hal_cluster_id(), hal_core_id(), ##x); \
   } while(0)
 
+#endif
+
 #define POS_FATAL(fmt, x...) \
   do { \
     printf("[\033[33FATAL:POS(%d,%d)\033[0m] " fmt, hal_cluster_id(), hal_core_id(), ##x); \
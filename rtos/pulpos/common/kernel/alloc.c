@@ -28,7 +28,9 @@
 // and actually 8 to fit free chunk header size and make sure a e free block to always have
 // at least the size of the header.
 // This also requires the initial chunk to be correctly aligned.
+#ifndef MIN_CHUNK_SIZE
 #define MIN_CHUNK_SIZE 8
+#endif
 
 #define ALIGN_UP(addr,size)   (((addr) + (size) - 1) & ~((size) - 1))
 #define ALIGN_DOWN(addr,size) ((addr) & ~((size) - 1))
@@ -38,7 +40,7 @@
 #endif
 
 
-void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size);
+static void __pos_free(pos_alloc_t *a, void *_chunk, int size);
 
 
 /*
@@ -90,6 +92,32 @@ void pos_alloc_dump(pos_alloc_t *a)
     printf("=============================================\n");
 }
 
+void pos_alloc_get_stats(pos_alloc_t *a, pos_alloc_stats_t *stats)
+{
+    memset(stats, 0, sizeof(pos_alloc_stats_t));
+
+    for (pos_alloc_chunk_t *pt = a->first_free; pt; pt = pt->next)
+    {
+        stats->free_size += pt->size;
+        stats->nb_free_chunks++;
+        if (pt->size > stats->largest_free_chunk)
+            stats->largest_free_chunk = pt->size;
+    }
+
+    if (stats->free_size)
+        stats->fragmentation = 1000 - (int)(((long long)stats->largest_free_chunk * 1000) / stats->free_size);
+
+#ifdef POS_CONFIG_ALLOC_STATS
+    stats->nb_alloc = a->stats.nb_alloc;
+    stats->nb_free = a->stats.nb_free;
+    stats->nb_failed = a->stats.nb_failed;
+    stats->alloc_cycles_max = a->stats.alloc_cycles_max;
+    stats->alloc_cycles_total = a->stats.alloc_cycles_total;
+    stats->free_cycles_max = a->stats.free_cycles_max;
+    stats->free_cycles_total = a->stats.free_cycles_total;
+#endif
+}
+
 
 
 #if 0 //#ifdef ARCHI_MEMORY_POWER
@@ -177,12 +205,15 @@ void pos_alloc_conf(pos_alloc_t *a, void *chunk, int size, pos_alloc_conf_e conf
 
 void pos_alloc_init(pos_alloc_t *a, void *_chunk, int size)
 {
-    pos_alloc_chunk_t *chunk = (pos_alloc_chunk_t *)ALIGN_UP((int)_chunk, MIN_CHUNK_SIZE);
+    pos_alloc_chunk_t *chunk = (pos_alloc_chunk_t *)ALIGN_UP((uintptr_t)_chunk, MIN_CHUNK_SIZE);
 #ifdef ARCHI_MEMORY_POWER
     a->track_pwd = 0;
+#endif
+#ifdef POS_CONFIG_ALLOC_STATS
+    memset(&a->stats, 0, sizeof(a->stats));
 #endif
     a->first_free = chunk;
-    size = size - ((int)chunk - (int)_chunk);
+    size = size - ((uintptr_t)chunk - (uintptr_t)_chunk);
     if (size > 0)
     {
         chunk->size = ALIGN_DOWN(size, MIN_CHUNK_SIZE);
@@ -190,7 +221,7 @@ void pos_alloc_init(pos_alloc_t *a, void *_chunk, int size)
     }
 }
 
-void *pos_alloc(pos_alloc_t *a, int size)
+static void *__pos_alloc(pos_alloc_t *a, int size)
 {
     ALLOC_TRACE(POS_LOG_TRACE, "Allocating memory chunk (alloc: %p, size: 0x%8x)\n", a, size);
 
@@ -216,7 +247,7 @@ void *pos_alloc(pos_alloc_t *a, int size)
             ALLOC_TRACE(POS_LOG_TRACE, "Allocated memory chunk (alloc: %p, base: %p)\n", a, pt);
             // As this block was the full free block, the beginning of the block was already taken
             // for the header and was accounted as allocated, so don't account it twice.
-            pos_alloc_account_alloc(a, (void *)(((uint32_t)pt) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
+            pos_alloc_account_alloc(a, (void *)(((uintptr_t)pt) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
             return (void *)pt;
         }
         else
@@ -237,7 +268,7 @@ void *pos_alloc(pos_alloc_t *a, int size)
             ALLOC_TRACE(POS_LOG_TRACE, "Allocated memory chunk (alloc: %p, base: %p)\n", a, result);
             // Don't account the metadata which were in the newly allocated block as they were
             // already accounted when the block was freed
-            pos_alloc_account_alloc(a, (void *)((uint32_t)result+ sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
+            pos_alloc_account_alloc(a, (void *)((uintptr_t)result+ sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
             // Instead account the metadata of the new free block
             pos_alloc_account_alloc(a, new_pt, sizeof(pos_alloc_chunk_t));
 
@@ -253,24 +284,38 @@ void *pos_alloc(pos_alloc_t *a, int size)
     }
 }
 
-void *pos_alloc_align(pos_alloc_t *a, int size, int align)
+void *pos_alloc(pos_alloc_t *a, int size)
+{
+    POS_ALLOC_STATS_START();
+
+    void *result = __pos_alloc(a, size);
+
+    POS_ALLOC_STATS_ALLOC(a, result);
+
+    return result;
+}
+
+static void *__pos_alloc_align(pos_alloc_t *a, int size, int align)
 {
 
     if (align < (int)sizeof(pos_alloc_chunk_t))
-        return pos_alloc(a, size);
+        return __pos_alloc(a, size);
 
     // As the user must give back the size of the allocated chunk when freeing it, we must allocate
     // an aligned chunk with exactly the right size
     // To do so, we allocate a bigger chunk and we free what is before and what is after
 
+    // The remaining room after the chunk is freed, so it must start on a chunk boundary
+    size = ALIGN_UP(size, MIN_CHUNK_SIZE);
+
     // We reserve enough space to free the remaining room before and after the aligned chunk
     int size_align = size + align + sizeof(pos_alloc_chunk_t) * 2;
-    unsigned int result = (unsigned int)pos_alloc(a, size_align);
+    uintptr_t result = (uintptr_t)__pos_alloc(a, size_align);
     if (!result)
         return NULL;
 
-    unsigned int result_align = (result + align - 1) & -align;
-    unsigned int headersize = result_align - result;
+    uintptr_t result_align = (result + align - 1) & -align;
+    uintptr_t headersize = result_align - result;
 
     // In case we don't get an aligned chunk at first, we must free the room before the first aligned one
     if (headersize != 0)
@@ -281,16 +326,27 @@ void *pos_alloc_align(pos_alloc_t *a, int size, int align)
             result_align += align;
 
         // Free the header
-        pos_free(a, (void *)result, headersize);
+        __pos_free(a, (void *)result, headersize);
     }
 
     // Now free what remains after
-    pos_free(a, (unsigned char *)(result_align + size), size_align - headersize - size);
+    __pos_free(a, (unsigned char *)(result_align + size), size_align - headersize - size);
 
     return (void *)result_align;
 }
 
-void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size)
+void *pos_alloc_align(pos_alloc_t *a, int size, int align)
+{
+    POS_ALLOC_STATS_START();
+
+    void *result = __pos_alloc_align(a, size, align);
+
+    POS_ALLOC_STATS_ALLOC(a, result);
+
+    return result;
+}
+
+static void __pos_free(pos_alloc_t *a, void *_chunk, int size)
 {
     ALLOC_TRACE(POS_LOG_TRACE, "Freeing memory chunk (alloc: %p, base: %p, size: 0x%8x)\n", a, _chunk, size);
 
@@ -332,13 +388,22 @@ void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size)
         {
             prev->next = chunk;
             // The metadata will stand in this block, we can account ony after the metadata
-            pos_alloc_account_free(a, (void *)(((uint32_t)_chunk) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
+            pos_alloc_account_free(a, (void *)(((uintptr_t)_chunk) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
         }
     }
     else
     {
         a->first_free = chunk;
         // The metadata will stand in this block, we can account ony after the metadata
-        pos_alloc_account_free(a, (void *)(((uint32_t)_chunk) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
+        pos_alloc_account_free(a, (void *)(((uintptr_t)_chunk) + sizeof(pos_alloc_chunk_t)), size - sizeof(pos_alloc_chunk_t));
     }
 }
+
+void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size)
+{
+    POS_ALLOC_STATS_START();
+
+    __pos_free(a, _chunk, size);
+
+    POS_ALLOC_STATS_FREE(a);
+}
@@ -0,0 +1,459 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pmsis.h"
+#include <string.h>
+#include <stdio.h>
+
+
+/*
+  Two-level segregated fit allocator, with the same interface as the first-fit one,
+  i.e. the size of a chunk is given back when it is freed so that allocated chunks
+  do not carry any header.
+
+  Free blocks are linked into size-class lists. The first level splits sizes by
+  power of 2 and the second level splits each power of 2 into
+  POS_ALLOC_TLSF_SL_COUNT linear classes. Non-empty lists are tracked in bitmaps
+  so that both allocation and free are done in constant time, whatever the number
+  of free blocks.
+
+  Each free block has a header (size, next, prev) at its beginning and a copy of
+  its size in its last word. To coalesce with the neighbours on free, a bitmap
+  with one bit per granule marks the first and the last granules of every free
+  block. It is carved from the beginning of the heap.
+
+  This allocator is only selected with CONFIG_ALLOC_TLSF=1, the first-fit one
+  stays the default. On traces with few free blocks (tests/alloc/host,
+  cnn_tiling.trace), first-fit is faster on average and fragments a bit less,
+  while the granule, which must hold the free block header and the size copy,
+  rounds every chunk up to 16 bytes and wastes space in small L1 heaps.
+  TLSF only pays off when the free list gets long (fragmented.trace, hundreds of
+  free blocks), where its latency stays flat while first-fit has to walk all the
+  free blocks and gets more than 10 times slower, at the price of more
+  fragmentation.
+*/
+
+#if __SIZEOF_POINTER__ > 4
+#define GRANULE_LOG2 5
+#else
+#define GRANULE_LOG2 4
+#endif
+
+#define GRANULE       (1 << GRANULE_LOG2)
+#define SL_LOG2       POS_ALLOC_TLSF_SL_LOG2
+#define SL_COUNT      POS_ALLOC_TLSF_SL_COUNT
+#define FL_COUNT      POS_ALLOC_TLSF_FL_COUNT
+#define SMALL_LOG2    (GRANULE_LOG2 + SL_LOG2)
+#define SMALL_SIZE    (1 << SMALL_LOG2)
+
+#define ALIGN_UP(addr,size)   (((addr) + (size) - 1) & ~((size) - 1))
+#define ALIGN_DOWN(addr,size) ((addr) & ~((size) - 1))
+
+
+static inline int pos_alloc_msb(unsigned int value)
+{
+    return 31 - __builtin_clz(value);
+}
+
+static inline void pos_alloc_mapping(unsigned int size, int *fl, int *sl)
+{
+    if (size < SMALL_SIZE)
+    {
+        *fl = 0;
+        *sl = size >> GRANULE_LOG2;
+    }
+    else
+    {
+        int msb = pos_alloc_msb(size);
+        *fl = msb - SMALL_LOG2 + 1;
+        *sl = (size >> (msb - SL_LOG2)) - SL_COUNT;
+
+        if (*fl >= FL_COUNT)
+        {
+            *fl = FL_COUNT - 1;
+            *sl = SL_COUNT - 1;
+        }
+    }
+}
+
+static inline unsigned int pos_alloc_granule(pos_alloc_t *a, void *addr)
+{
+    return ((char *)addr - a->base) >> GRANULE_LOG2;
+}
+
+static inline int pos_alloc_map_get(pos_alloc_t *a, unsigned int granule)
+{
+    return (a->free_map[granule >> 5] >> (granule & 0x1f)) & 1;
+}
+
+static inline void pos_alloc_map_set(pos_alloc_t *a, unsigned int granule)
+{
+    a->free_map[granule >> 5] |= 1U << (granule & 0x1f);
+}
+
+static inline void pos_alloc_map_clr(pos_alloc_t *a, unsigned int granule)
+{
+    a->free_map[granule >> 5] &= ~(1U << (granule & 0x1f));
+}
+
+static void pos_alloc_insert(pos_alloc_t *a, pos_alloc_chunk_t *block, int size)
+{
+    int fl, sl;
+    pos_alloc_mapping(size, &fl, &sl);
+
+    block->size = size;
+    block->prev = NULL;
+    block->next = a->blocks[fl][sl];
+    if (block->next)
+        block->next->prev = block;
+    a->blocks[fl][sl] = block;
+
+    *(int *)((char *)block + size - sizeof(int)) = size;
+
+    unsigned int first = pos_alloc_granule(a, block);
+    pos_alloc_map_set(a, first);
+    pos_alloc_map_set(a, first + (size >> GRANULE_LOG2) - 1);
+
+    a->fl_bitmap |= 1U << fl;
+    a->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void pos_alloc_remove(pos_alloc_t *a, pos_alloc_chunk_t *block)
+{
+    int fl, sl;
+    pos_alloc_mapping(block->size, &fl, &sl);
+
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        a->blocks[fl][sl] = block->next;
+
+    if (block->next)
+        block->next->prev = block->prev;
+
+    unsigned int first = pos_alloc_granule(a, block);
+    pos_alloc_map_clr(a, first);
+    pos_alloc_map_clr(a, first + (block->size >> GRANULE_LOG2) - 1);
+
+    if (a->blocks[fl][sl] == NULL)
+    {
+        a->sl_bitmap[fl] &= ~(1U << sl);
+        if (a->sl_bitmap[fl] == 0)
+            a->fl_bitmap &= ~(1U << fl);
+    }
+}
+
+// Find a free block of at least the specified size and remove it from the lists
+static pos_alloc_chunk_t *pos_alloc_find(pos_alloc_t *a, unsigned int size)
+{
+    int fl, sl;
+    unsigned int search_size = size;
+
+    // Round the size up to the next class so that any block of the class found
+    // with the bitmaps is big enough, without walking the list.
+    if (search_size >= SMALL_SIZE)
+        search_size += (1U << (pos_alloc_msb(search_size) - SL_LOG2)) - 1;
+
+    pos_alloc_mapping(search_size, &fl, &sl);
+
+    uint32_t sl_map = a->sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0)
+    {
+        uint32_t fl_map = fl + 1 < 32 ? a->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (fl_map)
+        {
+            fl = __builtin_ctz(fl_map);
+            sl_map = a->sl_bitmap[fl];
+        }
+    }
+
+    pos_alloc_chunk_t *block = NULL;
+
+    if (sl_map)
+    {
+        block = a->blocks[fl][__builtin_ctz(sl_map)];
+    }
+    else
+    {
+        // Nothing in the bigger classes, the class of the requested size may still
+        // contain a block which is big enough. This matters for small heaps where
+        // the remaining memory is often in a single block.
+        pos_alloc_mapping(size, &fl, &sl);
+        for (block = a->blocks[fl][sl]; block; block = block->next)
+        {
+            if (block->size >= (int)size)
+                break;
+        }
+    }
+
+    if (block)
+        pos_alloc_remove(a, block);
+
+    return block;
+}
+
+// Give back to the free lists what is before and after the allocated area
+// of a block removed from the lists. No coalescing is needed as the block was
+// already fully coalesced with its neighbours.
+static void *pos_alloc_carve(pos_alloc_t *a, pos_alloc_chunk_t *block, int offset, int size)
+{
+    int block_size = block->size;
+    char *result = (char *)block + offset;
+    int tail = block_size - offset - size;
+
+    if (offset)
+        pos_alloc_insert(a, block, offset);
+
+    if (tail)
+        pos_alloc_insert(a, (pos_alloc_chunk_t *)(result + size), tail);
+
+    return (void *)result;
+}
+
+void pos_alloc_info(pos_alloc_t *a, int *_size, void **first_chunk, int *_nb_chunks)
+{
+    int size = 0;
+    int nb_chunks = 0;
+    void *first = NULL;
+
+    for (int fl=0; fl<FL_COUNT; fl++)
+    {
+        for (int sl=0; sl<SL_COUNT; sl++)
+        {
+            for (pos_alloc_chunk_t *pt = a->blocks[fl][sl]; pt; pt = pt->next)
+            {
+                if (first == NULL || (void *)pt < first)
+                    first = pt;
+                size += pt->size;
+                nb_chunks++;
+            }
+        }
+    }
+
+    if (first_chunk)
+        *first_chunk = first;
+
+    if (_size)
+        *_size = size;
+
+    if (_nb_chunks)
+        *_nb_chunks = nb_chunks;
+}
+
+void pos_alloc_dump(pos_alloc_t *a)
+{
+    printf("======== Memory allocator state: ============\n");
+    for (int fl=0; fl<FL_COUNT; fl++)
+    {
+        for (int sl=0; sl<SL_COUNT; sl++)
+        {
+            for (pos_alloc_chunk_t *pt = a->blocks[fl][sl]; pt; pt = pt->next)
+            {
+                printf("Free Block at %8X, size: %8x, Class: %d/%d ", (unsigned int)(uintptr_t)pt, pt->size, fl, sl);
+                if (pt == pt->next)
+                {
+                    printf(" CORRUPTED\n"); break;
+                }
+                else
+                    printf("\n");
+            }
+        }
+    }
+    printf("=============================================\n");
+}
+
+void pos_alloc_get_stats(pos_alloc_t *a, pos_alloc_stats_t *stats)
+{
+    memset(stats, 0, sizeof(pos_alloc_stats_t));
+
+    for (int fl=0; fl<FL_COUNT; fl++)
+    {
+        for (int sl=0; sl<SL_COUNT; sl++)
+        {
+            for (pos_alloc_chunk_t *pt = a->blocks[fl][sl]; pt; pt = pt->next)
+            {
+                stats->free_size += pt->size;
+                stats->nb_free_chunks++;
+                if (pt->size > stats->largest_free_chunk)
+                    stats->largest_free_chunk = pt->size;
+            }
+        }
+    }
+
+    if (stats->free_size)
+        stats->fragmentation = 1000 - (int)(((long long)stats->largest_free_chunk * 1000) / stats->free_size);
+
+#ifdef POS_CONFIG_ALLOC_STATS
+    stats->nb_alloc = a->stats.nb_alloc;
+    stats->nb_free = a->stats.nb_free;
+    stats->nb_failed = a->stats.nb_failed;
+    stats->alloc_cycles_max = a->stats.alloc_cycles_max;
+    stats->alloc_cycles_total = a->stats.alloc_cycles_total;
+    stats->free_cycles_max = a->stats.free_cycles_max;
+    stats->free_cycles_total = a->stats.free_cycles_total;
+#endif
+}
+
+void pos_alloc_init(pos_alloc_t *a, void *_chunk, int size)
+{
+    char *start = (char *)ALIGN_UP((uintptr_t)_chunk, GRANULE);
+    char *end = (char *)ALIGN_DOWN((uintptr_t)_chunk + size, GRANULE);
+
+    memset(a, 0, sizeof(pos_alloc_t));
+
+    if (end <= start)
+    {
+        a->base = a->end = start;
+        return;
+    }
+
+    // Reserve the free map at the beginning of the heap, sized for the whole
+    // area, which is slightly more than what the remaining heap needs.
+    int nb_granules = (end - start) >> GRANULE_LOG2;
+    int map_size = ALIGN_UP(((nb_granules + 31) >> 5) * 4, GRANULE);
+
+    a->free_map = (uint32_t *)start;
+    a->base = start + map_size;
+    a->end = end;
+
+    if (a->end <= a->base)
+    {
+        a->end = a->base;
+        return;
+    }
+
+    memset(a->free_map, 0, map_size);
+
+    pos_alloc_insert(a, (pos_alloc_chunk_t *)a->base, a->end - a->base);
+}
+
+static void *__pos_alloc(pos_alloc_t *a, int size)
+{
+    ALLOC_TRACE(POS_LOG_TRACE, "Allocating memory chunk (alloc: %p, size: 0x%8x)\n", a, size);
+
+    if (size <= 0)
+        size = GRANULE;
+
+    size = ALIGN_UP(size, GRANULE);
+
+    pos_alloc_chunk_t *block = pos_alloc_find(a, size);
+    if (block == NULL)
+    {
+        ALLOC_TRACE(POS_LOG_TRACE, "Not enough memory to allocate\n");
+        return NULL;
+    }
+
+    void *result = pos_alloc_carve(a, block, 0, size);
+
+    ALLOC_TRACE(POS_LOG_TRACE, "Allocated memory chunk (alloc: %p, base: %p)\n", a, result);
+
+    return result;
+}
+
+static void *__pos_alloc_align(pos_alloc_t *a, int size, int align)
+{
+    if (align <= GRANULE)
+        return __pos_alloc(a, size);
+
+    if (size <= 0)
+        size = GRANULE;
+
+    size = ALIGN_UP(size, GRANULE);
+
+    // Blocks are aligned on the granule so the aligned address is at most
+    // align - GRANULE bytes after the beginning of the block.
+    pos_alloc_chunk_t *block = pos_alloc_find(a, size + align - GRANULE);
+    if (block == NULL)
+    {
+        ALLOC_TRACE(POS_LOG_TRACE, "Not enough memory to allocate\n");
+        return NULL;
+    }
+
+    int offset = ALIGN_UP((uintptr_t)block, align) - (uintptr_t)block;
+
+    void *result = pos_alloc_carve(a, block, offset, size);
+
+    ALLOC_TRACE(POS_LOG_TRACE, "Allocated memory chunk (alloc: %p, base: %p)\n", a, result);
+
+    return result;
+}
+
+static void __pos_free(pos_alloc_t *a, void *_chunk, int size)
+{
+    ALLOC_TRACE(POS_LOG_TRACE, "Freeing memory chunk (alloc: %p, base: %p, size: 0x%8x)\n", a, _chunk, size);
+
+    char *chunk = (char *)_chunk;
+
+    if (size <= 0)
+        size = GRANULE;
+
+    size = ALIGN_UP(size, GRANULE);
+
+    unsigned int first = pos_alloc_granule(a, chunk);
+    unsigned int last = first + (size >> GRANULE_LOG2) - 1;
+
+    // The granule just before is marked only if it is the last one of a free block,
+    // whose size is then in its last word.
+    if (chunk > a->base && pos_alloc_map_get(a, first - 1))
+    {
+        int prev_size = *(int *)(chunk - sizeof(int));
+        pos_alloc_chunk_t *prev = (pos_alloc_chunk_t *)(chunk - prev_size);
+        pos_alloc_remove(a, prev);
+        chunk = (char *)prev;
+        size += prev_size;
+    }
+
+    // And the one just after only if it is the first one of a free block
+    if (chunk + size < a->end && pos_alloc_map_get(a, last + 1))
+    {
+        pos_alloc_chunk_t *next = (pos_alloc_chunk_t *)(chunk + size);
+        size += next->size;
+        pos_alloc_remove(a, next);
+    }
+
+    pos_alloc_insert(a, (pos_alloc_chunk_t *)chunk, size);
+}
+
+void *pos_alloc(pos_alloc_t *a, int size)
+{
+    POS_ALLOC_STATS_START();
+
+    void *result = __pos_alloc(a, size);
+
+    POS_ALLOC_STATS_ALLOC(a, result);
+
+    return result;
+}
+
+void *pos_alloc_align(pos_alloc_t *a, int size, int align)
+{
+    POS_ALLOC_STATS_START();
+
+    void *result = __pos_alloc_align(a, size, align);
+
+    POS_ALLOC_STATS_ALLOC(a, result);
+
+    return result;
+}
+
+void __attribute__((noinline)) pos_free(pos_alloc_t *a, void *_chunk, int size)
+{
+    POS_ALLOC_STATS_START();
+
+    __pos_free(a, _chunk, size);
+
+    POS_ALLOC_STATS_FREE(a);
+}
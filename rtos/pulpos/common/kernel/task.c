@@ -25,6 +25,51 @@
 
 PI_FC_TINY pi_task_t *pos_sched_first;
 PI_FC_TINY pi_task_t *pos_sched_last;
+PI_FC_TINY uint32_t pos_sched_prio_map;
+PI_FC_L1 pos_sched_queue_t pos_sched_queues[POS_SCHED_NB_PRIO];
+
+#ifdef POS_CONFIG_SCHED_STATS
+static PI_FC_L1 pos_sched_stats_t pos_sched_stats[POS_SCHED_NB_PRIO];
+
+// Latencies are measured with the cycle counter of the performance
+// counters, which must have been started with pi_perf_start.
+#if defined(TIMER_VERSION) && TIMER_VERSION >= 2
+#define POS_SCHED_TIMESTAMP() pi_perf_read(PI_PERF_CYCLES)
+#else
+#define POS_SCHED_TIMESTAMP() 0
+#endif
+
+void pos_sched_stats_push(pi_task_t *task)
+{
+    task->implem.push_time = POS_SCHED_TIMESTAMP();
+}
+
+static inline void pos_sched_stats_exec(pi_task_t *task, int prio)
+{
+    pos_sched_stats_t *stats = &pos_sched_stats[prio];
+    unsigned int latency = POS_SCHED_TIMESTAMP() - task->implem.push_time;
+
+    stats->nb_tasks++;
+    stats->latency_total += latency;
+    if (latency > stats->latency_max)
+        stats->latency_max = latency;
+}
+#endif
+
+
+
+void pos_sched_get_stats(int priority, pos_sched_stats_t *stats)
+{
+#ifdef POS_CONFIG_SCHED_STATS
+    int irq = hal_irq_disable();
+    *stats = pos_sched_stats[(priority - PI_TASK_PRIO_LOW) & (POS_SCHED_NB_PRIO - 1)];
+    hal_irq_restore(irq);
+#else
+    stats->nb_tasks = 0;
+    stats->latency_total = 0;
+    stats->latency_max = 0;
+#endif
+}
 
 
 
@@ -34,10 +79,52 @@ void pos_task_handle_blocking(void *arg)
     task->done = 1;
 }
 
-void pos_task_handle()
+
+// Move the tasks pushed from assembly handlers to their priority queue
+static void pos_sched_sort_remote()
 {
     pi_task_t *task = pos_sched_first;
 
+    pos_sched_first = NULL;
+
+    while (task)
+    {
+        pi_task_t *next = task->next;
+        pos_task_push_locked(task);
+        task = next;
+    }
+}
+
+
+static inline pi_task_t *pos_sched_pop(int *prio)
+{
+    if (unlikely(*(pi_task_t * volatile *)&pos_sched_first != NULL))
+        pos_sched_sort_remote();
+
+    uint32_t map = *(volatile uint32_t *)&pos_sched_prio_map;
+    if (map == 0)
+        return NULL;
+
+    // Highest priority is the highest non-empty queue
+    int index = 31 - __builtin_clz(map);
+    pos_sched_queue_t *queue = &pos_sched_queues[index];
+    pi_task_t *task = queue->first;
+
+    queue->first = task->next;
+    if (queue->first == NULL)
+        pos_sched_prio_map = map & ~(1 << index);
+
+    *prio = index;
+
+    return task;
+}
+
+
+void pos_task_handle()
+{
+    int prio;
+    pi_task_t *task = pos_sched_pop(&prio);
+
     if (unlikely(task == NULL))
     {
         // Pop first event from the queue. Loop until we pop a null event
@@ -46,24 +133,29 @@ void pos_task_handle()
         pos_irq_wait_for_interrupt();
         hal_irq_enable();
         hal_irq_disable();
-        task = *((pi_task_t * volatile *)&pos_sched_first);
+        task = pos_sched_pop(&prio);
     }
 
     while (likely(task != NULL))
     {
-        pos_sched_first = task->next;
-
         // Read event information and put it back in the scheduler
 
         void (*callback)(void *) = (void (*)(void *))task->arg[0];
         void *arg = (void *)task->arg[1];
+        task->implem.queued = 0;
+
+#ifdef POS_CONFIG_SCHED_STATS
+        pos_sched_stats_exec(task, prio);
+#endif
 
         // Finally execute the event with interrupts enabled
         hal_irq_enable();
         callback(arg);
         hal_irq_disable();
 
-        task = pos_sched_first;
+        // Always pick the highest priority task again, as the callback
+        // or interrupt handlers may have pushed more urgent ones.
+        task = pos_sched_pop(&prio);
 
     }
 }
@@ -73,4 +165,10 @@ void pos_task_handle()
 void pos_sched_init()
 {
     pos_sched_first = NULL;
-}
\ No newline at end of file
+    pos_sched_prio_map = 0;
+
+    for (int i=0; i<POS_SCHED_NB_PRIO; i++)
+    {
+        pos_sched_queues[i].first = NULL;
+    }
+}
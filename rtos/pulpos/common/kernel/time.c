@@ -20,8 +20,41 @@
 
 #include "pmsis.h"
 
+/*
+ * Delayed tasks are kept in a hierarchical timing wheel. Level l has
+ * POS_TIME_WHEEL_SLOTS slots of 2^(l*POS_TIME_WHEEL_SLOT_BITS) ticks, and a task
+ * is put in the lowest level where its expiration time and the wheel time
+ * only differ in this level bits. When the wheel time reaches a slot of an
+ * upper level, the tasks of this slot are moved down to the lower levels.
+ * Tasks too far away for the wheel are kept in an overflow list which is
+ * checked each time the upper level wraps.
+ * Bitmaps of non-empty slots are used to directly find the next slot to
+ * process, so that both insertion and cancellation are constant time and the
+ * timer interrupt is only raised when a slot must be processed.
+ * The wheel is brought to the current time before a task is inserted, so
+ * tasks never expire more than 2^32 ticks after the wheel time and only the
+ * low 32 bits of their expiration time are kept.
+ */
+
+#define POS_TIME_WHEEL_LEVELS    4
+#define POS_TIME_WHEEL_SLOT_BITS 5
+#define POS_TIME_WHEEL_SLOTS     (1 << POS_TIME_WHEEL_SLOT_BITS)
+#define POS_TIME_WHEEL_BITS      (POS_TIME_WHEEL_LEVELS * POS_TIME_WHEEL_SLOT_BITS)
+
+// The comparator is never set further than this, so that the 64 bits
+// extension of the 32 bits counter sees every wrap while tasks are waiting.
+#define POS_TIME_MAX_TICKS       0x7fffffffULL
+
+#define POS_TIME_NEVER           0xffffffffffffffffULL
+
 static PI_FC_L1 uint32_t pos_time_timer_count;
-PI_FC_L1 pi_task_t *pos_time_first_delayed;
+static PI_FC_L1 uint32_t pos_time_count_high;
+static PI_FC_L1 uint32_t pos_time_count_last;
+static PI_FC_L1 uint64_t pos_time_wheel_time;
+static PI_FC_L1 uint64_t pos_time_armed;
+static PI_FC_L1 uint32_t pos_time_wheel_map[POS_TIME_WHEEL_LEVELS];
+static PI_FC_L1 pi_task_t *pos_time_wheel[POS_TIME_WHEEL_LEVELS][POS_TIME_WHEEL_SLOTS];
+static PI_FC_L1 pi_task_t *pos_time_overflow;
 static PI_FC_L1 pos_cbsys_t pos_time_cbsys_poweroff;
 static PI_FC_L1 pos_cbsys_t pos_time_cbsys_poweron;
 
@@ -47,43 +80,188 @@ static int pos_time_poweron(void *arg)
 }
 
 
-void pos_time_timer_handler()
+// Return the timer count extended to 64 bits. Must be called with interrupts
+// disabled.
+static uint64_t pos_time_get_ticks()
+{
+    uint32_t count = timer_count_get(timer_base_fc(0, 1));
+
+    if (count < pos_time_count_last)
+        pos_time_count_high++;
+
+    pos_time_count_last = count;
+
+    return ((uint64_t)pos_time_count_high << 32) | count;
+}
+
+
+static inline uint64_t pos_time_task_time(pi_task_t *task)
+{
+    return pos_time_wheel_time + (uint32_t)(task->implem.time - (uint32_t)pos_time_wheel_time);
+}
+
+
+static void pos_time_insert(pi_task_t *task, uint64_t time)
 {
-    pi_task_t *event = pos_time_first_delayed;
+    pi_task_t **slot;
 
-    uint32_t current_time = timer_count_get(timer_base_fc(0, 1));
+    // Tasks late for the wheel are executed with the current slot
+    if (time < pos_time_wheel_time)
+        time = pos_time_wheel_time;
 
-    // First dequeue and push to their scheduler all events with the same number of
-    // ticks as they were waiting for the same time.
-    while (event && (current_time - event->implem.time) < 0x7fffffff)
+    uint64_t diff = time ^ pos_time_wheel_time;
+
+    if (diff >> POS_TIME_WHEEL_BITS)
+    {
+        slot = &pos_time_overflow;
+    }
+    else
     {
-        pi_task_t *next = event->next;
-        pos_task_push_locked(event);
-        event = next;
+        int level = diff < POS_TIME_WHEEL_SLOTS ? 0 : (31 - __builtin_clz((uint32_t)diff)) / POS_TIME_WHEEL_SLOT_BITS;
+        int index = (time >> (level * POS_TIME_WHEEL_SLOT_BITS)) & (POS_TIME_WHEEL_SLOTS - 1);
+        slot = &pos_time_wheel[level][index];
+        pos_time_wheel_map[level] |= 1U << index;
     }
 
-    // Update the wait list with the next waiting event which has a different number
-    // of ticks
-    pos_time_first_delayed = event;
+    task->implem.time = (uint32_t)time;
+    task->implem.timer_next = *slot;
+    task->implem.timer_pprev = slot;
+    if (*slot)
+        (*slot)->implem.timer_pprev = &task->implem.timer_next;
+    *slot = task;
+}
+
 
-    // Now re-arm the timer in case there are still some events
-    if (pos_time_first_delayed)
+static void pos_time_remove(pi_task_t *task)
+{
+    pi_task_t **pprev = task->implem.timer_pprev;
+    pi_task_t *next = task->implem.timer_next;
+
+    *pprev = next;
+
+    if (next)
+        next->implem.timer_pprev = pprev;
+
+    // The task was alone in its slot if it was pointed by a wheel slot and
+    // has no next task
+    uintptr_t index = (uintptr_t)(pprev - &pos_time_wheel[0][0]);
+    if (next == NULL && index < POS_TIME_WHEEL_LEVELS * POS_TIME_WHEEL_SLOTS)
     {
-        // Be carefull to set the new comparator from the current time plus a number of ticks
-        // in order to set a value which is not before the actual count.
-        // This may just delay a bit the events which is fine as the specified
-        // duration is a minimum.
-        timer_cmp_set(timer_base_fc(0, 1),
-                      timer_count_get(timer_base_fc(0, 1)) +
-                          pos_time_first_delayed->implem.time - current_time);
+        pos_time_wheel_map[index / POS_TIME_WHEEL_SLOTS] &= ~(1U << (index % POS_TIME_WHEEL_SLOTS));
+    }
 
-        timer_conf_set(timer_base_fc(0, 1),
-                       TIMER_CFG_LO_ENABLE(1) |
-                           TIMER_CFG_LO_IRQEN(1) |
-                           TIMER_CFG_LO_CCFG(1));
+    task->implem.timer_pprev = NULL;
+}
+
+
+// Return the time at which the next slot must be processed, and its level,
+// or POS_TIME_NEVER if no task is waiting.
+static uint64_t pos_time_next_slot(int *level, int *index)
+{
+    for (int i=0; i<POS_TIME_WHEEL_LEVELS; i++)
+    {
+        int shift = i * POS_TIME_WHEEL_SLOT_BITS;
+        int current = (pos_time_wheel_time >> shift) & (POS_TIME_WHEEL_SLOTS - 1);
+
+        // Slots of upper levels before or at the current position are always
+        // empty, while the current one of the first level can still be used.
+        uint32_t map = pos_time_wheel_map[i];
+        if (i == 0)
+            map &= ~0U << current;
+        else
+            map = current == POS_TIME_WHEEL_SLOTS - 1 ? 0 : map & (~0U << (current + 1));
+
+        if (map)
+        {
+            *level = i;
+            *index = __builtin_ctz(map);
+            uint64_t upper = pos_time_wheel_time & ~((1ULL << (shift + POS_TIME_WHEEL_SLOT_BITS)) - 1);
+            return upper | ((uint64_t)*index << shift);
+        }
     }
-    else
+
+    if (pos_time_overflow)
+    {
+        *level = POS_TIME_WHEEL_LEVELS;
+        *index = 0;
+        return ((pos_time_wheel_time >> POS_TIME_WHEEL_BITS) + 1) << POS_TIME_WHEEL_BITS;
+    }
+
+    return POS_TIME_NEVER;
+}
+
+
+static void pos_time_expire(pi_task_t *task, uint64_t now)
+{
+    if (task->implem.period)
+    {
+        // The task expires at the wheel time. If the interrupt was handled
+        // late, the missed occurrences are skipped so that the task is not
+        // expired again until the next one after now.
+        uint32_t period = task->implem.period;
+        uint64_t time = pos_time_wheel_time + period;
+        if (time <= now)
+            time += ((uint32_t)(now - time) / period + 1) * (uint64_t)period;
+
+        pos_time_insert(task, time);
+
+        if (task->implem.queued)
+            return;
+
+        task->implem.queued = 1;
+    }
+
+    pos_task_push_locked(task);
+}
+
+
+// Process all slots until the specified time
+static void pos_time_advance(uint64_t now)
+{
+    while (1)
     {
+        int level, index;
+        uint64_t time = pos_time_next_slot(&level, &index);
+
+        if (time > now)
+            break;
+
+        pos_time_wheel_time = time;
+
+        pi_task_t **slot = level == POS_TIME_WHEEL_LEVELS ? &pos_time_overflow : &pos_time_wheel[level][index];
+        pi_task_t *task = *slot;
+
+        *slot = NULL;
+        if (level < POS_TIME_WHEEL_LEVELS)
+            pos_time_wheel_map[level] &= ~(1U << index);
+
+        while (task)
+        {
+            pi_task_t *next = task->implem.timer_next;
+            task->implem.timer_pprev = NULL;
+
+            // Slots of the first level contain tasks expiring at this time while
+            // the others are moved down to the lower levels.
+            if (level == 0)
+                pos_time_expire(task, now);
+            else
+                pos_time_insert(task, pos_time_task_time(task));
+
+            task = next;
+        }
+    }
+
+    if (now > pos_time_wheel_time)
+        pos_time_wheel_time = now;
+}
+
+
+static void pos_time_arm(uint64_t now, uint64_t time)
+{
+    if (time == POS_TIME_NEVER)
+    {
+        pos_time_armed = POS_TIME_NEVER;
+
         // Set back default state where timer is only counting with
         // no interrupt
         timer_conf_set(timer_base_fc(0, 1),
@@ -97,7 +275,37 @@ void pos_time_timer_handler()
 #else
         pos_irq_clr(1 << ARCHI_EVT_TIMER0_HI);
 #endif
+        return;
     }
+
+    if (time > now + POS_TIME_MAX_TICKS)
+        time = now + POS_TIME_MAX_TICKS;
+
+    pos_time_armed = time;
+
+    // Be carefull to set the new comparator from the current time plus a number of ticks
+    // in order to set a value which is not before the actual count.
+    // This may just delay a bit the tasks which is fine as the specified
+    // duration is a minimum.
+    uint32_t ticks = time > now ? (uint32_t)(time - now) : 1;
+
+    timer_cmp_set(timer_base_fc(0, 1), timer_count_get(timer_base_fc(0, 1)) + ticks);
+
+    timer_conf_set(timer_base_fc(0, 1),
+                   TIMER_CFG_LO_ENABLE(1) |
+                       TIMER_CFG_LO_IRQEN(1) |
+                       TIMER_CFG_LO_CCFG(1));
+}
+
+
+void pos_time_timer_handler()
+{
+    int level, index;
+    uint64_t now = pos_time_get_ticks();
+
+    pos_time_advance(now);
+
+    pos_time_arm(now, pos_time_next_slot(&level, &index));
 }
 
 
@@ -109,63 +317,72 @@ unsigned int pos_time_get_us()
     return ((unsigned long long)count) * 1000000 / ARCHI_REF_CLOCK;
 }
 
-void pi_task_push_delayed_us(pi_task_t *event, uint32_t us)
-{
-    int irq = hal_irq_disable();
-
-    int set_irq = 0;
-    pi_task_t *current = pos_time_first_delayed, *prev = NULL;
-    unsigned int ticks, ticks_from_now;
-    uint32_t current_time = timer_count_get(timer_base_fc(0, 1));
 
-        // First compute the corresponding number of ticks.
-        // The specified time is the minimum we must, so we have to round-up
-        // the number of ticks.
+static uint32_t pos_time_us_to_ticks(uint32_t us)
+{
+    // The specified time is the minimum we must, so we have to round-up
+    // the number of ticks.
 #if PULP_CHIP_FAMILY == CHIP_USOC_V1
-    ticks = us * ARCHI_REF_CLOCK / 1000000 + 1;
+    return (uint64_t)us * ARCHI_REF_CLOCK / 1000000 + 1;
 #else
-    ticks = us / (1000000 / ARCHI_REF_CLOCK) + 1;
+    return us / (1000000 / ARCHI_REF_CLOCK) + 1;
 #endif
+}
 
-    // In order to simplify time comparison, we sacrify the MSB to avoid overflow
-    // as the given amount of time must be short
-    uint32_t time = (current_time & 0x7fffffff) + ticks;
-    event->implem.time = current_time + ticks;
 
-    // Enqueue the event in the wait list.
-    while (current && (current->implem.time & 0x7fffffff) < time)
-    {
-        prev = current;
-        current = current->next;
-    }
+static void pos_time_push(pi_task_t *task, uint32_t ticks, uint32_t period)
+{
+    int irq = hal_irq_disable();
+    int level, index;
 
-    if (prev)
-    {
-        prev->next = event;
-    }
-    else
-    {
-        set_irq = 1;
-        pos_time_first_delayed = event;
-    }
-    event->next = current;
+    uint64_t now = pos_time_get_ticks();
 
-    // And finally update the timer trigger time in case we enqueued the event
-    // at the head of the wait list.
-    if (set_irq)
-    {
-        // This is important to reload the current time, in case the previous code
-        // took too much time so that the interrupt is not missed
-        uint32_t timer = timer_count_get(timer_base_fc(0, 1)) + ticks;
-        timer_cmp_set(timer_base_fc(0, 1), timer);
+    // The wheel time may be far behind when no task was waiting
+    pos_time_advance(now);
 
-        timer_conf_set(timer_base_fc(0, 1),
-                       TIMER_CFG_LO_ENABLE(1) |
-                           TIMER_CFG_LO_IRQEN(1) |
-                           TIMER_CFG_LO_CCFG(1));
+    task->implem.period = period;
+    task->implem.queued = 0;
+
+    pos_time_insert(task, now + ticks);
+
+    // Only reprogram the timer if the task expires before the current trigger
+    uint64_t time = pos_time_next_slot(&level, &index);
+    if (time < pos_time_armed)
+        pos_time_arm(now, time);
+
+    hal_irq_restore(irq);
+}
+
+
+void pi_task_push_delayed_us(pi_task_t *task, uint32_t us)
+{
+    pos_time_push(task, pos_time_us_to_ticks(us), 0);
+}
+
+
+void pi_task_push_periodic_us(pi_task_t *task, uint32_t period_us)
+{
+    uint32_t period = pos_time_us_to_ticks(period_us);
+    pos_time_push(task, period, period);
+}
+
+
+int pi_task_cancel_delayed(pi_task_t *task)
+{
+    int irq = hal_irq_disable();
+    int result = -1;
+
+    // The timer is not reprogrammed, an early interrupt will just find
+    // nothing to do.
+    if (task->implem.timer_pprev)
+    {
+        pos_time_remove(task);
+        result = 0;
     }
 
     hal_irq_restore(irq);
+
+    return result;
 }
 
 void pos_time_wait_us(int time_us)
@@ -182,7 +399,20 @@ void pi_time_wait_us(int time_us)
 
 void __attribute__((constructor)) pos_time_init()
 {
-    pos_time_first_delayed = NULL;
+    pos_time_count_high = 0;
+    pos_time_count_last = 0;
+    pos_time_wheel_time = 0;
+    pos_time_armed = POS_TIME_NEVER;
+    pos_time_overflow = NULL;
+
+    for (int i=0; i<POS_TIME_WHEEL_LEVELS; i++)
+    {
+        pos_time_wheel_map[i] = 0;
+        for (int j=0; j<POS_TIME_WHEEL_SLOTS; j++)
+        {
+            pos_time_wheel[i][j] = NULL;
+        }
+    }
 
     // Configure the FC timer in 64 bits mode as it will be used as a common
     // timer for all virtual timers.
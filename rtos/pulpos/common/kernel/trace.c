@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pmsis.h"
+#include <stdarg.h>
+
+/*
+ * Binary traces
+ *
+ * Each core has its own ring of 32 bits words in L2, so that no lock is
+ * needed. A record is:
+ *   word 0: number of arguments << 24 | offset of the format string in the
+ *           .pos_trace_fmt section
+ *   word 1: timestamp, in ticks of the FC timer used for the time, which
+ *           is always running and can be read by all the cores
+ *   word 2..: arguments
+ * The core only writes head, and drops the records which do not fit. A
+ * reader, either the debug bridge during the run or pos-trace after it,
+ * consumes the records from tail to head and can move tail forward.
+ * pos_trace_desc gives the reader the location and geometry of the rings.
+ */
+
+// Must be a power of 2
+#ifndef POS_CONFIG_TRACE_RING_SIZE
+#define POS_CONFIG_TRACE_RING_SIZE 1024
+#endif
+
+#if defined(ARCHI_HAS_CLUSTER)
+#define POS_TRACE_NB_RINGS (1 + ARCHI_NB_CLUSTER*ARCHI_CLUSTER_NB_PE)
+#else
+#define POS_TRACE_NB_RINGS 1
+#endif
+
+// The cycle counters are per core, only count between pi_perf_start and
+// pi_perf_stop and are reset by pi_perf_reset, so they cannot be used to
+// merge the records of the different cores
+#if defined(TIMER_VERSION) && TIMER_VERSION >= 2 && defined(ARCHI_HAS_FC)
+#define POS_TRACE_TIMESTAMP() timer_count_get(timer_base_fc(0, 1))
+#else
+#define POS_TRACE_TIMESTAMP() 0
+#endif
+
+typedef struct
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t nb_lost;
+    uint32_t buffer[POS_CONFIG_TRACE_RING_SIZE];
+} pos_trace_ring_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t nb_rings;
+    uint32_t nb_pe;
+    uint32_t ring_size;
+    uint32_t rings;
+} pos_trace_desc_t;
+
+static PI_L2 pos_trace_ring_t pos_trace_rings[POS_TRACE_NB_RINGS];
+
+PI_L2 const pos_trace_desc_t pos_trace_desc = {
+    .magic = 0x43525450,    // "PTRC"
+    .nb_rings = POS_TRACE_NB_RINGS,
+#if defined(ARCHI_HAS_CLUSTER)
+    .nb_pe = ARCHI_CLUSTER_NB_PE,
+#endif
+    .ring_size = POS_CONFIG_TRACE_RING_SIZE,
+    .rings = (uint32_t)pos_trace_rings,
+};
+
+
+void pos_trace_record(uint32_t fmt, int nb_args, ...)
+{
+    pos_trace_ring_t *ring = &pos_trace_rings[0];
+    uint32_t mask = POS_CONFIG_TRACE_RING_SIZE - 1;
+    va_list ap;
+
+#if defined(ARCHI_HAS_CLUSTER)
+    if (!hal_is_fc())
+        ring = &pos_trace_rings[1 + hal_cluster_id()*ARCHI_CLUSTER_NB_PE + hal_core_id()];
+#endif
+
+    // Interrupt handlers of this core may also trace
+    int irq = hal_irq_disable();
+
+    uint32_t head = ring->head;
+
+    if (head - *(volatile uint32_t *)&ring->tail + 2 + nb_args > POS_CONFIG_TRACE_RING_SIZE)
+    {
+        ring->nb_lost++;
+        hal_irq_restore(irq);
+        return;
+    }
+
+    ring->buffer[head++ & mask] = (nb_args << 24) | fmt;
+    ring->buffer[head++ & mask] = POS_TRACE_TIMESTAMP();
+
+    va_start(ap, nb_args);
+    for (int i=0; i<nb_args; i++)
+    {
+        ring->buffer[head++ & mask] = va_arg(ap, uint32_t);
+    }
+    va_end(ap);
+
+    hal_compiler_barrier();
+    *(volatile uint32_t *)&ring->head = head;
+
+    hal_irq_restore(irq);
+}
+
+
+void __attribute__((constructor)) pos_trace_init()
+{
+    for (int i=0; i<POS_TRACE_NB_RINGS; i++)
+    {
+        pos_trace_rings[i].head = 0;
+        pos_trace_rings[i].tail = 0;
+        pos_trace_rings[i].nb_lost = 0;
+    }
+}
@@ -44,6 +44,16 @@ static int pos_libc_uart_buffer_index_cl[ARCHI_NB_CLUSTER];
 
 
 #if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_CONFIG_IO_RING) && POS_CONFIG_IO_RING == 1
+#define POS_IO_RING 1
+#else
+// Without the rings, the cluster cores share one buffer per cluster
+#define POS_IO_LOCK 1
+#endif
+#endif
+
+
+#if defined(POS_IO_LOCK)
 static PI_CL_L1_TINY pos_cl_mutex_t pos_io_lock = POS_CL_MUTEX_INIT;
 #endif
 
@@ -125,59 +135,226 @@ int memcmp(const void *m1, const void *m2, size_t n)
 
 
 
-void *memset(void *m, int c, size_t n)
-{
-    char *s = (char *)m;
-    while (n--)
-        *s++ = (char) c;
+/*
+ * Memory copies and fills. Once the destination is aligned, they are done
+ * by words, 4 words per iteration so that the loads are issued before the
+ * stores. The loops are simple counted loops on incremented pointers, which
+ * the PULP toolchain turns into hardware loops with post-increment accesses.
+ * When the source and the destination have different alignments, the source
+ * is read with aligned words which are realigned with shifts.
+ * On cluster cores, big copies between the L1 and another memory can be done
+ * with the cluster DMA when POS_CONFIG_MEMCPY_DMA_THRESHOLD is set. This is
+ * not the default as the DMA commands are pushed with EU mutex 0 taken, so
+ * such copies must then not be done while holding this mutex, e.g. in a team
+ * critical section.
+ */
 
-    return m;
-}
+#if defined(ARCHI_HAS_CLUSTER)
+#ifndef POS_CONFIG_MEMCPY_DMA_THRESHOLD
+#define POS_CONFIG_MEMCPY_DMA_THRESHOLD 0
+#endif
+#if POS_CONFIG_MEMCPY_DMA_THRESHOLD != 0
+#define POS_MEMCPY_DMA 1
+#endif
+#endif
 
+// Copies smaller than this are done by bytes, as aligning them costs more
+// than it saves
+#define POS_MEM_MIN_WORD_SIZE 8
 
 
-void *memcpy(void *dst0, const void *src0, size_t len0)
+static void *pos_memcpy_cpu(void *dst0, const void *src0, size_t len)
 {
-    void *save = dst0;
+    uint8_t *dst = (uint8_t *)dst0;
+    const uint8_t *src = (const uint8_t *)src0;
 
-    char src_aligned = (((size_t) src0) & 3) == 0;
-    char dst_aligned = (((size_t) dst0) & 3) == 0;
-    char copy_full_words = (len0 & 3) == 0;
-
-    if (src_aligned && dst_aligned && copy_full_words)
+    if (len >= POS_MEM_MIN_WORD_SIZE)
     {
-        // all accesses are aligned => can copy full words
-        uint32_t *dst = (uint32_t *) dst0;
-        uint32_t *src = (uint32_t *) src0;
-
-        while (len0)
+        while ((uintptr_t)dst & 3)
         {
             *dst++ = *src++;
-            len0 -= 4;
+            len--;
+        }
+
+        uint32_t *wdst = (uint32_t *)dst;
+        size_t nb_words = len >> 2;
+        int offset = (uintptr_t)src & 3;
+
+        if (offset == 0)
+        {
+            const uint32_t *wsrc = (const uint32_t *)src;
+
+            for (size_t i=0; i<(nb_words >> 2); i++)
+            {
+                uint32_t w0 = wsrc[0];
+                uint32_t w1 = wsrc[1];
+                uint32_t w2 = wsrc[2];
+                uint32_t w3 = wsrc[3];
+                wdst[0] = w0;
+                wdst[1] = w1;
+                wdst[2] = w2;
+                wdst[3] = w3;
+                wsrc += 4;
+                wdst += 4;
+            }
+
+            for (size_t i=0; i<(nb_words & 3); i++)
+            {
+                *wdst++ = *wsrc++;
+            }
+        }
+        else
+        {
+            // The last aligned word which is read may contain a few bytes
+            // after the source buffer, this is harmless as it cannot cross
+            // a memory boundary.
+            const uint32_t *wsrc = (const uint32_t *)(src - offset);
+            int shift = offset * 8;
+            uint32_t prev = *wsrc++;
+
+            for (size_t i=0; i<nb_words; i++)
+            {
+                uint32_t next = *wsrc++;
+                *wdst++ = (prev >> shift) | (next << (32 - shift));
+                prev = next;
+            }
         }
+
+        dst = (uint8_t *)wdst;
+        src += nb_words << 2;
+        len &= 3;
+    }
+
+    while (len)
+    {
+        *dst++ = *src++;
+        len--;
+    }
+
+    return dst0;
+}
+
+
+
+#if defined(POS_MEMCPY_DMA)
+
+// The DMA command size is an unsigned short, chunks are kept word-aligned
+// so that the next ones keep the alignment of the buffers
+#define POS_MEMCPY_DMA_MAX_SIZE 0x8000
+
+static inline int pos_memcpy_is_l1(const void *ptr)
+{
+    return (uint32_t)ptr - ARCHI_CLUSTER_GLOBAL_ADDR(hal_cluster_id()) < ARCHI_CLUSTER_PERIPHERALS_OFFSET;
+}
+
+// Returns 0 if the copy cannot be done by the cluster DMA, which needs one
+// buffer in the L1 of the cluster and the other one outside
+static int pos_memcpy_dma(void *dst, const void *src, size_t len)
+{
+    uint32_t ext, loc;
+    pi_cl_dma_dir_e dir;
+
+    if (hal_is_fc())
+        return 0;
+
+    int dst_l1 = pos_memcpy_is_l1(dst);
+    if (dst_l1 == pos_memcpy_is_l1(src))
+        return 0;
+
+    if (dst_l1)
+    {
+        ext = (uint32_t)src;
+        loc = (uint32_t)dst;
+        dir = PI_CL_DMA_DIR_EXT2LOC;
     }
     else
     {
-        // copy bytewise
-        char *dst = (char *) dst0;
-        char *src = (char *) src0;
+        ext = (uint32_t)dst;
+        loc = (uint32_t)src;
+        dir = PI_CL_DMA_DIR_LOC2EXT;
+    }
+
+    while (len)
+    {
+        pi_cl_dma_cmd_t cmd;
+        uint32_t size = len > POS_MEMCPY_DMA_MAX_SIZE ? POS_MEMCPY_DMA_MAX_SIZE : len;
+
+        pi_cl_dma_cmd(ext, loc, size, dir, &cmd);
+        pi_cl_dma_wait(&cmd);
+
+        ext += size;
+        loc += size;
+        len -= size;
+    }
+
+    return 1;
+}
+
+#endif
+
+
+
+void *memset(void *m, int c, size_t n)
+{
+    uint8_t *s = (uint8_t *)m;
+
+    if (n >= POS_MEM_MIN_WORD_SIZE)
+    {
+        while ((uintptr_t)s & 3)
+        {
+            *s++ = (uint8_t)c;
+            n--;
+        }
 
-        while (len0)
+        uint32_t word = (uint8_t)c * 0x01010101;
+        uint32_t *ws = (uint32_t *)s;
+        size_t nb_words = n >> 2;
+
+        for (size_t i=0; i<(nb_words >> 2); i++)
         {
-            *dst++ = *src++;
-            len0--;
+            ws[0] = word;
+            ws[1] = word;
+            ws[2] = word;
+            ws[3] = word;
+            ws += 4;
         }
+
+        for (size_t i=0; i<(nb_words & 3); i++)
+        {
+            *ws++ = word;
+        }
+
+        s = (uint8_t *)ws;
+        n &= 3;
     }
 
-    return save;
+    while (n)
+    {
+        *s++ = (uint8_t)c;
+        n--;
+    }
+
+    return m;
+}
+
+
+
+void *memcpy(void *dst0, const void *src0, size_t len0)
+{
+#if defined(POS_MEMCPY_DMA)
+    if (len0 >= POS_CONFIG_MEMCPY_DMA_THRESHOLD && pos_memcpy_dma(dst0, src0, len0))
+        return dst0;
+#endif
+
+    return pos_memcpy_cpu(dst0, src0, len0);
 }
 
 
 
 void *memmove(void *d, const void *s, size_t n)
 {
-    char *dest = d;
-    const char *src  = s;
+    uint8_t *dest = (uint8_t *)d;
+    const uint8_t *src = (const uint8_t *)s;
 
     if ((size_t) (dest - src) < n)
     {
@@ -185,23 +362,58 @@ void *memmove(void *d, const void *s, size_t n)
          * The <src> buffer overlaps with the start of the <dest> buffer.
          * Copy backwards to prevent the premature corruption of <src>.
          */
+        dest += n;
+        src += n;
+
+        if (n >= POS_MEM_MIN_WORD_SIZE && (((uintptr_t)dest ^ (uintptr_t)src) & 3) == 0)
+        {
+            while ((uintptr_t)dest & 3)
+            {
+                *--dest = *--src;
+                n--;
+            }
+
+            uint32_t *wdest = (uint32_t *)dest;
+            const uint32_t *wsrc = (const uint32_t *)src;
+            size_t nb_words = n >> 2;
+
+            for (size_t i=0; i<(nb_words >> 2); i++)
+            {
+                uint32_t w3 = wsrc[-1];
+                uint32_t w2 = wsrc[-2];
+                uint32_t w1 = wsrc[-3];
+                uint32_t w0 = wsrc[-4];
+                wdest[-1] = w3;
+                wdest[-2] = w2;
+                wdest[-3] = w1;
+                wdest[-4] = w0;
+                wsrc -= 4;
+                wdest -= 4;
+            }
+
+            for (size_t i=0; i<(nb_words & 3); i++)
+            {
+                *--wdest = *--wsrc;
+            }
+
+            dest = (uint8_t *)wdest;
+            src = (const uint8_t *)wsrc;
+            n &= 3;
+        }
 
         while (n > 0)
         {
+            *--dest = *--src;
             n--;
-            dest[n] = src[n];
         }
     }
     else
     {
-        /* It is safe to perform a forward-copy */
-        while (n > 0)
-        {
-            *dest = *src;
-            dest++;
-            src++;
-            n--;
-        }
+        /*
+         * It is safe to perform a forward-copy, the word copy never writes
+         * a byte of <src> before reading it.
+         */
+        pos_memcpy_cpu(d, s, n);
     }
 
     return d;
@@ -292,6 +504,7 @@ int pos_libc_putc_host_cl_flush()
 }
 
 
+#if !defined(POS_IO_RING)
 static void pos_libc_putc_host(char c)
 {
     char *buffer;
@@ -325,6 +538,7 @@ static void pos_libc_putc_host(char c)
         }
     }
 }
+#endif
 
 #endif
 
@@ -371,6 +585,7 @@ int pos_libc_putc_uart_cl_flush()
     return 0;
 }
 
+#if !defined(POS_IO_RING)
 static void pos_libc_putc_uart(char c)
 {
     if (pos_io_uart_enabled)
@@ -408,12 +623,265 @@ static void pos_libc_putc_uart(char c)
     }
 }
 #endif
+#endif
 
 
 
-static void pos_putc(char c)
+#if defined(POS_IO_RING)
+
+/*
+ * Each core writes its characters to its own ring in L2, without any lock,
+ * and publishes them line by line. A task on the FC gathers the published
+ * lines of all the rings into one buffer, which is written to the UART
+ * asynchronously or to the host, so that a core only waits for the output
+ * when its ring is full.
+ * A core notifies the FC with its own task when it publishes a line and no
+ * notification of it is pending. The FC clears the flag before reading the
+ * ring, so that a line published after that is either seen or notified.
+ * With POS_CONFIG_IO_RING_DROP, a line which does not fit in the ring is
+ * dropped instead of waiting for the FC.
+ */
+
+// Must be a power of 2
+#ifndef POS_CONFIG_IO_RING_SIZE
+#define POS_CONFIG_IO_RING_SIZE 256
+#endif
+
+#define POS_IO_RING_FLUSH_SIZE 1024
+
+#if defined(ARCHI_HAS_CLUSTER)
+#define POS_IO_NB_RINGS (1 + ARCHI_NB_CLUSTER*ARCHI_CLUSTER_NB_PE)
+#else
+#define POS_IO_NB_RINGS 1
+#endif
+
+typedef struct
+{
+    char buffer[POS_CONFIG_IO_RING_SIZE];
+    uint32_t head;       // End of the published characters, written by the core
+    uint32_t tail;       // End of the characters read by the FC
+    uint32_t write;      // End of the characters written by the core
+    uint32_t notif_pending;
+    uint32_t dropping;
+    uint32_t nb_dropped;  // Number of dropped lines, for debug
+    pi_task_t notif_task;
+} pos_io_ring_t;
+
+static PI_L2 pos_io_ring_t pos_io_rings[POS_IO_NB_RINGS];
+static PI_L2 char pos_io_ring_flush_buffer[POS_IO_RING_FLUSH_SIZE + 1];
+static int pos_io_ring_busy;
+
+#if defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
+static PI_FC_TINY pi_task_t pos_io_ring_write_task;
+#endif
+
+
+static void pos_io_ring_flush(int sync);
+
+
+#if defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
+static void pos_io_ring_write_done(void *arg)
 {
+    pos_io_ring_busy = 0;
+    pos_io_ring_flush(0);
+}
+#endif
+
+
+static void pos_io_ring_notif(void *arg)
+{
+    pos_io_ring_t *ring = (pos_io_ring_t *)arg;
+
+    // Only cleared here, once the notification task is not queued anymore,
+    // so that the core never pushes it twice. The flush reads the head
+    // after, so that the lines published before are seen.
+    *(volatile uint32_t *)&ring->notif_pending = 0;
+    hal_compiler_barrier();
+
+    pos_io_ring_flush(0);
+}
+
+
+// Gather the published lines into the flush buffer and write them. With
+// sync, this returns once all of them are written.
+static void pos_io_ring_flush(int sync)
+{
+    do
+    {
+        if (pos_io_ring_busy)
+            return;
+
+        int size = 0;
+
+        for (int i=0; i<POS_IO_NB_RINGS; i++)
+        {
+            pos_io_ring_t *ring = &pos_io_rings[i];
+            uint32_t tail = ring->tail;
+            uint32_t head = *(volatile uint32_t *)&ring->head;
+
+            while (tail != head && size < POS_IO_RING_FLUSH_SIZE)
+            {
+                pos_io_ring_flush_buffer[size++] = ring->buffer[tail & (POS_CONFIG_IO_RING_SIZE - 1)];
+                tail++;
+            }
+
+            hal_compiler_barrier();
+            *(volatile uint32_t *)&ring->tail = tail;
+        }
+
+        if (size == 0)
+            return;
+
 #if defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
+        if (pos_io_uart_enabled)
+        {
+            if (sync)
+            {
+                pi_uart_write(&pos_io_uart, pos_io_ring_flush_buffer, size);
+            }
+            else
+            {
+                pos_io_ring_busy = 1;
+                pi_uart_write_async(&pos_io_uart, pos_io_ring_flush_buffer, size,
+                    pi_task_callback(&pos_io_ring_write_task, pos_io_ring_write_done, NULL));
+            }
+        }
+#else
+        pos_io_ring_flush_buffer[size] = 0;
+        pos_semihost_write0(pos_io_ring_flush_buffer);
+#endif
+    }
+    while (!pos_io_ring_busy);
+}
+
+
+static inline pos_io_ring_t *pos_io_ring_get()
+{
+#if defined(ARCHI_HAS_CLUSTER)
+    if (!hal_is_fc())
+        return &pos_io_rings[1 + hal_cluster_id()*ARCHI_CLUSTER_NB_PE + hal_core_id()];
+#endif
+    return &pos_io_rings[0];
+}
+
+
+static void pos_io_ring_publish(pos_io_ring_t *ring)
+{
+    hal_compiler_barrier();
+    *(volatile uint32_t *)&ring->head = ring->write;
+    hal_compiler_barrier();
+
+    if (*(volatile uint32_t *)&ring->notif_pending == 0)
+    {
+        ring->notif_pending = 1;
+
+        if (hal_is_fc())
+        {
+            int irq = hal_irq_disable();
+            pos_task_push_locked(&ring->notif_task);
+            hal_irq_restore(irq);
+        }
+#if defined(ARCHI_HAS_CLUSTER)
+        else
+        {
+            pos_cluster_push_fc_event(&ring->notif_task);
+        }
+#endif
+    }
+}
+
+
+static void pos_io_ring_putc(char c)
+{
+    pos_io_ring_t *ring = pos_io_ring_get();
+
+#if defined(POS_CONFIG_IO_RING_DROP) && POS_CONFIG_IO_RING_DROP == 1
+    if (ring->dropping)
+    {
+        if (c == '\n')
+            ring->dropping = 0;
+        return;
+    }
+
+    if (ring->write - *(volatile uint32_t *)&ring->tail == POS_CONFIG_IO_RING_SIZE)
+    {
+        // Forget the beginning of the line and skip the rest of it
+        ring->write = ring->head;
+        ring->nb_dropped++;
+        ring->dropping = c != '\n';
+        return;
+    }
+#else
+    if (ring->write - *(volatile uint32_t *)&ring->tail == POS_CONFIG_IO_RING_SIZE)
+    {
+        // The line is bigger than the ring, publish what we have to make
+        // room for the rest
+        if (ring->head != ring->write)
+            pos_io_ring_publish(ring);
+
+        while (ring->write - *(volatile uint32_t *)&ring->tail == POS_CONFIG_IO_RING_SIZE)
+        {
+            if (hal_is_fc())
+            {
+                pos_io_ring_flush(0);
+                pi_yield();
+            }
+        }
+    }
+#endif
+
+    ring->buffer[ring->write & (POS_CONFIG_IO_RING_SIZE - 1)] = c;
+    ring->write++;
+
+    if (c == '\n')
+        pos_io_ring_publish(ring);
+}
+
+
+static void pos_io_ring_init()
+{
+    for (int i=0; i<POS_IO_NB_RINGS; i++)
+    {
+        pos_io_ring_t *ring = &pos_io_rings[i];
+        ring->head = 0;
+        ring->tail = 0;
+        ring->write = 0;
+        ring->notif_pending = 0;
+        ring->dropping = 0;
+        ring->nb_dropped = 0;
+        pi_task_callback(&ring->notif_task, pos_io_ring_notif, ring);
+    }
+
+    pos_io_ring_busy = 0;
+}
+
+
+// Write what is left in the rings, including the lines which are not
+// terminated
+static void pos_io_ring_stop()
+{
+    while (*(volatile int *)&pos_io_ring_busy)
+    {
+        pi_yield();
+    }
+
+    for (int i=0; i<POS_IO_NB_RINGS; i++)
+    {
+        pos_io_rings[i].head = pos_io_rings[i].write;
+    }
+
+    pos_io_ring_flush(1);
+}
+
+#endif
+
+
+
+static void pos_putc(char c)
+{
+#if defined(POS_IO_RING)
+    pos_io_ring_putc(c);
+#elif defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
     pos_libc_putc_uart(c);
 #elif defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1
     pos_libc_putc_host(c);
@@ -426,7 +894,7 @@ static void pos_putc(char c)
 
 int puts(const char *s)
 {
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_lock(&pos_io_lock);
 #endif
@@ -444,7 +912,7 @@ int puts(const char *s)
         s++;
     } while(1);
 
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_unlock(&pos_io_lock);
 #endif
@@ -456,14 +924,14 @@ int puts(const char *s)
 
 int fputc(int c, FILE *stream)
 {
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_lock(&pos_io_lock);
 #endif
 
     pos_putc(c);
 
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_unlock(&pos_io_lock);
 #endif
@@ -492,14 +960,14 @@ int pos_libc_prf_locked(int (*func)(), void *dest, char *format, va_list vargs)
 {
     int err;
 
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_lock(&pos_io_lock);
 #endif
 
     err =  pos_libc_prf(func, dest, format, vargs);
 
-#if (defined(POS_CONFIG_IO_HOST) && POS_CONFIG_IO_HOST == 1) || (defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1)
+#if defined(POS_IO_LOCK)
     if (!hal_is_fc())
         pos_cl_mutex_unlock(&pos_io_lock);
 #endif
@@ -573,6 +1041,10 @@ int pos_io_start()
 
 int pos_io_stop()
 {
+#if defined(POS_IO_RING)
+    pos_io_ring_stop();
+#endif
+
 #if defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
 
     pos_io_uart_enabled = 0;
@@ -635,4 +1107,8 @@ void __attribute__((constructor)) pos_io_init()
 #if defined(POS_CONFIG_IO_UART) && POS_CONFIG_IO_UART == 1
     pos_io_uart_enabled = 0;
 #endif
+
+#if defined(POS_IO_RING)
+    pos_io_ring_init();
+#endif
 }
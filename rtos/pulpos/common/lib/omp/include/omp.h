@@ -23,6 +23,17 @@ typedef unsigned int omp_lock_t;
 
 int omp_get_thread_num(void);
 
+typedef enum omp_sched_t {
+  omp_sched_static = 1,
+  omp_sched_dynamic = 2,
+  omp_sched_guided = 3,
+  omp_sched_auto = 4
+} omp_sched_t;
+
+// Schedule of the loops using schedule(runtime), static by default
+void omp_set_schedule(omp_sched_t kind, int chunk_size);
+void omp_get_schedule(omp_sched_t *kind, int *chunk_size);
+
 typedef int               kmp_int32;
 typedef void (*kmpc_micro)              ( kmp_int32 * global_tid, kmp_int32 * bound_tid, void *args);
 
@@ -47,4 +58,27 @@ void __kmpc_fork_call(ident_t *loc, kmp_int32 argc, kmpc_micro microtask, int **
 
 int rt_omp_start();
 
+/*
+ * Reductions, PULP extension. They must be called by all the threads of the
+ * team, which all get the combined value. This is much faster than reduction
+ * clauses, which are compiled as critical sections.
+ *   sum = omp_reduce_add_i32(partial_sum);
+ */
+int omp_reduce_add_i32(int value);
+int omp_reduce_min_i32(int value);
+int omp_reduce_max_i32(int value);
+unsigned int omp_reduce_add_u32(unsigned int value);
+float omp_reduce_add_f32(float value);
+float omp_reduce_min_f32(float value);
+float omp_reduce_max_f32(float value);
+v2s omp_reduce_add_v2s(v2s value);
+v4s omp_reduce_add_v4s(v4s value);
+
+// Element-wise reduction of arrays privatized by each thread, the combined
+// array is written to out, which can be the private array of any thread.
+void omp_reduce_add_i32_array(int *out, int *priv, int len);
+void omp_reduce_add_f32_array(float *out, float *priv, int len);
+void omp_reduce_add_v2s_array(v2s *out, v2s *priv, int len);
+void omp_reduce_add_v4s_array(v4s *out, v4s *priv, int len);
+
 #endif
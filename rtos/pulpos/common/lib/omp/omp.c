@@ -23,36 +23,13 @@
 
 omp_t PI_CL_L1_TINY ompData;
 PI_CL_L1_TINY int core_epoch[16];
-
-static void handleReadyTasks(omp_team_t *team);
+PI_CL_L1_TINY int core_guided_epoch[16];
+PI_CL_L1 omp_static_loop_t ompStaticLoops[16];
 
 /*
  * OMP runtime library
  */
 
-#if 0
-static void handleReadyTasks(omp_team_t *team)
-{
-  criticalStart(team);
-  ompTask_t *task = team->firstReadyTask;
-  omp_t *_this = omp_getData();
-  if (task) {
-    team->firstReadyTask = task->next;
-    if (team->firstReadyTask == NULL) {
-      team->lastReadyTask = NULL;
-      team->hasTasks = 0;
-    }
-    void (*func)(void *) = task->func;
-    void *data = task->data;
-    freeTask(rtCc, _this, task);
-    criticalEnd(team);
-    func(data);
-  } else {
-    criticalEnd(team);
-  }
-}
-#endif
-
 static inline void initTeam(omp_t *_this, omp_team_t *team)
 {
 }
@@ -89,18 +66,19 @@ static void __rt_omp_init(int exec_main)
   _this->plainTeam.loop_epoch = 0;
   _this->plainTeam.loop_is_setup = 0;
 #endif
-  //_this->plainTeam.firstReadyTask = NULL;
-  //_this->taskPool = NULL;
-  //_this->plainTeam.hasTasks = 0;
-  #if 0
-  ompTask_t *taskPool = (ompTask_t *)rt_l1_alloc(rtCc, sizeof(ompTask_t)*rtCc->nbCores*2);
-  unsigned int i;
-  for (i=0; i<rtCc->nbCores*2; i++) {
-    ompTask_t *task = &taskPool[i];
-    task->next = _this->taskPool;
-    _this->taskPool = task;
+#if EU_VERSION >= 3
+  _this->plainTeam.guided_epoch = 0;
+  _this->plainTeam.guided_is_setup = 0;
+  for (int i=0; i<16; i++)
+  {
+    core_guided_epoch[i] = 0;
   }
-  #endif
+#endif
+  _this->runSched = omp_sched_static;
+  _this->runChunk = 0;
+
+  ompReduceInit();
+  ompTaskInit(_this);
 
   initTeam(_this, &_this->plainTeam);
 
@@ -164,6 +142,20 @@ int omp_get_num_threads(void) {
   return team->nbThreads;
 }
 
+void omp_set_schedule(omp_sched_t kind, int chunk_size)
+{
+  omp_t *omp = omp_getData();
+  omp->runSched = kind;
+  omp->runChunk = chunk_size;
+}
+
+void omp_get_schedule(omp_sched_t *kind, int *chunk_size)
+{
+  omp_t *omp = omp_getData();
+  *kind = omp->runSched;
+  *chunk_size = omp->runChunk;
+}
+
 void partialParallelRegion(void (*fn) (void*), void *data, int num_threads)
 {
   omp_t *_this = omp_getData();
@@ -190,17 +182,25 @@ void partialParallelRegion(void (*fn) (void*), void *data, int num_threads)
   eu_loop_initEpoch(eu_loop_addr(1), coreMask);
 #else
   team->loop_epoch = 0;
-  for (int i=0; i<team->nbThreads; i++)
+  for (int i=0; i<nbCores; i++)
   {
     core_epoch[i] = 0;
   }
 #endif
+  team->guided_epoch = 0;
+  for (int i=0; i<nbCores; i++)
+  {
+    core_guided_epoch[i] = 0;
+  }
 #else
   team->nbThreads = num_threads;
   pulp_barrier_setup(0, num_threads, (1<<num_threads)-1);
   parallelRegionExec(data, fn);
   pulp_barrier_setup(0, nbCores, _this->coreMask);
 #endif
+  // The cores outside of the partial team did not take part in its
+  // reductions, realign the reduction epochs as well
+  ompReduceInit();
   team->nbThreads = nbCores;
 }
 
@@ -30,19 +30,91 @@
 
 struct omp_ws_s;
 
+/*
+ * Explicit tasks. Deferred tasks are allocated from a pool in L1 and pushed to
+ * the deque of the core which made them ready. Each core pops its own tasks
+ * in LIFO order and steals the oldest tasks from the other cores when its
+ * deque is empty. When the pool or the deque is full, or when the arguments
+ * do not fit, the task is executed immediately by the encountering thread.
+ */
+
+#ifndef OMP_TASK_POOL_SIZE
+#define OMP_TASK_POOL_SIZE 32
+#endif
+
+// Maximum size of the arguments captured by a deferred task
+#ifndef OMP_TASK_ARG_SIZE
+#define OMP_TASK_ARG_SIZE 64
+#endif
+
+// Must be a power of 2
+#ifndef OMP_TASK_DEQUE_SIZE
+#define OMP_TASK_DEQUE_SIZE 16
+#endif
+
+// Number of addresses tracked for depend clauses, must be a power of 2
+#ifndef OMP_TASK_DEP_TABLE_SIZE
+#define OMP_TASK_DEP_TABLE_SIZE 32
+#endif
+
+#define OMP_TASK_MAX_SUCC    4
+#define OMP_TASK_DEP_READERS 2
+
+#define GOMP_TASK_FLAG_UNTIED    (1 << 0)
+#define GOMP_TASK_FLAG_FINAL     (1 << 1)
+#define GOMP_TASK_FLAG_MERGEABLE (1 << 2)
+#define GOMP_TASK_FLAG_DEPEND    (1 << 3)
+
+// Dependencies only apply between sibling tasks, so the entries of the
+// dependency table and the fence belong to the task which created the tasks
+typedef struct {
+  struct ompTask_s *fence;
+  unsigned int fence_id;
+} omp_task_dep_scope_t;
+
 typedef struct ompTask_s {
+  // Must be first as the pool keeps its free list there
+  struct ompTask_s *next;
   void (*func)(void *);
   void *data;
-  struct ompTask_s *next;
+  // NULL if the parent is the implicit task of parent_core
+  struct ompTask_s *parent;
+  // Identifies this instance of the descriptor, as it can be reused as soon
+  // as the task is done
+  unsigned int id;
+  short nb_children;
+  short nb_pred;
+  char nb_succ;
+  char done;
+  char parent_core;
+  struct ompTask_s *succ[OMP_TASK_MAX_SUCC];
+  // Scope of the dependencies of the children
+  omp_task_dep_scope_t deps;
+  long long args[OMP_TASK_ARG_SIZE / sizeof(long long)];
 } ompTask_t;
 
+typedef struct {
+  unsigned int lock;
+  unsigned int head;    // Stealing side
+  unsigned int tail;    // Owner side
+  ompTask_t *tasks[OMP_TASK_DEQUE_SIZE];
+} omp_task_deque_t;
+
+// Last tasks which accessed an address given in a depend clause
+typedef struct {
+  void *addr;
+  omp_task_dep_scope_t *scope;
+  ompTask_t *out;
+  unsigned int out_id;
+  ompTask_t *in[OMP_TASK_DEP_READERS];
+  unsigned int in_id[OMP_TASK_DEP_READERS];
+  int next_in;
+} omp_task_dep_t;
+
 typedef struct {
   //int id;
   //int barrier;
-  //ompTask_t *firstReadyTask;
-  //ompTask_t *lastReadyTask;
   char nbThreads;
-  //char hasTasks;
 #if EU_VERSION == 1
   plp_swMutex_t mutex;
 #endif
@@ -54,19 +126,49 @@ typedef struct {
   int loop_chunk;
   int loop_is_setup;
 #endif
+#if EU_VERSION >= 3
+  // Guided loops are always handled by software as the chunk size changes
+  int guided_epoch;
+  int guided_next;
+  int guided_nb_iter;
+  int guided_start;
+  int guided_incr;
+  int guided_chunk;
+  int guided_is_setup;
+  // Protects the task graph, e.g. task counters and dependencies
+  unsigned int task_lock;
+  int nb_pending_tasks;
+  unsigned int task_id;
+  int bar_count;
+  int bar_gen;
+#endif
 } omp_team_t;
 
+// Iterations of a static loop assigned to one core, chunk after chunk
+typedef struct {
+  int start;
+  int incr;
+  int nb_iter;
+  int next;
+  int size;
+  int stride;
+} omp_static_loop_t;
+
 typedef struct {
-  //ompTask_t *taskPool;
   omp_team_t plainTeam;
 #ifdef __clang__
   int numThreads;
 #endif
   unsigned short coreMask;
+  // Schedule used by schedule(runtime) loops, see omp_set_schedule
+  char runSched;
+  int runChunk;
 } omp_t;
 
 extern omp_t PI_CL_L1_TINY ompData;
 extern PI_CL_L1_TINY int core_epoch[16];
+extern PI_CL_L1_TINY int core_guided_epoch[16];
+extern PI_CL_L1 omp_static_loop_t ompStaticLoops[16];
 
 void partialParallelRegion(void (*fn) (void*), void *data, int num_threads);
 
@@ -111,30 +213,15 @@ static inline int getThreadNum(omp_t *omp)
   return pi_core_id();
 }
 
-#ifdef __GNUC__
-static inline ompTask_t *allocTask(omp_t *_this, int arg_size) 
-{
-#if 0
-  ompTask_t *task = _this->taskPool;
-  if (task == NULL) return NULL;
-  _this->taskPool = task->next;
-  return task;
-#else
-  //return (ompTask_t *)rt_l1_alloc(rtCc, sizeof(ompTask_t)+arg_size);
-  return (void *)0;
-#endif
-}
-#endif
+void ompReduceInit();
 
-static inline void freeTask(omp_t *_this, ompTask_t *task) 
-{
-#if 1
-  //task->next = _this->taskPool;
-  //_this->taskPool = task;
-#else
-  rt_l1_free(rtCc, (unsigned int)task);
-#endif
-}
+void ompTaskInit(omp_t *_this);
+void ompTaskCreate(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *),
+  long arg_size, long arg_align, int if_clause, unsigned int flags, void **depend);
+void ompTaskWait();
+int ompTaskYield();
+void ompTaskDrain(omp_team_t *team);
+void ompTaskBarrier(omp_team_t *team);
 
 // This returns OMP data in 3 instructions (address construction + load)
 static inline omp_t *omp_getData() {
@@ -193,6 +280,11 @@ static inline void userCriticalEnd(omp_team_t *team)
 
 static inline __attribute__((always_inline)) void doBarrier(omp_team_t *team) {
 #if EU_VERSION >= 3
+  // Tasks must all be done when leaving the barrier. As the other threads
+  // may already sleep in the hardware barrier, this thread executes the
+  // remaining ones.
+  if (*(volatile int *)&getCurrentTeam()->nb_pending_tasks)
+    ompTaskDrain(getCurrentTeam());
   pi_cl_team_barrier();
 #else
   pulp_barrier_notify(0);
@@ -205,7 +297,13 @@ static inline void userBarrier(omp_team_t *team) {
 #ifdef __PROFILE0__
   pulp_trace(TRACE_OMP_BARRIER_ENTER);
 #endif
+#if EU_VERSION >= 3
+  // Explicit barriers are where the other threads wait while a single thread
+  // creates tasks, so they must be able to execute them
+  ompTaskBarrier(team);
+#else
   doBarrier(team);
+#endif
 #ifdef __PROFILE0__
   pulp_trace(TRACE_OMP_BARRIER_EXIT);
 #endif
@@ -370,7 +468,7 @@ end:
 
     team->loop_start = start + chunk;
 
-    if (start >= end)
+    if (team->loop_incr > 0 ? start >= end : start <= end)
     {
       team->loop_epoch++;
       team->loop_is_setup = 0;
@@ -382,9 +480,9 @@ end:
     eu_mutex_unlock(eu_mutex_addr(0));
 
     *istart = start;
-    if (start + chunk > end)
+    if (team->loop_incr > 0 ? start + chunk > end : start + chunk < end)
       chunk = end - start;
-    *iend = start;
+    *iend = start + chunk;
 
     result = 1;
 
@@ -438,7 +536,7 @@ end:
     team->loop_start = start;
     team->loop_end = end;
     team->loop_incr = incr;
-    team->loop_chunk = chunk_size;
+    team->loop_chunk = chunk_size * incr;
   }
   eu_mutex_unlock(eu_mutex_addr(0));
 
@@ -480,7 +578,7 @@ static inline void dynLoopInitNoIter(omp_team_t *team, int start, int end, int i
     team->loop_start = start;
     team->loop_end = end;
     team->loop_incr = incr;
-    team->loop_chunk = chunk_size;
+    team->loop_chunk = chunk_size * incr;
   }
   eu_mutex_unlock(eu_mutex_addr(0));
 #else
@@ -500,10 +598,153 @@ static inline void dynLoopInitSingle(omp_team_t *team, int start, int end, int i
   team->loop_start = start;
   team->loop_end = end;
   team->loop_incr = incr;
-  team->loop_chunk = chunk_size;
+  team->loop_chunk = chunk_size * incr;
 #endif
 }
 
+static inline int loopNbIter(int start, int end, int incr)
+{
+  if (incr > 0)
+    return end > start ? (end - start + incr - 1) / incr : 0;
+  else
+    return start > end ? (start - end - incr - 1) / -incr : 0;
+}
+
+// Static schedule, each core computes its own iterations without any shared
+// state. Without chunk size, the iterations are split into one contiguous
+// block per core, otherwise the chunks are distributed in round-robin.
+static inline void staticLoopInit(omp_static_loop_t *loop, int thread, int nb_threads,
+  int start, int end, int incr, int chunk_size)
+{
+  int nb_iter = loopNbIter(start, end, incr);
+
+  loop->start = start;
+  loop->incr = incr;
+  loop->nb_iter = nb_iter;
+
+  if (chunk_size <= 0)
+  {
+    int size = nb_iter / nb_threads;
+    int rem = nb_iter - size * nb_threads;
+    loop->next = thread * size + (thread < rem ? thread : rem);
+    loop->size = size + (thread < rem);
+    loop->stride = nb_iter;
+  }
+  else
+  {
+    loop->next = thread * chunk_size;
+    loop->size = chunk_size;
+    loop->stride = nb_threads * chunk_size;
+  }
+}
+
+static inline __attribute__((always_inline)) int staticLoopIter(omp_static_loop_t *loop, int *istart, int *iend)
+{
+  int next = loop->next;
+  int nb_iter = loop->nb_iter;
+
+  if (next >= nb_iter || loop->size == 0)
+    return 0;
+
+  int last = next + loop->size;
+  if (last > nb_iter)
+    last = nb_iter;
+
+  loop->next = next + loop->stride;
+  *istart = loop->start + next * loop->incr;
+  *iend = loop->start + last * loop->incr;
+
+  return 1;
+}
+
+static inline int staticLoopInitIter(omp_team_t *team, int start, int end, int incr, int chunk_size, int *istart, int *iend)
+{
+  int core_id = pi_core_id();
+  omp_static_loop_t *loop = &ompStaticLoops[core_id];
+  staticLoopInit(loop, core_id, team->nbThreads, start, end, incr, chunk_size);
+  return staticLoopIter(loop, istart, iend);
+}
+
+#if EU_VERSION >= 3
+
+// Guided schedule, each chunk is the number of remaining iterations divided
+// by the number of threads, and at least the chunk size. This uses the same
+// epoch scheme as the software dynamic loops to know if a core is entering a
+// new loop or one which is already finished.
+static inline int guidedLoopIter(omp_team_t *team, int *istart, int *iend)
+{
+  int core_id = pi_core_id();
+
+  eu_mutex_lock(eu_mutex_addr(0));
+
+  if (team->guided_epoch - core_guided_epoch[core_id] != 0)
+  {
+    eu_mutex_unlock(eu_mutex_addr(0));
+    core_guided_epoch[core_id]++;
+    return 0;
+  }
+
+  int next = team->guided_next;
+  int remaining = team->guided_nb_iter - next;
+
+  if (remaining <= 0)
+  {
+    team->guided_epoch++;
+    team->guided_is_setup = 0;
+    core_guided_epoch[core_id]++;
+    eu_mutex_unlock(eu_mutex_addr(0));
+    return 0;
+  }
+
+  int size = (remaining + team->nbThreads - 1) / team->nbThreads;
+  if (size < team->guided_chunk)
+    size = team->guided_chunk;
+  if (size > remaining)
+    size = remaining;
+
+  team->guided_next = next + size;
+
+  eu_mutex_unlock(eu_mutex_addr(0));
+
+  *istart = team->guided_start + next * team->guided_incr;
+  *iend = *istart + size * team->guided_incr;
+
+  return 1;
+}
+
+static inline void guidedLoopInitSingle(omp_team_t *team, int start, int end, int incr, int chunk_size)
+{
+  team->guided_is_setup = 1;
+  team->guided_next = 0;
+  team->guided_nb_iter = loopNbIter(start, end, incr);
+  team->guided_start = start;
+  team->guided_incr = incr;
+  team->guided_chunk = chunk_size > 0 ? chunk_size : 1;
+}
+
+static inline int guidedLoopInit(omp_team_t *team, int start, int end, int incr, int chunk_size, int *istart, int *iend)
+{
+  int core_id = pi_core_id();
+
+  eu_mutex_lock(eu_mutex_addr(0));
+
+  if (team->guided_epoch - core_guided_epoch[core_id] != 0)
+  {
+    eu_mutex_unlock(eu_mutex_addr(0));
+    core_guided_epoch[core_id]++;
+    return 0;
+  }
+
+  if (!team->guided_is_setup)
+    guidedLoopInitSingle(team, start, end, incr, chunk_size);
+
+  eu_mutex_unlock(eu_mutex_addr(0));
+
+  return guidedLoopIter(team, istart, iend);
+}
+
+#endif
+
 static inline int singleStart()
 {
 #ifdef ARCHI_EU_HAS_DYNLOOP
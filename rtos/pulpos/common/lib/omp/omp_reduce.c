@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ompRt.h"
+#include "pmsis.h"
+#include <string.h>
+
+/*
+ * OMP reductions
+ *
+ * Each core publishes its partial value in its own L1 slot, and the values
+ * are combined by pairs in log2(nb_threads) steps: at step s, the cores
+ * whose id is a multiple of 2s combine the value of core id+s. Core 0 then
+ * broadcasts the result. Cores only wait for the slot of their partner, so
+ * there is no barrier between steps.
+ */
+
+typedef struct {
+  long long value;
+  int epoch;
+} omp_reduce_slot_t;
+
+static PI_CL_L1 omp_reduce_slot_t ompReduceSlots[16];
+// Number of reductions done by each core, used to identify the current one
+static PI_CL_L1 int ompReduceCount[16];
+static PI_CL_L1 long long ompReduceResult;
+static PI_CL_L1 int ompReduceEpoch;
+// Private arrays of each core for array reductions
+static PI_CL_L1 void *ompReduceArrays[16];
+
+void ompReduceInit()
+{
+  for (int i=0; i<16; i++)
+  {
+    ompReduceSlots[i].epoch = 0;
+    ompReduceCount[i] = 0;
+  }
+  ompReduceEpoch = 0;
+}
+
+static void ompReduce(void *value, int size, void (*combine)(void *acc, void *value))
+{
+  int nb_threads = getCurrentTeam()->nbThreads;
+  int core_id = pi_core_id();
+  int epoch = ++ompReduceCount[core_id];
+  long long acc;
+
+  memcpy(&acc, value, size);
+
+  for (int step=1; step<nb_threads; step<<=1)
+  {
+    if (core_id & step)
+    {
+      ompReduceSlots[core_id].value = acc;
+      hal_compiler_barrier();
+      *(volatile int *)&ompReduceSlots[core_id].epoch = epoch;
+      break;
+    }
+
+    int partner = core_id + step;
+    if (partner < nb_threads)
+    {
+      while (*(volatile int *)&ompReduceSlots[partner].epoch != epoch)
+      {
+      }
+      hal_compiler_barrier();
+      combine(&acc, &ompReduceSlots[partner].value);
+    }
+  }
+
+  // The slots cannot be overwritten by the next reduction before core 0 has
+  // read them, as all cores first wait for the result of this one.
+  if (core_id == 0)
+  {
+    ompReduceResult = acc;
+    hal_compiler_barrier();
+    *(volatile int *)&ompReduceEpoch = epoch;
+  }
+  else
+  {
+    while (*(volatile int *)&ompReduceEpoch != epoch)
+    {
+    }
+    hal_compiler_barrier();
+    acc = ompReduceResult;
+  }
+
+  memcpy(value, &acc, size);
+}
+
+#define OMP_REDUCE(name, type, expr)                                \
+static void ompReduce_##name(void *acc, void *value)                \
+{                                                                   \
+  type a = *(type *)acc;                                            \
+  type b = *(type *)value;                                          \
+  *(type *)acc = (expr);                                            \
+}                                                                   \
+                                                                    \
+type omp_reduce_##name(type value)                                  \
+{                                                                   \
+  ompReduce(&value, sizeof(type), ompReduce_##name);                \
+  return value;                                                     \
+}
+
+OMP_REDUCE(add_i32, int, a + b)
+OMP_REDUCE(min_i32, int, a < b ? a : b)
+OMP_REDUCE(max_i32, int, a > b ? a : b)
+OMP_REDUCE(add_u32, unsigned int, a + b)
+OMP_REDUCE(add_f32, float, a + b)
+OMP_REDUCE(min_f32, float, a < b ? a : b)
+OMP_REDUCE(max_f32, float, a > b ? a : b)
+// SIMD types, combined with a single vector instruction
+OMP_REDUCE(add_v2s, v2s, a + b)
+OMP_REDUCE(add_v4s, v4s, a + b)
+
+/*
+ * Array reductions, for arrays privatized by each thread. Instead of combining
+ * the arrays by pairs, each core combines one slice of all of them, so that
+ * the work is spread over the team. The output can be one of the private
+ * arrays.
+ */
+
+#define OMP_REDUCE_ARRAY(name, type, expr)                                  \
+void omp_reduce_##name##_array(type *out, type *priv, int len)              \
+{                                                                           \
+  omp_team_t *team = getCurrentTeam();                                      \
+  int nb_threads = team->nbThreads;                                         \
+  int core_id = pi_core_id();                                               \
+  int chunk = (len + nb_threads - 1) / nb_threads;                          \
+  int first = core_id * chunk;                                              \
+  int last = first + chunk > len ? len : first + chunk;                     \
+                                                                            \
+  ompReduceArrays[core_id] = priv;                                          \
+  doBarrier(team);                                                          \
+                                                                            \
+  for (int i=first; i<last; i++)                                            \
+  {                                                                         \
+    type a = ((type *)ompReduceArrays[0])[i];                               \
+    for (int j=1; j<nb_threads; j++)                                        \
+    {                                                                       \
+      type b = ((type *)ompReduceArrays[j])[i];                             \
+      a = (expr);                                                           \
+    }                                                                       \
+    out[i] = a;                                                             \
+  }                                                                         \
+                                                                            \
+  doBarrier(team);                                                          \
+}
+
+OMP_REDUCE_ARRAY(add_i32, int, a + b)
+OMP_REDUCE_ARRAY(add_f32, float, a + b)
+OMP_REDUCE_ARRAY(add_v2s, v2s, a + b)
+OMP_REDUCE_ARRAY(add_v4s, v4s, a + b)
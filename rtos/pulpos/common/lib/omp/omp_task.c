@@ -0,0 +1,698 @@
+/*
+ * Copyright (C) 2018 ETH Zurich and University of Bologna
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ompRt.h"
+#include "pmsis.h"
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * OMP explicit tasks
+ */
+
+#if EU_VERSION >= 3
+
+static PI_CL_L1 ompTask_t ompTaskObjs[OMP_TASK_POOL_SIZE];
+static PI_CL_L1 pos_obj_pool_t ompTaskPool;
+
+static PI_CL_L1 omp_task_deque_t ompTaskDeques[ARCHI_CLUSTER_NB_PE];
+
+// Task being executed by each core, NULL for the implicit task
+static PI_CL_L1 ompTask_t *ompCurrentTask[ARCHI_CLUSTER_NB_PE];
+// Children of the implicit task of each core which are not done
+static PI_CL_L1 int ompImplicitChildren[ARCHI_CLUSTER_NB_PE];
+// Number of final tasks being executed by each core
+static PI_CL_L1 int ompFinalDepth[ARCHI_CLUSTER_NB_PE];
+
+static PI_CL_L1 omp_task_dep_t ompTaskDeps[OMP_TASK_DEP_TABLE_SIZE];
+// Dependency scope of the children of the implicit task of each core
+static PI_CL_L1 omp_task_dep_scope_t ompImplicitDeps[ARCHI_CLUSTER_NB_PE];
+
+
+static inline void ompTaskLock(unsigned int *lock)
+{
+  while (pos_tas_lock_32((unsigned int)lock) == -1)
+  {
+  }
+}
+
+static inline void ompTaskUnlock(unsigned int *lock)
+{
+  pos_tas_unlock_32((unsigned int)lock, 0);
+}
+
+// Wake-up the threads sleeping until a task is ready or done
+static inline void ompTaskNotify()
+{
+  eu_evt_trig(eu_evt_trig_addr(POS_EVENT_CLUSTER_OMP), 0);
+}
+
+static inline void ompTaskSleep()
+{
+  eu_evt_maskWaitAndClr(1<<POS_EVENT_CLUSTER_OMP);
+}
+
+// Tasks can be checked after they are done, as the descriptor keeps its id
+// and done flag until it is allocated again
+static inline int ompTaskIsLive(ompTask_t *task, unsigned int id)
+{
+  return task && *(volatile unsigned int *)&task->id == id && !*(volatile char *)&task->done;
+}
+
+
+
+static int ompTaskPush(int core, ompTask_t *task)
+{
+  omp_task_deque_t *deque = &ompTaskDeques[core];
+  int result = -1;
+
+  ompTaskLock(&deque->lock);
+  if (deque->tail - deque->head < OMP_TASK_DEQUE_SIZE)
+  {
+    deque->tasks[deque->tail & (OMP_TASK_DEQUE_SIZE - 1)] = task;
+    deque->tail++;
+    result = 0;
+  }
+  ompTaskUnlock(&deque->lock);
+
+  return result;
+}
+
+static ompTask_t *ompTaskPop(omp_task_deque_t *deque, int steal)
+{
+  ompTask_t *task = NULL;
+
+  if (*(volatile unsigned int *)&deque->tail == *(volatile unsigned int *)&deque->head)
+    return NULL;
+
+  ompTaskLock(&deque->lock);
+  if (deque->tail != deque->head)
+  {
+    if (steal)
+      task = deque->tasks[deque->head++ & (OMP_TASK_DEQUE_SIZE - 1)];
+    else
+      task = deque->tasks[--deque->tail & (OMP_TASK_DEQUE_SIZE - 1)];
+  }
+  ompTaskUnlock(&deque->lock);
+
+  return task;
+}
+
+static ompTask_t *ompTaskGetReady(omp_team_t *team, int core)
+{
+  ompTask_t *task = ompTaskPop(&ompTaskDeques[core], 0);
+  if (task)
+    return task;
+
+  int nb_threads = team->nbThreads;
+  int victim = core;
+  for (int i=1; i<nb_threads; i++)
+  {
+    victim = victim + 1 == nb_threads ? 0 : victim + 1;
+    task = ompTaskPop(&ompTaskDeques[victim], 1);
+    if (task)
+      return task;
+  }
+
+  return NULL;
+}
+
+
+
+// Tasks are usually created by one core and freed by the others, so the
+// per-core caches of the pool are not used, they would keep all the tasks
+// away from the producer.
+static ompTask_t *ompTaskAlloc()
+{
+  pos_obj_pool_lock(&ompTaskPool);
+  ompTask_t *task = pos_obj_pool_pop(&ompTaskPool);
+  pos_obj_pool_unlock(&ompTaskPool);
+  return task;
+}
+
+static void ompTaskFree(ompTask_t *task)
+{
+  pos_obj_pool_lock(&ompTaskPool);
+  pos_obj_pool_push(&ompTaskPool, task);
+  pos_obj_pool_unlock(&ompTaskPool);
+}
+
+static void ompTaskRun(omp_team_t *team, ompTask_t *task);
+
+static void ompTaskComplete(omp_team_t *team, ompTask_t *task)
+{
+  ompTask_t *ready[OMP_TASK_MAX_SUCC];
+  int nb_ready = 0;
+
+  ompTaskLock(&team->task_lock);
+
+  task->done = 1;
+
+  for (int i=0; i<task->nb_succ; i++)
+  {
+    ompTask_t *succ = task->succ[i];
+    if (--succ->nb_pred == 0)
+      ready[nb_ready++] = succ;
+  }
+
+  // A task descriptor is released only once the task and all its children
+  // are done, as the children refer to it
+  ompTask_t *parent = task->parent;
+  if (parent)
+  {
+    if (--parent->nb_children == 0 && parent->done)
+      ompTaskFree(parent);
+  }
+  else
+  {
+    ompImplicitChildren[(int)task->parent_core]--;
+  }
+
+  if (task->nb_children == 0)
+    ompTaskFree(task);
+
+  team->nb_pending_tasks--;
+
+  ompTaskUnlock(&team->task_lock);
+
+  int core = pi_core_id();
+  for (int i=0; i<nb_ready; i++)
+  {
+    if (ompTaskPush(core, ready[i]))
+      ompTaskRun(team, ready[i]);
+  }
+
+  ompTaskNotify();
+}
+
+static void ompTaskRun(omp_team_t *team, ompTask_t *task)
+{
+  int core = pi_core_id();
+  ompTask_t *prev = ompCurrentTask[core];
+
+  ompCurrentTask[core] = task;
+  task->func(task->data);
+  ompCurrentTask[core] = prev;
+
+  ompTaskComplete(team, task);
+}
+
+// Execute a ready task if there is one, return 0 otherwise
+static int ompTaskSchedule(omp_team_t *team)
+{
+  ompTask_t *task = ompTaskGetReady(team, pi_core_id());
+  if (task == NULL)
+    return 0;
+
+  ompTaskRun(team, task);
+  return 1;
+}
+
+
+
+// Make the task depend on pred. If the successors of pred are full, it
+// depends instead on the last one, which cannot start before pred is done.
+static void ompTaskAddPred(ompTask_t *task, ompTask_t *pred, unsigned int id)
+{
+  while (ompTaskIsLive(pred, id) && pred != task)
+  {
+    for (int i=0; i<pred->nb_succ; i++)
+    {
+      if (pred->succ[i] == task)
+        return;
+    }
+
+    if (pred->nb_succ < OMP_TASK_MAX_SUCC)
+    {
+      pred->succ[(int)pred->nb_succ++] = task;
+      task->nb_pred++;
+      return;
+    }
+
+    pred = pred->succ[OMP_TASK_MAX_SUCC - 1];
+    id = pred->id;
+  }
+}
+
+static int ompTaskDepIsStale(omp_task_dep_t *dep)
+{
+  if (ompTaskIsLive(dep->out, dep->out_id))
+    return 0;
+
+  for (int i=0; i<OMP_TASK_DEP_READERS; i++)
+  {
+    if (ompTaskIsLive(dep->in[i], dep->in_id[i]))
+      return 0;
+  }
+
+  return 1;
+}
+
+static inline omp_task_dep_scope_t *ompTaskDepScope(ompTask_t *parent, int core)
+{
+  return parent ? &parent->deps : &ompImplicitDeps[core];
+}
+
+static omp_task_dep_t *ompTaskDepLookup(omp_task_dep_scope_t *scope, void *addr, int create)
+{
+  omp_task_dep_t *free_dep = NULL;
+  int index = ((uintptr_t)addr >> 2) & (OMP_TASK_DEP_TABLE_SIZE - 1);
+
+  for (int i=0; i<OMP_TASK_DEP_TABLE_SIZE; i++)
+  {
+    omp_task_dep_t *dep = &ompTaskDeps[index];
+
+    if (dep->addr == addr && dep->scope == scope)
+      return dep;
+
+    if (dep->addr == NULL)
+    {
+      if (free_dep == NULL)
+        free_dep = dep;
+      break;
+    }
+
+    if (create && free_dep == NULL && ompTaskDepIsStale(dep))
+      free_dep = dep;
+
+    index = (index + 1) & (OMP_TASK_DEP_TABLE_SIZE - 1);
+  }
+
+  if (!create || free_dep == NULL)
+    return NULL;
+
+  // Stale entries are reused but keep their position so that the lookup of
+  // the addresses after them still works
+  memset(free_dep, 0, sizeof(*free_dep));
+  free_dep->addr = addr;
+  free_dep->scope = scope;
+
+  return free_dep;
+}
+
+// When the dependency table is full, the entries of the scope are emptied and
+// the task becomes a fence which depends on all the tasks they contained, and
+// which all further sibling tasks with dependencies depend on.
+// The entries keep their address so that the lookup of the entries of other
+// scopes after them still works, and they are reused as they are now stale.
+static void ompTaskSetFence(omp_task_dep_scope_t *scope, ompTask_t *task)
+{
+  for (int i=0; i<OMP_TASK_DEP_TABLE_SIZE; i++)
+  {
+    omp_task_dep_t *dep = &ompTaskDeps[i];
+
+    if (dep->addr && dep->scope == scope)
+    {
+      ompTaskAddPred(task, dep->out, dep->out_id);
+      dep->out = NULL;
+      for (int j=0; j<OMP_TASK_DEP_READERS; j++)
+      {
+        ompTaskAddPred(task, dep->in[j], dep->in_id[j]);
+        dep->in[j] = NULL;
+      }
+    }
+  }
+
+  scope->fence = task;
+  scope->fence_id = task->id;
+}
+
+// GCC gives first the out and inout addresses, then the in addresses. Newer
+// versions use a format starting with 0, where mutexinoutset addresses come
+// after the out ones and are handled the same way.
+static int ompTaskDepCount(void **depend, int *nb_out, void ***addrs)
+{
+  if ((uintptr_t)depend[0])
+  {
+    *nb_out = (uintptr_t)depend[1];
+    *addrs = &depend[2];
+    return (uintptr_t)depend[0];
+  }
+
+  *nb_out = (uintptr_t)depend[2] + (uintptr_t)depend[3];
+  *addrs = &depend[5];
+  return (uintptr_t)depend[1];
+}
+
+static void ompTaskAddDeps(omp_task_dep_scope_t *scope, ompTask_t *task, void **depend)
+{
+  int nb_out;
+  void **addrs;
+  int nb_deps = ompTaskDepCount(depend, &nb_out, &addrs);
+
+  ompTaskAddPred(task, scope->fence, scope->fence_id);
+
+  for (int i=0; i<nb_deps; i++)
+  {
+    omp_task_dep_t *dep = ompTaskDepLookup(scope, addrs[i], 1);
+    if (dep == NULL)
+    {
+      ompTaskSetFence(scope, task);
+      dep = ompTaskDepLookup(scope, addrs[i], 1);
+
+      // The table is full of entries of other scopes. The address is not
+      // tracked, the fence already orders the task with its siblings.
+      if (dep == NULL)
+        continue;
+    }
+
+    ompTaskAddPred(task, dep->out, dep->out_id);
+
+    if (i < nb_out)
+    {
+      for (int j=0; j<OMP_TASK_DEP_READERS; j++)
+      {
+        ompTaskAddPred(task, dep->in[j], dep->in_id[j]);
+        dep->in[j] = NULL;
+      }
+      dep->out = task;
+      dep->out_id = task->id;
+    }
+    else
+    {
+      // When all reader slots are used, the new reader waits for the one it
+      // replaces, so that the next writer still waits for both.
+      int slot = dep->next_in;
+      ompTaskAddPred(task, dep->in[slot], dep->in_id[slot]);
+      dep->in[slot] = task;
+      dep->in_id[slot] = task->id;
+      dep->next_in = slot + 1 == OMP_TASK_DEP_READERS ? 0 : slot + 1;
+    }
+  }
+}
+
+// Return one of the tasks that a task with the specified dependencies would
+// have to wait for, or NULL if there is none
+static ompTask_t *ompTaskFindPred(omp_task_dep_scope_t *scope, void **depend, unsigned int *id)
+{
+  int nb_out;
+  void **addrs;
+  int nb_deps = ompTaskDepCount(depend, &nb_out, &addrs);
+
+  if (ompTaskIsLive(scope->fence, scope->fence_id))
+  {
+    *id = scope->fence_id;
+    return scope->fence;
+  }
+
+  for (int i=0; i<nb_deps; i++)
+  {
+    omp_task_dep_t *dep = ompTaskDepLookup(scope, addrs[i], 0);
+    if (dep == NULL)
+      continue;
+
+    if (ompTaskIsLive(dep->out, dep->out_id))
+    {
+      *id = dep->out_id;
+      return dep->out;
+    }
+
+    if (i < nb_out)
+    {
+      for (int j=0; j<OMP_TASK_DEP_READERS; j++)
+      {
+        if (ompTaskIsLive(dep->in[j], dep->in_id[j]))
+        {
+          *id = dep->in_id[j];
+          return dep->in[j];
+        }
+      }
+    }
+  }
+
+  return NULL;
+}
+
+static void ompTaskWaitDeps(omp_team_t *team, void **depend)
+{
+  int core = pi_core_id();
+  omp_task_dep_scope_t *scope = ompTaskDepScope(ompCurrentTask[core], core);
+
+  while (1)
+  {
+    unsigned int id;
+
+    ompTaskLock(&team->task_lock);
+    ompTask_t *pred = ompTaskFindPred(scope, depend, &id);
+    ompTaskUnlock(&team->task_lock);
+
+    if (pred == NULL)
+      break;
+
+    while (ompTaskIsLive(pred, id))
+    {
+      if (!ompTaskSchedule(team))
+        ompTaskSleep();
+    }
+  }
+}
+
+
+
+static void ompTaskExecUndeferred(omp_team_t *team, void (*fn)(void *), void *data,
+  void (*cpyfn)(void *, void *), long arg_size, long arg_align, unsigned int flags,
+  void **depend)
+{
+  int core = pi_core_id();
+
+  if (depend)
+    ompTaskWaitDeps(team, depend);
+
+  if (flags & GOMP_TASK_FLAG_FINAL)
+    ompFinalDepth[core]++;
+
+  if (cpyfn)
+  {
+    char buffer[arg_size + arg_align - 1];
+    char *args = (char *)(((uintptr_t)buffer + arg_align - 1) & ~(arg_align - 1));
+    cpyfn(args, data);
+    fn(args);
+  }
+  else
+  {
+    fn(data);
+  }
+
+  if (flags & GOMP_TASK_FLAG_FINAL)
+    ompFinalDepth[core]--;
+}
+
+void ompTaskCreate(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *),
+  long arg_size, long arg_align, int if_clause, unsigned int flags, void **depend)
+{
+  omp_team_t *team = getCurrentTeam();
+  int core = pi_core_id();
+  ompTask_t *task = NULL;
+
+  if (!(flags & GOMP_TASK_FLAG_DEPEND))
+    depend = NULL;
+
+  if (arg_align == 0)
+    arg_align = 1;
+
+  // Included tasks, i.e. undeferred ones and the ones created inside a final
+  // task, are executed right now
+  if (if_clause && !(flags & GOMP_TASK_FLAG_FINAL) && ompFinalDepth[core] == 0 &&
+    arg_size + arg_align - 1 <= OMP_TASK_ARG_SIZE)
+  {
+    task = ompTaskAlloc();
+  }
+
+  if (task == NULL)
+  {
+    ompTaskExecUndeferred(team, fn, data, cpyfn, arg_size, arg_align, flags, depend);
+    return;
+  }
+
+  char *args = (char *)(((uintptr_t)task->args + arg_align - 1) & ~(arg_align - 1));
+  if (cpyfn)
+    cpyfn(args, data);
+  else
+    memcpy(args, data, arg_size);
+
+  task->func = fn;
+  task->data = args;
+  task->parent = ompCurrentTask[core];
+  task->parent_core = core;
+  task->nb_children = 0;
+  task->nb_pred = 0;
+  task->deps.fence = NULL;
+
+  ompTaskLock(&team->task_lock);
+
+  // The descriptor may be recycled while older references to it are still
+  // checked by other cores, which take the lock to add dependencies. The
+  // new id makes them stale before the done flag is cleared.
+  task->id = ++team->task_id;
+  hal_compiler_barrier();
+  task->nb_succ = 0;
+  task->done = 0;
+  team->nb_pending_tasks++;
+  if (task->parent)
+    task->parent->nb_children++;
+  else
+    ompImplicitChildren[core]++;
+
+  if (depend)
+    ompTaskAddDeps(ompTaskDepScope(task->parent, core), task, depend);
+
+  int is_ready = task->nb_pred == 0;
+
+  ompTaskUnlock(&team->task_lock);
+
+  if (is_ready)
+  {
+    if (ompTaskPush(core, task))
+      ompTaskRun(team, task);
+    else
+      ompTaskNotify();
+  }
+}
+
+
+
+static inline int ompTaskNbChildren(int core)
+{
+  ompTask_t *task = ompCurrentTask[core];
+  if (task)
+    return *(volatile short *)&task->nb_children;
+  else
+    return *(volatile int *)&ompImplicitChildren[core];
+}
+
+void ompTaskWait()
+{
+  omp_team_t *team = getCurrentTeam();
+  int core = pi_core_id();
+
+  while (ompTaskNbChildren(core))
+  {
+    if (!ompTaskSchedule(team))
+      ompTaskSleep();
+  }
+}
+
+int ompTaskYield()
+{
+  return ompTaskSchedule(getCurrentTeam());
+}
+
+void ompTaskDrain(omp_team_t *team)
+{
+  while (*(volatile int *)&team->nb_pending_tasks)
+  {
+    if (!ompTaskSchedule(team))
+      ompTaskSleep();
+  }
+}
+
+void ompTaskBarrier(omp_team_t *team)
+{
+  volatile omp_team_t *vteam = team;
+
+  ompTaskLock(&team->task_lock);
+  int gen = team->bar_gen;
+  int is_last = ++team->bar_count == team->nbThreads;
+  ompTaskUnlock(&team->task_lock);
+
+  if (is_last)
+    ompTaskNotify();
+
+  // Once all threads are in the barrier, only tasks can create tasks, so no
+  // more task can appear when none is pending
+  while (vteam->bar_gen == gen)
+  {
+    if (vteam->bar_count == vteam->nbThreads && vteam->nb_pending_tasks == 0)
+    {
+      ompTaskLock(&team->task_lock);
+      if (team->bar_gen == gen)
+      {
+        team->bar_count = 0;
+        team->bar_gen = gen + 1;
+      }
+      ompTaskUnlock(&team->task_lock);
+      ompTaskNotify();
+      break;
+    }
+
+    if (!ompTaskSchedule(team))
+      ompTaskSleep();
+  }
+}
+
+void ompTaskInit(omp_t *_this)
+{
+  omp_team_t *team = &_this->plainTeam;
+
+  pos_obj_pool_init(&ompTaskPool, ompTaskObjs, OMP_TASK_POOL_SIZE, sizeof(ompTask_t));
+
+  for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    ompTaskDeques[i].lock = 0;
+    ompTaskDeques[i].head = 0;
+    ompTaskDeques[i].tail = 0;
+    ompCurrentTask[i] = NULL;
+    ompImplicitChildren[i] = 0;
+    ompFinalDepth[i] = 0;
+    ompImplicitDeps[i].fence = NULL;
+  }
+
+  memset(ompTaskDeps, 0, sizeof(ompTaskDeps));
+
+  team->task_lock = 0;
+  team->nb_pending_tasks = 0;
+  team->task_id = 0;
+  team->bar_count = 0;
+  team->bar_gen = 0;
+}
+
+#else
+
+void ompTaskCreate(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *),
+  long arg_size, long arg_align, int if_clause, unsigned int flags, void **depend)
+{
+  // Without test-and-set locks, tasks are always executed immediately, which
+  // also satisfies all dependencies
+  if (arg_align == 0)
+    arg_align = 1;
+
+  if (cpyfn)
+  {
+    char buffer[arg_size + arg_align];
+    char *args = (char *)(((uintptr_t)buffer + arg_align - 1) & ~(arg_align - 1));
+    cpyfn(args, data);
+    fn(args);
+  }
+  else
+  {
+    fn(data);
+  }
+}
+
+void ompTaskWait()
+{
+}
+
+int ompTaskYield()
+{
+  return 0;
+}
+
+void ompTaskInit(omp_t *_this)
+{
+}
+
+#endif
@@ -103,13 +103,17 @@ void GOMP_loop_end()
 int GOMP_loop_guided_start(int start, int end, int incr, int chunk_size,
                         int *istart, int *iend)
 {
+#if EU_VERSION >= 3
+  return guidedLoopInit(getCurrentTeam(), start, end, incr, chunk_size, istart, iend);
+#else
   return GOMP_loop_dynamic_start(start, end, incr, chunk_size, istart, iend);
+#endif
 }
 
 int GOMP_loop_guided_next (int *istart, int *iend)
 {
-#if EU_VERSION == 3
-  return 0;
+#if EU_VERSION >= 3
+  return guidedLoopIter(getCurrentTeam(), istart, iend);
 #else
   return GOMP_loop_dynamic_next(istart, iend);
 #endif
@@ -118,58 +122,58 @@ int GOMP_loop_guided_next (int *istart, int *iend)
 int GOMP_loop_static_start(int start, int end, int incr, int chunk_size,
                         int *istart, int *iend)
 {
-  return GOMP_loop_dynamic_start(start, end, incr, chunk_size, istart, iend);
+  return staticLoopInitIter(getCurrentTeam(), start, end, incr, chunk_size, istart, iend);
 }
 
 int GOMP_loop_static_next (int *istart, int *iend)
 {
-#if EU_VERSION == 3
-  return 0;
-#else
-  omp_team_t *team = getCurrentTeam();
-  int isLast;
-  int ret = dynLoopIter(team, istart, iend, &isLast);
-  return ret;
-#endif
+  return staticLoopIter(&ompStaticLoops[pi_core_id()], istart, iend);
 }
 
-#if 0
-void GOMP_task(void (*func)(void *), void *data, void (*copy_func)(void *, void *),
-	       long arg_size, long arg_align, int if_cond, unsigned gomp_flags, void **depend) 
+int GOMP_loop_runtime_start(int start, int end, int incr, int *istart, int *iend)
 {
-  omp_team_t *team = getCurrentTeam();
   omp_t *_this = omp_getData();
-  criticalStart(team);
-  ompTask_t *task = allocTask(rtCc, _this, arg_size);
-  if (task == NULL) {
-    criticalEnd(team);
-    //printf("Direct exec\n");
-    func(data);
-  } else {
-    //printf("Enqueue %x %x %x %x %x\n", (int)func, (int)data, (int)copy_func, (int)arg_size, (int)arg_align);
-    task->func = func;
-    void *args = (void *)((unsigned int)task + sizeof(ompTask_t));
-    rt_memcpy(args, data, arg_size);
-    task->data = args;
-    team->hasTasks = 1;
-    if (team->firstReadyTask == NULL) team->firstReadyTask = task;
-    else team->lastReadyTask->next = task;
-    team->lastReadyTask = task;
-    task->next = NULL;
-    criticalEnd(team);
+  int chunk_size = _this->runChunk;
+
+  switch (_this->runSched)
+  {
+    case omp_sched_dynamic:
+      return GOMP_loop_dynamic_start(start, end, incr, chunk_size > 0 ? chunk_size : 1, istart, iend);
+    case omp_sched_guided:
+      return GOMP_loop_guided_start(start, end, incr, chunk_size, istart, iend);
+    default:
+      return GOMP_loop_static_start(start, end, incr, chunk_size, istart, iend);
+  }
+}
+
+int GOMP_loop_runtime_next(int *istart, int *iend)
+{
+  switch (omp_getData()->runSched)
+  {
+    case omp_sched_dynamic:
+      return GOMP_loop_dynamic_next(istart, iend);
+    case omp_sched_guided:
+      return GOMP_loop_guided_next(istart, iend);
+    default:
+      return GOMP_loop_static_next(istart, iend);
   }
+}
 
+void GOMP_task(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *),
+  long arg_size, long arg_align, int if_clause, unsigned flags, void **depend, int priority)
+{
+  ompTaskCreate(fn, data, cpyfn, arg_size, arg_align, if_clause, flags, depend);
+}
 
-#if 0
-  int nbdepend = (uintptr_t) depend[0];
-  int i;
-  printf("%x %x %x %x %x %x %x %d\n", (int)func, (int)data, (int)copy_func, (int)arg_size, (int)arg_align, (int)if_cond, (int)gomp_flags, nbdepend);
-  for (i = 0; i < nbdepend; i++)
-    printf("%x\n", (int)depend[i+2]);
-  func(data);
-#endif
+void GOMP_taskwait(void)
+{
+  ompTaskWait();
+}
+
+void GOMP_taskyield(void)
+{
+  ompTaskYield();
 }
-  #endif
 
 int GOMP_single_start(void)
 { 
@@ -204,6 +208,65 @@ GOMP_parallel_loop_dynamic (void (*fn) (void *), void *data,
   parallelRegion(data, fn, num_threads);
 }
 
+static inline int parallelLoopNbThreads(omp_team_t *team, unsigned num_threads)
+{
+  return num_threads == 0 || num_threads > team->nbThreads ? team->nbThreads : num_threads;
+}
+
+void
+GOMP_parallel_loop_static (void (*fn) (void *), void *data,
+                           unsigned num_threads, long start, long end,
+                           long incr, long chunk_size, unsigned flags)
+{
+  omp_team_t *team = getCurrentTeam();
+  int nb_threads = parallelLoopNbThreads(team, num_threads);
+
+  // The threads directly call GOMP_loop_static_next, so their iterations
+  // are computed before they are started
+  for (int i=0; i<nb_threads; i++)
+  {
+    staticLoopInit(&ompStaticLoops[i], i, nb_threads, start, end, incr, chunk_size);
+  }
+  parallelRegion(data, fn, num_threads);
+}
+
+void
+GOMP_parallel_loop_guided (void (*fn) (void *), void *data,
+                           unsigned num_threads, long start, long end,
+                           long incr, long chunk_size, unsigned flags)
+{
+  omp_team_t *team = getCurrentTeam();
+
+#if EU_VERSION >= 3
+  guidedLoopInitSingle(team, start, end, incr, chunk_size);
+#else
+  dynLoopInitSingle(team, start, end, incr, chunk_size, num_threads);
+#endif
+  parallelRegion(data, fn, num_threads);
+}
+
+void
+GOMP_parallel_loop_runtime (void (*fn) (void *), void *data,
+                            unsigned num_threads, long start, long end,
+                            long incr, unsigned flags)
+{
+  omp_t *_this = omp_getData();
+  int chunk_size = _this->runChunk;
+
+  switch (_this->runSched)
+  {
+    case omp_sched_dynamic:
+      GOMP_parallel_loop_dynamic(fn, data, num_threads, start, end, incr, chunk_size > 0 ? chunk_size : 1, flags);
+      break;
+    case omp_sched_guided:
+      GOMP_parallel_loop_guided(fn, data, num_threads, start, end, incr, chunk_size, flags);
+      break;
+    default:
+      GOMP_parallel_loop_static(fn, data, num_threads, start, end, incr, chunk_size, flags);
+      break;
+  }
+}
+
 void GOMP_loop_end_nowait()
 {
 }
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#include "pmsis.h"
+
+/*
+ * Tile pipeline
+ *
+ * Processes a sequence of tiles which are loaded to L1, computed and stored
+ * back, with each L1 buffer replicated once per stage so that the loads of
+ * the next tiles and the stores of the previous ones overlap with the
+ * computation of the current one. With N stages, the loads are started N-1
+ * tiles in advance and up to N-1 stores can be in flight.
+ *
+ * The load and store callbacks push their transfers with the cluster DMA
+ * commands API using the given commands, and return how many of them they
+ * used, which the pipeline waits for before using the buffer. The compute
+ * callback is called by the cluster master and can fork on the team.
+ */
+
+#define PI_CL_PIPELINE_MAX_STAGES 4
+#define PI_CL_PIPELINE_MAX_CMDS   4
+
+typedef int (*pi_cl_pipeline_dma_t)(void *arg, int tile, void *buffer, pi_cl_dma_cmd_t *cmds);
+
+typedef struct pi_cl_pipeline_conf_s
+{
+    int nb_tiles;
+    // Number of buffers for each of the input and output, 2 for double
+    // buffering
+    int nb_stages;
+    // Size of one input and one output buffer, the input or output is
+    // disabled with size 0
+    int in_size;
+    int out_size;
+    pi_cl_pipeline_dma_t load;
+    void (*compute)(void *arg, int tile, void *in, void *out);
+    pi_cl_pipeline_dma_t store;
+    void *arg;
+    // Measure the cycles of each step with the cluster timer, which must
+    // have been started with pi_perf_start
+    int stats;
+} pi_cl_pipeline_conf_t;
+
+typedef struct pi_cl_pipeline_stats_s
+{
+    uint32_t total_cycles;
+    uint32_t compute_cycles;
+    // Cycles where the computation was waiting for a load to finish or for
+    // an output buffer to be stored
+    uint32_t load_stall_cycles;
+    uint32_t store_stall_cycles;
+} pi_cl_pipeline_stats_t;
+
+typedef struct pi_cl_pipeline_stage_s
+{
+    void *in;
+    void *out;
+    pi_cl_dma_cmd_t load_cmds[PI_CL_PIPELINE_MAX_CMDS];
+    pi_cl_dma_cmd_t store_cmds[PI_CL_PIPELINE_MAX_CMDS];
+    int8_t nb_load_cmds;
+    int8_t nb_store_cmds;
+} pi_cl_pipeline_stage_t;
+
+typedef struct pi_cl_pipeline_s
+{
+    pi_cl_pipeline_conf_t conf;
+    struct pi_device *device;
+    void *buffers;
+    pi_cl_pipeline_stage_t stages[PI_CL_PIPELINE_MAX_STAGES];
+    pi_cl_pipeline_stats_t stats;
+} pi_cl_pipeline_t;
+
+void pi_cl_pipeline_conf_init(pi_cl_pipeline_conf_t *conf);
+
+// Allocate the stage buffers in the L1 of the cluster, returns -1 if there
+// is not enough memory
+int pi_cl_pipeline_open(pi_cl_pipeline_t *pipe, struct pi_device *device, pi_cl_pipeline_conf_t *conf);
+
+void pi_cl_pipeline_close(pi_cl_pipeline_t *pipe);
+
+// Process all the tiles, from the cluster master
+void pi_cl_pipeline_run(pi_cl_pipeline_t *pipe);
+
+void pi_cl_pipeline_get_stats(pi_cl_pipeline_t *pipe, pi_cl_pipeline_stats_t *stats);
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pmsis.h"
+#include "pipeline.h"
+
+
+void pi_cl_pipeline_conf_init(pi_cl_pipeline_conf_t *conf)
+{
+    conf->nb_tiles = 0;
+    conf->nb_stages = 2;
+    conf->in_size = 0;
+    conf->out_size = 0;
+    conf->load = NULL;
+    conf->compute = NULL;
+    conf->store = NULL;
+    conf->arg = NULL;
+    conf->stats = 0;
+}
+
+
+int pi_cl_pipeline_open(pi_cl_pipeline_t *pipe, struct pi_device *device, pi_cl_pipeline_conf_t *conf)
+{
+    int nb_stages = conf->nb_stages;
+
+    if (nb_stages < 1 || nb_stages > PI_CL_PIPELINE_MAX_STAGES)
+        return -1;
+
+    int in_size = (conf->in_size + 3) & ~3;
+    int out_size = (conf->out_size + 3) & ~3;
+    int size = (in_size + out_size) * nb_stages;
+
+    pipe->conf = *conf;
+    pipe->device = device;
+    pipe->buffers = NULL;
+
+    if (size)
+    {
+        pipe->buffers = pi_cl_l1_malloc(device, size);
+        if (pipe->buffers == NULL)
+            return -1;
+    }
+
+    char *buffer = (char *)pipe->buffers;
+    for (int i=0; i<nb_stages; i++)
+    {
+        pi_cl_pipeline_stage_t *stage = &pipe->stages[i];
+
+        stage->in = in_size ? buffer : NULL;
+        buffer += in_size;
+        stage->out = out_size ? buffer : NULL;
+        buffer += out_size;
+    }
+
+    return 0;
+}
+
+
+void pi_cl_pipeline_close(pi_cl_pipeline_t *pipe)
+{
+    pi_cl_pipeline_conf_t *conf = &pipe->conf;
+    int size = (((conf->in_size + 3) & ~3) + ((conf->out_size + 3) & ~3)) * conf->nb_stages;
+
+    if (pipe->buffers)
+        pi_cl_l1_free(pipe->device, pipe->buffers, size);
+}
+
+
+static inline uint32_t pos_pipeline_time(pi_cl_pipeline_t *pipe)
+{
+    return pipe->conf.stats ? pi_perf_cl_read(PI_PERF_CYCLES) : 0;
+}
+
+
+static void pos_pipeline_load(pi_cl_pipeline_t *pipe, int tile)
+{
+    pi_cl_pipeline_stage_t *stage = &pipe->stages[tile % pipe->conf.nb_stages];
+
+    stage->nb_load_cmds = 0;
+    if (pipe->conf.load && stage->in)
+        stage->nb_load_cmds = pipe->conf.load(pipe->conf.arg, tile, stage->in, stage->load_cmds);
+}
+
+
+static void pos_pipeline_wait(pi_cl_dma_cmd_t *cmds, int8_t *nb_cmds)
+{
+    for (int i=0; i<*nb_cmds; i++)
+    {
+        pi_cl_dma_cmd_wait(&cmds[i]);
+    }
+    *nb_cmds = 0;
+}
+
+
+void pi_cl_pipeline_run(pi_cl_pipeline_t *pipe)
+{
+    pi_cl_pipeline_conf_t *conf = &pipe->conf;
+    pi_cl_pipeline_stats_t *stats = &pipe->stats;
+    int nb_tiles = conf->nb_tiles;
+    int nb_stages = conf->nb_stages;
+    int nb_prefetch = nb_stages > 1 ? nb_stages - 1 : 1;
+
+    stats->compute_cycles = 0;
+    stats->load_stall_cycles = 0;
+    stats->store_stall_cycles = 0;
+
+    uint32_t start = pos_pipeline_time(pipe);
+
+    for (int i=0; i<nb_stages; i++)
+    {
+        pipe->stages[i].nb_load_cmds = 0;
+        pipe->stages[i].nb_store_cmds = 0;
+    }
+
+    // Prologue, the first tiles are loaded to fill the pipeline
+    for (int tile=0; tile<nb_prefetch && tile<nb_tiles; tile++)
+    {
+        pos_pipeline_load(pipe, tile);
+    }
+
+    for (int tile=0; tile<nb_tiles; tile++)
+    {
+        pi_cl_pipeline_stage_t *stage = &pipe->stages[tile % nb_stages];
+        uint32_t time = pos_pipeline_time(pipe);
+
+        pos_pipeline_wait(stage->load_cmds, &stage->nb_load_cmds);
+
+        // The input buffer of the next tile to be loaded is the one of the
+        // previous tile, whose computation is over
+        if (nb_stages > 1 && tile + nb_prefetch < nb_tiles)
+            pos_pipeline_load(pipe, tile + nb_prefetch);
+
+        uint32_t loaded = pos_pipeline_time(pipe);
+        stats->load_stall_cycles += loaded - time;
+
+        // The output buffer can still be stored for the tile nb_stages before
+        pos_pipeline_wait(stage->store_cmds, &stage->nb_store_cmds);
+
+        uint32_t stored = pos_pipeline_time(pipe);
+        stats->store_stall_cycles += stored - loaded;
+
+        conf->compute(conf->arg, tile, stage->in, stage->out);
+
+        stats->compute_cycles += pos_pipeline_time(pipe) - stored;
+
+        if (conf->store && stage->out)
+            stage->nb_store_cmds = conf->store(conf->arg, tile, stage->out, stage->store_cmds);
+
+        // With a single stage, nothing can be loaded during the computation
+        if (nb_stages == 1 && tile + 1 < nb_tiles)
+        {
+            pos_pipeline_wait(stage->store_cmds, &stage->nb_store_cmds);
+            pos_pipeline_load(pipe, tile + 1);
+        }
+    }
+
+    // Epilogue, wait for the last stores
+    for (int i=0; i<nb_stages; i++)
+    {
+        pi_cl_pipeline_stage_t *stage = &pipe->stages[i];
+        pos_pipeline_wait(stage->store_cmds, &stage->nb_store_cmds);
+    }
+
+    stats->total_cycles = pos_pipeline_time(pipe) - start;
+}
+
+
+void pi_cl_pipeline_get_stats(pi_cl_pipeline_t *pipe, pi_cl_pipeline_stats_t *stats)
+{
+    *stats = pipe->stats;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "pmsis.h"
+
+/*
+ * Profiling regions
+ *
+ * A region is a piece of code surrounded by pi_cl_profile_begin and
+ * pi_cl_profile_end, which can be executed by any number of cluster cores.
+ * Each core collects its own counters and the region keeps, for each core
+ * and each event, the minimum, average and maximum over the runs.
+ *
+ * The cycles are always collected, with the cluster timer. The other
+ * events are counted by the core counters. When there are more events
+ * than counters, they are split into groups of PI_CL_PROFILE_NB_COUNTERS
+ * events, and each run of the region collects the next group, so the region
+ * must be run at least once per group, after the warmup runs, to get all of
+ * them.
+ *
+ * Regions are declared with PI_CL_PROFILE_REGION, in L2 so that they can be
+ * dumped from the FC once the cluster is closed.
+ */
+
+// Number of events which the core counters can count at the same time
+#ifdef POS_CONFIG_PROFILE_NB_COUNTERS
+#define PI_CL_PROFILE_NB_COUNTERS POS_CONFIG_PROFILE_NB_COUNTERS
+#else
+#define PI_CL_PROFILE_NB_COUNTERS 1
+#endif
+
+typedef struct pi_cl_profile_stat_s
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} pi_cl_profile_stat_t;
+
+typedef struct pi_cl_profile_region_s
+{
+    const char *name;
+    // Mask of PI_PERF_* events, always including PI_PERF_CYCLES
+    uint32_t events;
+    // Number of runs of each core which are not accounted, to warm up
+    // the caches
+    uint32_t nb_warmup;
+    // One entry per core and per event, in the order of the event bits
+    pi_cl_profile_stat_t *stats;
+    uint32_t runs[ARCHI_CLUSTER_NB_PE];
+    uint32_t run_events[ARCHI_CLUSTER_NB_PE];
+    uint32_t start[ARCHI_CLUSTER_NB_PE];
+} pi_cl_profile_region_t;
+
+#define PI_CL_PROFILE_EVENTS(events) ((events) | (1 << PI_PERF_CYCLES))
+
+// Declare the region var, with its statistics
+#define PI_CL_PROFILE_REGION(var, region_name, region_events, warmup)                               \
+    static PI_L2 pi_cl_profile_stat_t var##_stats[ARCHI_CLUSTER_NB_PE *                             \
+        __builtin_popcount(PI_CL_PROFILE_EVENTS(region_events))];                                  \
+    static PI_L2 pi_cl_profile_region_t var = {                                                     \
+        .name = region_name,                                                                        \
+        .events = PI_CL_PROFILE_EVENTS(region_events),                                              \
+        .nb_warmup = warmup,                                                                        \
+        .stats = var##_stats                                                                        \
+    }
+
+// Start collecting the counters of the calling core
+void pi_cl_profile_begin(pi_cl_profile_region_t *region);
+
+// Stop collecting the counters of the calling core and account them
+void pi_cl_profile_end(pi_cl_profile_region_t *region);
+
+// Forget all the runs, from the FC or from the cluster when no core is in
+// the region
+void pi_cl_profile_reset(pi_cl_profile_region_t *region);
+
+// Print the statistics, one line per core and event:
+//   PROFILE;<region>;<core>;<event>;<count>;<min>;<avg>;<max>
+void pi_cl_profile_dump(pi_cl_profile_region_t *region);
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pmsis.h"
+#include "profile.h"
+#include <stdio.h>
+
+
+// Keyed by event as the numbering of the events depends on the chip
+static const char *pos_profile_event_names[PI_PERF_CYCLES + 1] = {
+    [PI_PERF_ACTIVE_CYCLES] = "active_cycles",
+    [PI_PERF_INSTR]         = "instr",
+    [PI_PERF_LD_STALL]      = "ld_stall",
+    [PI_PERF_JR_STALL]      = "jr_stall",
+    [PI_PERF_IMISS]         = "imiss",
+    [PI_PERF_LD]            = "ld",
+    [PI_PERF_ST]            = "st",
+    [PI_PERF_JUMP]          = "jump",
+    [PI_PERF_BRANCH]        = "branch",
+    [PI_PERF_BTAKEN]        = "btaken",
+    [PI_PERF_RVC]           = "rvc",
+    [PI_PERF_LD_EXT]        = "ld_ext",
+    [PI_PERF_ST_EXT]        = "st_ext",
+    [PI_PERF_LD_EXT_CYC]    = "ld_ext_cyc",
+    [PI_PERF_ST_EXT_CYC]    = "st_ext_cyc",
+    [PI_PERF_TCDM_CONT]     = "tcdm_cont",
+    [PI_PERF_CYCLES]        = "cycles",
+};
+
+
+static inline int pos_profile_nb_events(pi_cl_profile_region_t *region)
+{
+    return __builtin_popcount(region->events);
+}
+
+
+static inline pi_cl_profile_stat_t *pos_profile_stat(pi_cl_profile_region_t *region, int core, int event)
+{
+    int index = __builtin_popcount(region->events & ((1 << event) - 1));
+    return &region->stats[core*pos_profile_nb_events(region) + index];
+}
+
+
+// Events collected by the specified run, apart from the cycles
+static uint32_t pos_profile_run_events(pi_cl_profile_region_t *region, uint32_t run)
+{
+    uint32_t events = region->events & ~(1 << PI_PERF_CYCLES);
+    int nb_events = __builtin_popcount(events);
+
+    if (nb_events <= PI_CL_PROFILE_NB_COUNTERS)
+        return events;
+
+    int nb_groups = (nb_events + PI_CL_PROFILE_NB_COUNTERS - 1) / PI_CL_PROFILE_NB_COUNTERS;
+    int first = (run % nb_groups) * PI_CL_PROFILE_NB_COUNTERS;
+    uint32_t result = 0;
+    int index = 0;
+
+    for (int i=0; i<PI_PERF_CYCLES; i++)
+    {
+        if ((events >> i) & 1)
+        {
+            if (index >= first && index < first + PI_CL_PROFILE_NB_COUNTERS)
+                result |= 1 << i;
+            index++;
+        }
+    }
+
+    return result;
+}
+
+
+static void pos_profile_account(pi_cl_profile_stat_t *stat, uint32_t value)
+{
+    if (stat->count == 0 || value < stat->min)
+        stat->min = value;
+    if (value > stat->max)
+        stat->max = value;
+    stat->total += value;
+    stat->count++;
+}
+
+
+void pi_cl_profile_begin(pi_cl_profile_region_t *region)
+{
+    int core = pi_core_id();
+    uint32_t run = region->runs[core];
+
+    // Warmup runs collect the first group, so that the measured runs still
+    // start from the first group and go through all of them evenly
+    run = run < region->nb_warmup ? 0 : run - region->nb_warmup;
+
+    uint32_t events = pos_profile_run_events(region, run);
+
+    region->run_events[core] = events;
+
+    // The cluster timer is shared by all the cores, so it is never reset
+    // and each core only takes its value at the beginning
+    timer_start(timer_base_cl(0, 0, 0));
+
+    cpu_perf_conf_events(events);
+    cpu_perf_setall(0);
+
+    region->start[core] = pi_perf_cl_read(PI_PERF_CYCLES);
+    cpu_perf_conf(PCMR_ACTIVE | PCMR_SATURATE);
+}
+
+
+void pi_cl_profile_end(pi_cl_profile_region_t *region)
+{
+    cpu_perf_conf(0);
+    uint32_t cycles = pi_perf_cl_read(PI_PERF_CYCLES);
+
+    int core = pi_core_id();
+    uint32_t run = region->runs[core]++;
+
+    if (run < region->nb_warmup)
+        return;
+
+    pos_profile_account(pos_profile_stat(region, core, PI_PERF_CYCLES), cycles - region->start[core]);
+
+    uint32_t events = region->run_events[core];
+    for (int i=0; i<PI_PERF_CYCLES; i++)
+    {
+        if ((events >> i) & 1)
+            pos_profile_account(pos_profile_stat(region, core, i), cpu_perf_get(i));
+    }
+}
+
+
+void pi_cl_profile_reset(pi_cl_profile_region_t *region)
+{
+    int nb_events = pos_profile_nb_events(region);
+
+    for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+    {
+        region->runs[i] = 0;
+    }
+
+    for (int i=0; i<ARCHI_CLUSTER_NB_PE*nb_events; i++)
+    {
+        region->stats[i].count = 0;
+        region->stats[i].min = 0;
+        region->stats[i].max = 0;
+        region->stats[i].total = 0;
+    }
+}
+
+
+void pi_cl_profile_dump(pi_cl_profile_region_t *region)
+{
+    for (int core=0; core<ARCHI_CLUSTER_NB_PE; core++)
+    {
+        for (int i=0; i<=PI_PERF_CYCLES; i++)
+        {
+            if (((region->events >> i) & 1) == 0)
+                continue;
+
+            pi_cl_profile_stat_t *stat = pos_profile_stat(region, core, i);
+            if (stat->count == 0)
+                continue;
+
+            const char *name = pos_profile_event_names[i] ? pos_profile_event_names[i] : "unknown";
+
+            printf("PROFILE;%s;%d;%s;%d;%d;%d;%d\n", region->name, core, name,
+                stat->count, stat->min, (uint32_t)(stat->total / stat->count), stat->max);
+        }
+    }
+}
@@ -108,6 +108,38 @@ ifdef CONFIG_IO_UART_ITF
 PULP_CFLAGS += -DPOS_CONFIG_IO_UART_ITF=$(CONFIG_IO_UART_ITF)
 endif
 
+ifdef CONFIG_IO_RING
+PULP_CFLAGS += -DPOS_CONFIG_IO_RING=$(CONFIG_IO_RING)
+endif
+
+ifdef CONFIG_IO_RING_SIZE
+PULP_CFLAGS += -DPOS_CONFIG_IO_RING_SIZE=$(CONFIG_IO_RING_SIZE)
+endif
+
+ifdef CONFIG_IO_RING_DROP
+PULP_CFLAGS += -DPOS_CONFIG_IO_RING_DROP=$(CONFIG_IO_RING_DROP)
+endif
+
+ifdef CONFIG_ALLOC_TLSF
+PULP_CFLAGS += -DPOS_CONFIG_ALLOC_TLSF=$(CONFIG_ALLOC_TLSF)
+endif
+
+ifdef CONFIG_ALLOC_STATS
+PULP_CFLAGS += -DPOS_CONFIG_ALLOC_STATS=$(CONFIG_ALLOC_STATS)
+endif
+
+ifdef CONFIG_SCHED_STATS
+PULP_CFLAGS += -DPOS_CONFIG_SCHED_STATS=$(CONFIG_SCHED_STATS)
+endif
+
+ifdef CONFIG_MEMCPY_DMA_THRESHOLD
+PULP_CFLAGS += -DPOS_CONFIG_MEMCPY_DMA_THRESHOLD=$(CONFIG_MEMCPY_DMA_THRESHOLD)
+endif
+
+ifdef CONFIG_PROFILE_NB_COUNTERS
+PULP_CFLAGS += -DPOS_CONFIG_PROFILE_NB_COUNTERS=$(CONFIG_PROFILE_NB_COUNTERS)
+endif
+
 ifdef CONFIG_RISCV_GENERIC
 PULP_CFLAGS += -D__RISCV_GENERIC__=1
 endif
@@ -144,6 +176,14 @@ endif
 PULP_CFLAGS += -D__TRACE_LEVEL__=$(CONFIG_TRACE_LEVEL_INT) -DPI_LOG_LOCAL_LEVEL=$(PI_LOG_LOCAL_LEVEL)
 endif
 
+ifdef CONFIG_TRACE_BINARY
+PULP_CFLAGS += -DPOS_CONFIG_TRACE_BINARY=$(CONFIG_TRACE_BINARY)
+endif
+
+ifdef CONFIG_TRACE_RING_SIZE
+PULP_CFLAGS += -DPOS_CONFIG_TRACE_RING_SIZE=$(CONFIG_TRACE_RING_SIZE)
+endif
+
 ifdef CONFIG_TRACE_ALL
 PULP_CFLAGS += -D__TRACE_ALL__=1
 endif
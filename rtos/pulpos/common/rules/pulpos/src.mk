@@ -19,11 +19,23 @@ PULP_SRCS += lib/libc/minimal/io.c lib/libc/minimal/fprintf.c lib/libc/minimal/p
 endif
 
 ifdef CONFIG_KERNEL
-PULP_SRCS += kernel/init.c kernel/kernel.c kernel/device.c kernel/task.c kernel/alloc.c \
+PULP_SRCS += kernel/init.c kernel/kernel.c kernel/device.c kernel/task.c \
 	kernel/alloc_pool.c kernel/irq.c kernel/soc_event.c kernel/log.c kernel/time.c
 
+# First-fit is the default allocator, TLSF is opt-in for applications which
+# need a bounded allocation latency with many free blocks
+ifeq '$(CONFIG_ALLOC_TLSF)' '1'
+PULP_SRCS += kernel/alloc_tlsf.c
+else
+PULP_SRCS += kernel/alloc.c
+endif
+
 PULP_ASM_SRCS += kernel/irq_asm.S kernel/task_asm.S kernel/time_asm.S
 
+ifeq '$(CONFIG_TRACE_BINARY)' '1'
+PULP_SRCS += kernel/trace.c
+endif
+
 endif
 
 # SOC EVENT
@@ -47,6 +59,22 @@ PULP_CFLAGS += -I$(PULPOS_OPENMP_DIR)/include
 endif
 
 
+# TILE PIPELINE
+
+ifeq '$(CONFIG_PIPELINE)' '1'
+PULP_SRCS += lib/pipeline/pipeline.c
+PULP_CFLAGS += -I$(PULPOS_HOME)/lib/pipeline/include
+endif
+
+
+# PROFILING REGIONS
+
+ifeq '$(CONFIG_PROFILE)' '1'
+PULP_SRCS += lib/profile/profile.c
+PULP_CFLAGS += -I$(PULPOS_HOME)/lib/profile/include
+endif
+
+
 # HYPER
 
 ifeq '$(CONFIG_HYPER)' '1'
@@ -134,7 +162,7 @@ endif
 # Cluster
 ifeq '$(CONFIG_CLUSTER)' '1'
 ifneq '$(cluster/version)' ''
-PULP_SRCS += drivers/cluster/cluster.c
+PULP_SRCS += drivers/cluster/cluster.c drivers/cluster/dma.c
 PULP_ASM_SRCS += drivers/cluster/pe-eu-v$(event_unit/version).S
 ifneq '$(event_unit/version)' '3'
 PULP_ASM_SRCS += drivers/cluster/pe-eu-v$(event_unit/version)_task.S
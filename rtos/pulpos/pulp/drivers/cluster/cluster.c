@@ -42,6 +42,7 @@ PI_CL_L1 uint32_t pos_cluster_fc_task_lock;
 
 
 void pos_master_task_with_stack(void *arg);
+void pos_cl_dma_handler_asm();
 
 
 void pi_cluster_conf_init(struct pi_cluster_conf *conf)
@@ -85,6 +86,10 @@ static int pos_cluster_init()
   
   pos_irq_mask_set(1<<POS_EVENT_FC_ENQUEUE);
 
+  // The cluster cores share the FC vector table, and the master enables the
+  // DMA interrupt when it boots
+  pos_irq_set_handler(ARCHI_CL_EVT_DMA1, pos_cl_dma_handler_asm);
+
   return 0;
 }
 
@@ -355,6 +360,194 @@ void pos_cluster_push_fc_event(pi_task_t *event)
 }
 
 
+void pos_cl_subteam_entry(pi_cl_subteam_t *team)
+{
+    team->entry(team->arg);
+
+    pi_cl_subteam_barrier(team);
+
+    if (pi_core_id() == team->leader)
+    {
+        team->done = 1;
+        hal_compiler_barrier();
+        eu_evt_trig(eu_evt_trig_addr(POS_EVENT_CLUSTER_CALL_EVT), 0);
+    }
+}
+
+
+static void pos_cluster_queue_loop(void *arg)
+{
+    pi_cluster_queue_t *queue = (pi_cluster_queue_t *)arg;
+    pos_cluster_queue_shared_t *shared = queue->shared;
+    uint32_t mask = queue->nb_entries - 1;
+    uint32_t tail = shared->tail;
+
+    while(1)
+    {
+        // The FC triggers the event after each push, so it cannot be missed
+        // between the check and the wait
+        while (*(volatile uint32_t *)&shared->head == tail)
+        {
+            eu_evt_maskWaitAndClr(1<<POS_EVENT_CLUSTER_CALL_EVT);
+        }
+
+        hal_compiler_barrier();
+
+        struct pi_cluster_task *task = shared->ring[tail & mask];
+
+        // A NULL task is pushed when the queue is closed
+        if (task == NULL)
+            break;
+
+        task->entry(task->arg);
+
+        tail++;
+        hal_compiler_barrier();
+        *(volatile uint32_t *)&shared->tail = tail;
+        hal_compiler_barrier();
+
+        // Only notify the FC if it is not already going to handle the
+        // completions, it will then see this one as it clears the flag
+        // before reading the tail.
+        if (*(volatile uint32_t *)&shared->notif_pending == 0)
+        {
+            shared->notif_pending = 1;
+            pos_cluster_push_fc_event(&queue->notif_task);
+        }
+    }
+
+    // The resident task completion is notified by the caller
+}
+
+
+// Also called outside of the notification, so it must not touch the
+// notification flag, the notification task may still be queued
+static void pos_cluster_queue_handle_completions(pi_cluster_queue_t *queue)
+{
+    pos_cluster_queue_shared_t *shared = queue->shared;
+    uint32_t tail = *(volatile uint32_t *)&shared->tail;
+    uint32_t mask = queue->nb_entries - 1;
+
+    // The ring entries are not reused by the FC before their completion is
+    // handled, so that they still point to the completed tasks.
+    while (queue->completed != tail)
+    {
+        pi_task_t *done = shared->ring[queue->completed & mask]->completion_callback;
+        queue->completed++;
+        if (done)
+            pi_task_push(done);
+    }
+}
+
+
+static void pos_cluster_queue_notif(void *arg)
+{
+    pi_cluster_queue_t *queue = (pi_cluster_queue_t *)arg;
+
+    // Only cleared here, once the notification task is not queued anymore,
+    // so that the cluster never pushes it twice
+    *(volatile uint32_t *)&queue->shared->notif_pending = 0;
+    hal_compiler_barrier();
+
+    pos_cluster_queue_handle_completions(queue);
+}
+
+
+int pi_cluster_queue_open(struct pi_device *device, pi_cluster_queue_t *queue, struct pi_cluster_task *resident, int nb_entries)
+{
+    // The ring indexes are masked, so that they can freely wrap
+    if (nb_entries & (nb_entries - 1))
+        return -1;
+
+    int size = sizeof(pos_cluster_queue_shared_t) + nb_entries * sizeof(struct pi_cluster_task *);
+    pos_cluster_queue_shared_t *shared = pi_cl_l1_malloc(device, size);
+    if (shared == NULL)
+        return -1;
+
+    shared->head = 0;
+    shared->tail = 0;
+    shared->notif_pending = 0;
+
+    queue->shared = shared;
+    queue->device = device;
+    queue->resident = resident;
+    queue->nb_entries = nb_entries;
+    queue->head = 0;
+    queue->completed = 0;
+
+    pi_task_callback(&queue->notif_task, pos_cluster_queue_notif, queue);
+    pi_task_priority(&queue->notif_task, PI_TASK_PRIO_HIGH);
+    pi_task_block(&queue->end_task);
+
+    resident->entry = pos_cluster_queue_loop;
+    resident->arg = queue;
+
+    if (pi_cluster_send_task_to_cl_async(device, resident, &queue->end_task))
+    {
+        pi_cl_l1_free(device, shared, size);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int pos_cluster_queue_push(pi_cluster_queue_t *queue, struct pi_cluster_task *task)
+{
+    pos_cluster_queue_shared_t *shared = queue->shared;
+    pos_cluster_t *data = (pos_cluster_t *)queue->device->data;
+    uint32_t head = queue->head;
+
+    if (head - queue->completed == queue->nb_entries)
+    {
+        // The completion notification may not have been handled yet
+        pos_cluster_queue_handle_completions(queue);
+        if (head - queue->completed == queue->nb_entries)
+            return -1;
+    }
+
+    shared->ring[head & (queue->nb_entries - 1)] = task;
+    hal_compiler_barrier();
+    *(volatile uint32_t *)&shared->head = head + 1;
+    queue->head = head + 1;
+    hal_compiler_barrier();
+
+    pos_cluster_notif_req_done(data->cid);
+
+    return 0;
+}
+
+
+int pi_cluster_queue_push(pi_cluster_queue_t *queue, struct pi_cluster_task *task, pi_task_t *done)
+{
+    task->completion_callback = done;
+    return pos_cluster_queue_push(queue, task);
+}
+
+
+void pi_cluster_queue_close(pi_cluster_queue_t *queue)
+{
+    while (pos_cluster_queue_push(queue, NULL))
+    {
+        pi_yield();
+    }
+
+    pi_task_wait_on(&queue->end_task);
+
+    // The last notification may still be queued, and must be executed before
+    // the shared part is freed as it accesses it
+    while (*(volatile uint32_t *)&queue->shared->notif_pending)
+    {
+        pi_yield();
+    }
+
+    pos_cluster_queue_handle_completions(queue);
+
+    int size = sizeof(pos_cluster_queue_shared_t) + queue->nb_entries * sizeof(struct pi_cluster_task *);
+    pi_cl_l1_free(queue->device, queue->shared, size);
+}
+
+
 extern void pos_cluster_task_slave_set_stack();
 
 
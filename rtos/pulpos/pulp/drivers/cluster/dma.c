@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pmsis.h"
+
+
+// Biggest size of one command. This is the half of what the command length
+// field can encode so that big transfers are split in aligned chunks.
+#define POS_CL_DMA_MAX_SIZE (1 << (MCHAN_CMD_CMD_LEN_WIDTH - 1))
+
+
+#if defined(ARCHI_MCHAN_DEMUX_ADDR)
+
+// Each core has its own command port, so that commands pushed by several
+// cores at the same time cannot be interleaved and no lock is needed.
+#define POS_CL_DMA_PORT ARCHI_MCHAN_DEMUX_ADDR
+
+static inline void pos_cl_dma_nd_lock() {}
+static inline void pos_cl_dma_nd_unlock() {}
+
+#else
+
+#define POS_CL_DMA_PORT ARCHI_MCHAN_EXT_ADDR
+
+// The lock is taken once for the whole transfer instead of once per command
+static inline void pos_cl_dma_nd_lock()
+{
+  eu_mutex_lock_from_id(0);
+}
+
+static inline void pos_cl_dma_nd_unlock()
+{
+  eu_mutex_unlock_from_id(0);
+}
+
+#endif
+
+
+static inline void pos_cl_dma_nd_write(uint32_t value)
+{
+  pulp_write32(POS_CL_DMA_PORT + MCHAN_CMD_OFFSET, value);
+}
+
+
+static void pos_cl_dma_nd_push(uint32_t cmd, uint32_t loc, uint32_t ext)
+{
+  pos_cl_dma_nd_write(cmd);
+  pos_cl_dma_nd_write(loc);
+  pos_cl_dma_nd_write(ext);
+#if defined(ARCHI_HAS_MCHAN_64) && ARCHI_HAS_MCHAN_64 == 1
+  pos_cl_dma_nd_write(0);
+#endif
+}
+
+
+// Copy contiguous lines of the given size, with the given stride in external
+// memory
+static void pos_cl_dma_nd_lines(uint32_t ext, uint32_t loc, uint32_t line_size, uint32_t stride, uint32_t nb_lines, int dir)
+{
+  if (line_size > POS_CL_DMA_MAX_SIZE / 2)
+  {
+    // Lines are too big to group several of them, each one is split into
+    // 1D commands
+    for (uint32_t i=0; i<nb_lines; i++)
+    {
+      uint32_t line_ext = ext;
+      uint32_t size = line_size;
+
+      while (size)
+      {
+        uint32_t chunk = size > POS_CL_DMA_MAX_SIZE ? POS_CL_DMA_MAX_SIZE : size;
+        pos_cl_dma_nd_push(plp_dma_getCmd(dir, chunk, PLP_DMA_1D, PLP_DMA_TRIG_EVT, PLP_DMA_NO_TRIG_IRQ, PLP_DMA_SHARED), loc, line_ext);
+        line_ext += chunk;
+        loc += chunk;
+        size -= chunk;
+      }
+
+      ext += stride;
+    }
+  }
+  else
+  {
+    // Otherwise as many lines as possible are copied with each 2D command
+    uint32_t max_lines = POS_CL_DMA_MAX_SIZE / line_size;
+
+    while (nb_lines)
+    {
+      uint32_t lines = nb_lines > max_lines ? max_lines : nb_lines;
+      uint32_t size = lines * line_size;
+
+      if (lines == 1)
+      {
+        pos_cl_dma_nd_push(plp_dma_getCmd(dir, size, PLP_DMA_1D, PLP_DMA_TRIG_EVT, PLP_DMA_NO_TRIG_IRQ, PLP_DMA_SHARED), loc, ext);
+      }
+      else
+      {
+        pos_cl_dma_nd_push(plp_dma_getCmd(dir, size, PLP_DMA_2D, PLP_DMA_TRIG_EVT, PLP_DMA_NO_TRIG_IRQ, PLP_DMA_SHARED), loc, ext);
+        pos_cl_dma_nd_write(line_size);
+        pos_cl_dma_nd_write(stride);
+      }
+
+      ext += lines * stride;
+      loc += size;
+      nb_lines -= lines;
+    }
+  }
+}
+
+
+int pos_cl_dma_nd(pi_cl_dma_nd_t *desc, pi_cl_dma_cmd_t *cmd)
+{
+  // Empty lines would make the number of lines per command infinite
+  if (desc->line_size == 0 || desc->nb_dims < 1 || desc->nb_dims > PI_CL_DMA_ND_MAX_DIMS)
+    return -1;
+
+  uint32_t line_size = desc->line_size;
+  int nb_outer = desc->nb_dims - 1;
+  int dim = 0;
+
+  // Outer dimensions contiguous in external memory are merged into the
+  // lines, so that a dense tile is a single 1D transfer
+  while (dim < nb_outer && desc->stride[dim] == line_size)
+  {
+    line_size *= desc->length[dim];
+    dim++;
+  }
+
+  // The next dimension is handled by the 2D commands and the other ones
+  // are iterated here
+  uint32_t stride = dim < nb_outer ? desc->stride[dim] : line_size;
+  uint32_t nb_lines = dim < nb_outer ? desc->length[dim] : 1;
+  uint32_t index[PI_CL_DMA_ND_MAX_DIMS-1] = { 0 };
+  uint32_t ext = desc->ext;
+  uint32_t loc = desc->loc;
+
+  // Prevent the compiler from pushing the transfer before all previous
+  // stores are done
+  hal_compiler_barrier();
+
+  pos_cl_dma_nd_lock();
+
+  // All the commands pushed after the counter allocation use the same
+  // counter
+  cmd->id = pulp_read32(POS_CL_DMA_PORT + MCHAN_CMD_OFFSET);
+
+  while (1)
+  {
+    pos_cl_dma_nd_lines(ext, loc, line_size, stride, nb_lines, desc->dir);
+    loc += line_size * nb_lines;
+
+    int outer = dim + 1;
+    for (; outer<nb_outer; outer++)
+    {
+      ext += desc->stride[outer];
+      if (++index[outer] < desc->length[outer])
+        break;
+      ext -= desc->stride[outer] * desc->length[outer];
+      index[outer] = 0;
+    }
+
+    if (outer >= nb_outer)
+      break;
+  }
+
+  pos_cl_dma_nd_unlock();
+
+  return 0;
+}
+
+
+
+/*
+ * Asynchronous transfers
+ *
+ * Transfers in flight are kept in issue order in the pending list, and the
+ * ones done without callback are moved to the completion queue. As the lists
+ * are also handled by the interrupt handler of the master, the lock is
+ * always taken with interrupts disabled. When both are needed, the DMA mutex
+ * (EU mutex 0) is always taken before the list lock.
+ */
+
+static PI_CL_L1 pi_cl_dma_async_t *pos_cl_dma_pending;
+static PI_CL_L1 pi_cl_dma_async_t *pos_cl_dma_pending_last;
+static PI_CL_L1 pi_cl_dma_async_t *pos_cl_dma_done;
+static PI_CL_L1 pi_cl_dma_async_t *pos_cl_dma_done_last;
+static PI_CL_L1 uint32_t pos_cl_dma_async_lock;
+
+
+static inline int pos_cl_dma_async_lock_get()
+{
+  int irq = hal_irq_disable();
+  while (pos_tas_lock_32((uint32_t)&pos_cl_dma_async_lock) == -1)
+  {
+  }
+  return irq;
+}
+
+
+static inline void pos_cl_dma_async_lock_release(int irq)
+{
+  pos_tas_unlock_32((uint32_t)&pos_cl_dma_async_lock, 0);
+  hal_irq_restore(irq);
+}
+
+
+// Move the finished transfers out of the pending list and return the ones
+// with a callback, which must be executed without the lock
+static pi_cl_dma_async_t *pos_cl_dma_async_check()
+{
+  uint32_t status = DMA_READ(MCHAN_STATUS_OFFSET);
+  pi_cl_dma_async_t *callbacks = NULL;
+  pi_cl_dma_async_t *prev = NULL;
+  pi_cl_dma_async_t *copy = pos_cl_dma_pending;
+
+  while (copy)
+  {
+    pi_cl_dma_async_t *next = copy->next;
+
+    if (status & (1 << copy->id))
+    {
+      prev = copy;
+    }
+    else
+    {
+      if (prev)
+        prev->next = next;
+      else
+        pos_cl_dma_pending = next;
+      if (copy == pos_cl_dma_pending_last)
+        pos_cl_dma_pending_last = prev;
+
+      plp_dma_counter_free(copy->id);
+
+      if (copy->callback)
+      {
+        copy->next = callbacks;
+        callbacks = copy;
+      }
+      else
+      {
+        copy->next = NULL;
+        if (pos_cl_dma_done)
+          pos_cl_dma_done_last->next = copy;
+        else
+          pos_cl_dma_done = copy;
+        pos_cl_dma_done_last = copy;
+        copy->done = 1;
+      }
+    }
+
+    copy = next;
+  }
+
+  return callbacks;
+}
+
+
+static void pos_cl_dma_async_callbacks(pi_cl_dma_async_t *copy)
+{
+  if (copy == NULL)
+    return;
+
+  while (copy)
+  {
+    pi_cl_dma_async_t *next = copy->next;
+    copy->callback(copy->arg);
+    copy->done = 1;
+    copy = next;
+  }
+
+  // Other cores may be waiting for these transfers
+  eu_evt_trig(eu_evt_trig_addr(POS_EVENT_CLUSTER_DMA), 0);
+}
+
+
+void pos_cl_dma_handler()
+{
+  pos_irq_clr(1 << ARCHI_CL_EVT_DMA1);
+
+  int irq = pos_cl_dma_async_lock_get();
+  pi_cl_dma_async_t *callbacks = pos_cl_dma_async_check();
+  pos_cl_dma_async_lock_release(irq);
+
+  pos_cl_dma_async_callbacks(callbacks);
+
+  // Cores waiting for a transfer may have been waiting for this one
+  eu_evt_trig(eu_evt_trig_addr(POS_EVENT_CLUSTER_DMA), 0);
+}
+
+
+static void pos_cl_dma_async_push(uint32_t cmd, uint32_t ext, uint32_t loc, uint32_t stride, uint32_t length, pi_cl_dma_async_t *copy)
+{
+  copy->next = NULL;
+  copy->done = 0;
+
+  // Prevent the compiler from pushing the transfer before all previous
+  // stores are done
+  hal_compiler_barrier();
+
+  // The transfer is put in the pending list with the lock held so that it
+  // cannot be seen as finished before.
+  // The DMA mutex is taken before the list lock, as the master can hold it
+  // with interrupts enabled while its interrupt handler spins on the list
+  // lock. The list lock must never be held while waiting for the mutex.
+  int irq = hal_irq_disable();
+  eu_mutex_lock_from_id(0);
+  while (pos_tas_lock_32((uint32_t)&pos_cl_dma_async_lock) == -1)
+  {
+  }
+
+  copy->id = plp_dma_counter_alloc();
+  if (cmd & (1 << MCHAN_CMD_CMD__2D_EXT_BIT))
+    plp_dma_cmd_push_2d(cmd, loc, ext, stride, length);
+  else
+    plp_dma_cmd_push(cmd, loc, ext);
+
+  if (pos_cl_dma_pending)
+    pos_cl_dma_pending_last->next = copy;
+  else
+    pos_cl_dma_pending = copy;
+  pos_cl_dma_pending_last = copy;
+
+  pos_tas_unlock_32((uint32_t)&pos_cl_dma_async_lock, 0);
+  eu_mutex_unlock_from_id(0);
+  hal_irq_restore(irq);
+}
+
+
+// The transfers also trigger the DMA event so that waiting cores can check
+// them even if the master interrupt is not handled, e.g. because the master
+// is itself waiting with interrupts disabled.
+void pi_cl_dma_async_cmd(uint32_t ext, uint32_t loc, uint32_t size, pi_cl_dma_dir_e dir, pi_cl_dma_async_t *copy)
+{
+  uint32_t cmd = plp_dma_getCmd(dir, size, PLP_DMA_1D, PLP_DMA_TRIG_EVT, PLP_DMA_TRIG_IRQ, PLP_DMA_SHARED);
+  pos_cl_dma_async_push(cmd, ext, loc, 0, 0, copy);
+}
+
+
+void pi_cl_dma_async_cmd_2d(uint32_t ext, uint32_t loc, uint32_t size, uint32_t stride, uint32_t length, pi_cl_dma_dir_e dir, pi_cl_dma_async_t *copy)
+{
+  uint32_t cmd = plp_dma_getCmd(dir, size, PLP_DMA_2D, PLP_DMA_TRIG_EVT, PLP_DMA_TRIG_IRQ, PLP_DMA_SHARED);
+  pos_cl_dma_async_push(cmd, ext, loc, stride, length, copy);
+}
+
+
+void pi_cl_dma_async_wait(pi_cl_dma_async_t *copy)
+{
+  while (1)
+  {
+    int irq = pos_cl_dma_async_lock_get();
+    pi_cl_dma_async_t *callbacks = pos_cl_dma_async_check();
+    int done = copy->done;
+
+    // A transfer waited individually is removed from the completion queue
+    if (done && copy->callback == NULL)
+    {
+      pi_cl_dma_async_t *prev = NULL;
+      for (pi_cl_dma_async_t *current = pos_cl_dma_done; current; prev = current, current = current->next)
+      {
+        if (current == copy)
+        {
+          if (prev)
+            prev->next = copy->next;
+          else
+            pos_cl_dma_done = copy->next;
+          if (copy == pos_cl_dma_done_last)
+            pos_cl_dma_done_last = prev;
+          break;
+        }
+      }
+    }
+
+    pos_cl_dma_async_lock_release(irq);
+
+    pos_cl_dma_async_callbacks(callbacks);
+
+    if (*(volatile uint8_t *)&copy->done)
+      break;
+
+    eu_evt_maskWaitAndClr((1 << ARCHI_CL_EVT_DMA0) | (1 << POS_EVENT_CLUSTER_DMA));
+  }
+}
+
+
+pi_cl_dma_async_t *pi_cl_dma_wait_any()
+{
+  while (1)
+  {
+    int irq = pos_cl_dma_async_lock_get();
+    pi_cl_dma_async_t *callbacks = pos_cl_dma_async_check();
+    pi_cl_dma_async_t *copy = pos_cl_dma_done;
+    int pending = pos_cl_dma_pending != NULL;
+
+    if (copy)
+    {
+      pos_cl_dma_done = copy->next;
+    }
+
+    pos_cl_dma_async_lock_release(irq);
+
+    pos_cl_dma_async_callbacks(callbacks);
+
+    if (copy || !pending)
+      return copy;
+
+    eu_evt_maskWaitAndClr((1 << ARCHI_CL_EVT_DMA0) | (1 << POS_EVENT_CLUSTER_DMA));
+  }
+}
@@ -53,28 +53,80 @@ static void pos_hyper_wait_done(pos_hyper_t *hyper)
   }
 }
 
-void pos_hyper_enqueue(pos_udma_channel_t *channel, pi_task_t *task, uint32_t offset, uint32_t buffer, uint32_t size, uint32_t cfg)
+/*
+ * Transfer queue
+ *
+ * The complete descriptor of each transfer is kept in its task, and the
+ * HyperBus registers of a transfer are only programmed when it is dispatched
+ * to one of the 2 UDMA slots of its channel, with a transaction ID allocated
+ * at this time. Any number of transfers can then be queued, and the next
+ * one is dispatched from the end of transfer interrupt so that the link
+ * stays busy.
+ *
+ * Descriptor layout in the task data:
+ *   0: L2 buffer, 1: size, 2: HyperBus address, 3: mode (2D enables in bits
+ *   0 and 1, CA setup in bits 8 and above), 4: 2D length, 5: 2D stride,
+ *   6: device, 7: transaction ID, once dispatched
+ */
+
+#define POS_HYPER_MODE_2D_EXT (1<<0)
+#define POS_HYPER_MODE_2D_L2  (1<<1)
+#define POS_HYPER_MODE_CA_BIT 8
+
+#define POS_HYPER_CA_READ  0x5
+#define POS_HYPER_CA_WRITE 0x1
+
+// Device whose timings are currently programmed, as they are common to all
+// transactions
+static PI_L2 pos_hyper_t *pos_hyper_current;
+
+static void pos_hyper_dispatch(pos_udma_channel_t *channel, pi_task_t *task)
+{
+    pos_hyper_t *hyper = (pos_hyper_t *)task->data[6];
+    uint32_t mode = task->data[3];
+    uint32_t length = task->data[4];
+    uint32_t stride = task->data[5];
+
+    unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {mode & POS_HYPER_MODE_2D_EXT, length, stride, (mode & POS_HYPER_MODE_2D_L2) >> 1, length, stride};
+    unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {mode >> POS_HYPER_MODE_CA_BIT, task->data[2]};
+
+    if (pos_hyper_current != hyper)
+    {
+        pos_hyper_setup(hyper);
+        pos_hyper_current = hyper;
+    }
+
+    // The id is only kept in the task, hyper->tran_id belongs to the
+    // synchronous accesses, which can be interrupted by a dispatch
+    uint32_t tran_id = plp_hyper_id_alloc(hyper->hyper_id);
+    task->data[7] = tran_id;
+
+    plp_hyper_set_twd_param(hyper->hyper_id, twd_cmd, tran_id);
+    plp_hyper_set_ctl_param(hyper->hyper_id, ctl_cmd, tran_id);
+
+    uint32_t chan_offset = UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + (channel == hyper->rx_channel ? UDMA_HYPER_CHANNEL_RX(tran_id) : UDMA_HYPER_CHANNEL_TX(tran_id));
+
+    plp_hyper_enqueue(chan_offset, task->data[0], task->data[1], UDMA_CHANNEL_CFG_EN | UDMA_CHANNEL_CFG_SIZE_8);
+}
+
+static void pos_hyper_enqueue(pos_udma_channel_t *channel, pi_task_t *task)
 {
-    // A UDMA channel has 2 slots, enqueue the copy to the UDMA if one of them is available, otherwise
-    // put the transfer on hold.
+    int irq = hal_irq_disable();
+
+    // A UDMA channel has 2 slots, dispatch the transfer if one of them is available, otherwise
+    // put it on hold.
     if (channel->pendings[0] == NULL)
     {
         channel->pendings[0] = task;
-        plp_hyper_enqueue(offset, buffer, size, UDMA_CHANNEL_CFG_EN | cfg);
+        pos_hyper_dispatch(channel, task);
     }
     else if (channel->pendings[1] == NULL)
     {
         channel->pendings[1] = task;
-        plp_hyper_enqueue(offset, buffer, size, UDMA_CHANNEL_CFG_EN | cfg);
+        pos_hyper_dispatch(channel, task);
     }
     else
     {
-        task->data[0] = buffer;
-        task->data[1] = size;
-        task->data[2] = cfg;
-
-        task->data[3] = offset;
-
         if (channel->waitings_first == NULL)
             channel->waitings_first = task;
         else
@@ -83,6 +135,21 @@ void pos_hyper_enqueue(pos_udma_channel_t *channel, pi_task_t *task, uint32_t of
         channel->waitings_last = task;
         task->next = NULL;
     }
+
+    hal_irq_restore(irq);
+}
+
+static void pos_hyper_copy_async(struct pi_device *device, pos_udma_channel_t *channel, uint32_t ca, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t mode, uint32_t stride, uint32_t length, struct pi_task *task)
+{
+    task->data[0] = (uint32_t)addr;
+    task->data[1] = size;
+    task->data[2] = hyper_addr;
+    task->data[3] = mode | (ca << POS_HYPER_MODE_CA_BIT);
+    task->data[4] = length;
+    task->data[5] = stride;
+    task->data[6] = (uint32_t)device->data;
+
+    pos_hyper_enqueue(channel, task);
 }
 
 void pos_hyper_handle_copy(int event, void *arg)
@@ -99,7 +166,7 @@ void pos_hyper_handle_copy(int event, void *arg)
         channel->waitings_first = pending_first->next;
         channel->pendings[1] = pending_first;
 
-        plp_hyper_enqueue(pending_first->data[3], pending_first->data[0], pending_first->data[1], UDMA_CHANNEL_CFG_EN | pending_first->data[2]);
+        pos_hyper_dispatch(channel, pending_first);
     }
     else
     {
@@ -148,6 +215,7 @@ int32_t pi_hyper_open(struct pi_device *device)
 
   if (hyper_open_count == 0)
   {
+    pos_hyper_current = NULL;
     pos_hyper_create_channel(hyper->rx_channel, UDMA_CHANNEL_ID(periph_id), hyper_channel + ARCHI_UDMA_HYPER_EOT_RX_EVT);
     pos_hyper_create_channel(hyper->tx_channel, UDMA_CHANNEL_ID(periph_id)+1, hyper_channel + ARCHI_UDMA_HYPER_EOT_TX_EVT);
   }
@@ -278,18 +346,7 @@ void pi_hyper_read(struct pi_device *device, uint32_t hyper_addr, void *addr, ui
 void pi_hyper_read_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {0,0,0,0,0,0};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x5, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->rx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_RX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  pos_hyper_copy_async(device, hyper->rx_channel, POS_HYPER_CA_READ, hyper_addr, addr, size, 0, 0, 0, task);
 }
 
 void pi_hyper_read_2d(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t stride, uint32_t length)
@@ -302,35 +359,14 @@ void pi_hyper_read_2d(struct pi_device *device, uint32_t hyper_addr, void *addr,
 void pi_hyper_read_2d_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t stride, uint32_t length, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {1,length,stride,0,length,stride};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x5, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->rx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_RX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  pos_hyper_copy_async(device, hyper->rx_channel, POS_HYPER_CA_READ, hyper_addr, addr, size, POS_HYPER_MODE_2D_EXT, stride, length, task);
 }
 
 void pi_hyper_read_bi2d_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t dir, uint32_t stride, uint32_t length, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {((0x0^dir) & 0x1),length,stride,((0x1^dir) & 0x1),length,stride};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x5, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->rx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_RX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  uint32_t mode = (dir & 0x1) ? POS_HYPER_MODE_2D_EXT : POS_HYPER_MODE_2D_L2;
+  pos_hyper_copy_async(device, hyper->rx_channel, POS_HYPER_CA_READ, hyper_addr, addr, size, mode, stride, length, task);
 }
 
 void pi_hyper_write(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size)
@@ -340,7 +376,12 @@ void pi_hyper_write(struct pi_device *device, uint32_t hyper_addr, void *addr, u
   unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {0,0,0,0,0,0};
   unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x0, hyper_addr};
 
+  // The transfers dispatched from the end of transfer interrupts also
+  // program the registers, they must not be interleaved with this sequence
+  int irq = hal_irq_disable();
+
   pos_hyper_setup(hyper);
+  pos_hyper_current = hyper;
 
   while(plp_hyper_nb_tran(hyper->hyper_id, hyper->tran_id)>HYPER_FIFO_DEPTH-1){}
 
@@ -349,23 +390,14 @@ void pi_hyper_write(struct pi_device *device, uint32_t hyper_addr, void *addr, u
   pi_hyper_set_regs(device, PI_HYPER_CFG, (unsigned short *)addr);
 
   plp_hyper_enqueue(UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_TX(hyper->tran_id), 0x0, 0x0, UDMA_CHANNEL_CFG_EN | UDMA_CHANNEL_CFG_SIZE_8);
+
+  hal_irq_restore(irq);
 }
 
 void pi_hyper_write_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {0,0,0,0,0,0};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x1, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->tx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_TX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  pos_hyper_copy_async(device, hyper->tx_channel, POS_HYPER_CA_WRITE, hyper_addr, addr, size, 0, 0, 0, task);
 }
 
 void pi_hyper_write_2d(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t stride, uint32_t length)
@@ -378,35 +410,14 @@ void pi_hyper_write_2d(struct pi_device *device, uint32_t hyper_addr, void *addr
 void pi_hyper_write_2d_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t stride, uint32_t length, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {1,length,stride,0,length,stride};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x1, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->tx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_TX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  pos_hyper_copy_async(device, hyper->tx_channel, POS_HYPER_CA_WRITE, hyper_addr, addr, size, POS_HYPER_MODE_2D_EXT, stride, length, task);
 }
 
 void pi_hyper_write_bi2d_async(struct pi_device *device, uint32_t hyper_addr, void *addr, uint32_t size, uint32_t dir, uint32_t stride, uint32_t length, struct pi_task *task)
 {
   pos_hyper_t *hyper = (pos_hyper_t *)device->data;
-
-  unsigned int twd_cmd[HYPER_NB_TWD_REGS] = {((0x0^dir) & 0x1),length,stride,((0x1^dir) & 0x1),length,stride};
-  unsigned int ctl_cmd[HYPER_NB_CTL_REGS] = {0x1, hyper_addr};
-
-  pos_hyper_setup(hyper);
-
-  hyper->tran_id = plp_hyper_id_alloc(hyper->hyper_id);
-
-  pi_hyper_set_regs(device, PI_HYPER_TWD, (unsigned int *)twd_cmd);
-  pi_hyper_set_regs(device, PI_HYPER_CTL, (unsigned int *)ctl_cmd);
-
-  pos_hyper_enqueue(hyper->tx_channel, task, UDMA_HYPER_BASE_ADDR(hyper->hyper_id) + UDMA_HYPER_CHANNEL_TX(hyper->tran_id), (uint32_t)addr, size, UDMA_CHANNEL_CFG_SIZE_8);
+  uint32_t mode = (dir & 0x1) ? POS_HYPER_MODE_2D_EXT : POS_HYPER_MODE_2D_L2;
+  pos_hyper_copy_async(device, hyper->tx_channel, POS_HYPER_CA_WRITE, hyper_addr, addr, size, mode, stride, length, task);
 }
 
 int pi_hyper_id_alloc(struct pi_device *device)
@@ -27,36 +27,86 @@ PI_FC_TINY void *pos_udma_channel_callback_arg[ARCHI_NB_PERIPH*2];
 
 
 
-#ifndef __USE_ASM_OPTIM__
-
-void pos_udma_handle_copy(int event, void *arg)
+// Make the next non-empty element of the scatter-gather list the current
+// buffer of the transfer. Returns 0 if there is none left.
+static int pos_udma_next_segment(pi_task_t *task)
 {
-    pos_udma_channel_t *channel = arg;
-
-    pi_task_t *pending_1 = channel->pendings[1];
-    pi_task_t *pending_0 = channel->pendings[0];
-    pi_task_t *pending_first = channel->waitings_first;
-    channel->pendings[0] = pending_1;
+    pos_udma_sg_t *sg = (pos_udma_sg_t *)task->data[3];
+    uint32_t nb_sg = task->data[4];
 
-    if (pending_first)
+    while (nb_sg)
     {
-        channel->waitings_first = pending_first->next;
-        channel->pendings[1] = pending_first;
-        plp_udma_enqueue(channel->base, pending_first->data[0], pending_first->data[1], 0);
+        nb_sg--;
+        if (sg->size)
+        {
+            task->data[0] = sg->buffer;
+            task->data[1] = sg->size;
+            task->data[3] = (uint32_t)(sg + 1);
+            task->data[4] = nb_sg;
+            return 1;
+        }
+        sg++;
     }
-    else
+
+    task->data[4] = 0;
+    return 0;
+}
+
+
+
+// Fill all the free hardware slots with commands of the waiting transfers
+static void pos_udma_refill(pos_udma_channel_t *channel)
+{
+    while (channel->pendings[1] == NULL)
     {
-        channel->pendings[1] = NULL;
-    }
+        pi_task_t *task = channel->waitings_first;
+        if (task == NULL)
+            break;
+
+        uint32_t size = task->data[1];
+        if (size > POS_UDMA_MAX_CMD_SIZE)
+            size = POS_UDMA_MAX_CMD_SIZE;
 
-    pos_task_push_locked(pending_0);
+        int slot = channel->pendings[0] != NULL;
+        channel->pendings[slot] = task;
+        channel->sizes[slot] = size;
+        plp_udma_enqueue(channel->base, task->data[0], size, task->data[2]);
+
+        task->data[0] += size;
+        task->data[1] -= size;
+
+        if (task->data[1] == 0 && !pos_udma_next_segment(task))
+            channel->waitings_first = task->next;
+    }
 }
 
-#else
 
-extern void __rt_udma_handle_copy();
 
-#endif
+void pos_udma_handle_copy(int event, void *arg)
+{
+    pos_udma_channel_t *channel = arg;
+    pi_task_t *task = channel->pendings[0];
+
+    channel->stats.nb_bytes += channel->sizes[0];
+    channel->stats.nb_cmds++;
+
+    channel->pendings[0] = channel->pendings[1];
+    channel->sizes[0] = channel->sizes[1];
+    channel->pendings[1] = NULL;
+
+    // Refill before handling the completion to keep the channel busy. If the
+    // channel was drained, this fills both slots.
+    pos_udma_refill(channel);
+
+    // The transfer is over once all its commands are enqueued and none of
+    // them is still in a slot
+    if (task->data[1] == 0 && task->data[4] == 0 &&
+        channel->pendings[0] != task && channel->pendings[1] != task)
+    {
+        channel->stats.nb_transfers++;
+        pos_task_push_locked(task);
+    }
+}
 
 
 
@@ -67,36 +117,69 @@ void pos_udma_create_channel(pos_udma_channel_t *channel, int channel_id, int so
     channel->pendings[1] = NULL;
     channel->waitings_first = NULL;
     channel->base = hal_udma_channel_base(channel_id);
+    channel->stats.nb_bytes = 0;
+    channel->stats.nb_cmds = 0;
+    channel->stats.nb_transfers = 0;
+}
+
+
+
+static void pos_udma_enqueue_task(pos_udma_channel_t *channel, pi_task_t *task)
+{
+    int irq = hal_irq_disable();
+
+    // Transfers are queued and the free slots are filled from the head of
+    // the queue, so that a transfer split into several commands keeps its
+    // order with respect to the others.
+    if (channel->waitings_first == NULL)
+        channel->waitings_first = task;
+    else
+        channel->waitings_last->next = task;
+
+    channel->waitings_last = task;
+    task->next = NULL;
+
+    pos_udma_refill(channel);
+
+    hal_irq_restore(irq);
 }
 
 
 
 void pos_udma_enqueue(pos_udma_channel_t *channel, pi_task_t *task, uint32_t buffer, uint32_t size, uint32_t cfg)
 {
-    // A UDMA channel has 2 slots, enqueue the copy to the UDMA if one of them is available, otherwise
-    // put the transfer on hold.
-    if (channel->pendings[0] == NULL)
-    {
-        channel->pendings[0] = task;
-        plp_udma_enqueue(channel->base, buffer, size, UDMA_CHANNEL_CFG_EN | cfg);
-    }
-    else if (channel->pendings[1] == NULL)
+    task->data[0] = buffer;
+    task->data[1] = size;
+    task->data[2] = UDMA_CHANNEL_CFG_EN | cfg;
+    task->data[4] = 0;
+
+    if (size == 0)
     {
-        channel->pendings[1] = task;
-        plp_udma_enqueue(channel->base, buffer, size, UDMA_CHANNEL_CFG_EN | cfg);
+        int irq = hal_irq_disable();
+        pos_task_push_locked(task);
+        hal_irq_restore(irq);
+        return;
     }
-    else
-    {
-        task->data[0] = buffer;
-        task->data[1] = size;
-        task->data[2] = cfg;
 
-        if (channel->waitings_first == NULL)
-            channel->waitings_first = task;
-        else
-            channel->waitings_last->next = task;
+    pos_udma_enqueue_task(channel, task);
+}
+
+
+
+void pos_udma_enqueue_sg(pos_udma_channel_t *channel, pi_task_t *task, pos_udma_sg_t *sg, int nb_sg, uint32_t cfg)
+{
+    task->data[2] = UDMA_CHANNEL_CFG_EN | cfg;
+    task->data[3] = (uint32_t)sg;
+    task->data[4] = nb_sg;
 
-        channel->waitings_last = task;
-        task->next = NULL;
+    if (!pos_udma_next_segment(task))
+    {
+        task->data[1] = 0;
+        int irq = hal_irq_disable();
+        pos_task_push_locked(task);
+        hal_irq_restore(irq);
+        return;
     }
+
+    pos_udma_enqueue_task(channel, task);
 }
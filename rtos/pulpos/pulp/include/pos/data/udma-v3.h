@@ -30,11 +30,37 @@ extern PI_FC_TINY void *pos_udma_channel_callback_arg[];
 
 #include "pmsis/pmsis_types.h"
 
+// Biggest size of a single UDMA command, bigger transfers are split into
+// several commands. This is a multiple of 4 so that chunks of 16 and 32
+// bits transfers stay aligned.
+#ifndef POS_UDMA_MAX_CMD_SIZE
+#define POS_UDMA_MAX_CMD_SIZE 0xFFFC
+#endif
+
+// One element of a scatter-gather list
+typedef struct {
+  uint32_t buffer;
+  uint32_t size;
+} pos_udma_sg_t;
+
+// Throughput counters of a channel, counting completed commands
+typedef struct {
+  uint32_t nb_bytes;
+  uint32_t nb_cmds;
+  uint32_t nb_transfers;
+} pos_udma_stats_t;
+
+// pendings contains the transfer owning each hardware slot, in completion
+// order. A transfer bigger than a command can own both of them.
+// waitings_first is the transfer being pushed to the hardware, it stays
+// at the head of the list until its last command is enqueued.
 typedef struct {
   pi_task_t *pendings[2];
   pi_task_t *waitings_first;
   pi_task_t *waitings_last;
   uint32_t base;
+  uint32_t sizes[2];
+  pos_udma_stats_t stats;
 } pos_udma_channel_t;
 
 #endif
@@ -35,4 +35,24 @@ void pos_udma_create_channel(pos_udma_channel_t *channel, int channel_id, int so
 
 void pos_udma_enqueue(pos_udma_channel_t *channel, pi_task_t *task, uint32_t buffer, uint32_t size, uint32_t cfg);
 
+// Enqueue a transfer made of several buffers. The task is pushed once all of
+// them are transferred. The list must stay valid until then.
+void pos_udma_enqueue_sg(pos_udma_channel_t *channel, pi_task_t *task, pos_udma_sg_t *sg, int nb_sg, uint32_t cfg);
+
+static inline void pos_udma_get_stats(pos_udma_channel_t *channel, pos_udma_stats_t *stats)
+{
+    int irq = hal_irq_disable();
+    *stats = channel->stats;
+    hal_irq_restore(irq);
+}
+
+static inline void pos_udma_reset_stats(pos_udma_channel_t *channel)
+{
+    int irq = hal_irq_disable();
+    channel->stats.nb_bytes = 0;
+    channel->stats.nb_cmds = 0;
+    channel->stats.nb_transfers = 0;
+    hal_irq_restore(irq);
+}
+
 #endif
\ No newline at end of file
@@ -84,6 +84,7 @@
 #define ARCHI_CLUSTER_NB_PE 8
 #endif
 #define ARCHI_NB_CLUSTER    1
+#define ARCHI_EU_NB_HW_BARRIERS 8
 
 
 
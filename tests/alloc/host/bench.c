@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host checks and benchmark of the pulpos allocators.
+ *
+ * The trace file has one operation per line:
+ *   a <id> <size> [<align>]    allocate a chunk and name it <id>
+ *   f <id>                     free chunk <id>
+ * Lines starting with # are ignored.
+ */
+
+#include "pmsis.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_CHECK_ITER 200000
+#define NB_CHECK_SLOTS 256
+#define NB_REPLAY 20
+
+typedef struct
+{
+  char op;
+  int id;
+  int size;
+  int align;
+} trace_op_t;
+
+typedef struct
+{
+  void *ptr;
+  int size;
+} slot_t;
+
+static int errors = 0;
+
+#define CHECK(cond, x...) \
+  do { if (!(cond)) { printf("[" BACKEND "] check failed: " x); printf("\n"); errors++; } } while(0)
+
+
+static void fill(void *ptr, int size, int id)
+{
+  memset(ptr, id & 0xff, size);
+}
+
+static int verify(void *ptr, int size, int id)
+{
+  unsigned char *data = (unsigned char *)ptr;
+  for (int i=0; i<size; i++)
+  {
+    if (data[i] != (id & 0xff))
+      return 0;
+  }
+  return 1;
+}
+
+static void check_heap(int heap_size)
+{
+  pos_alloc_t alloc;
+  void *heap = malloc(heap_size);
+  slot_t slots[NB_CHECK_SLOTS];
+  pos_alloc_stats_t stats;
+
+  memset(slots, 0, sizeof(slots));
+  pos_alloc_init(&alloc, heap, heap_size);
+
+  pos_alloc_get_stats(&alloc, &stats);
+  int initial_size = stats.free_size;
+  CHECK(stats.nb_free_chunks == 1, "initial heap should be a single block (%d)", stats.nb_free_chunks);
+
+  srand(1);
+
+  for (int i=0; i<NB_CHECK_ITER; i++)
+  {
+    int index = rand() % NB_CHECK_SLOTS;
+    slot_t *slot = &slots[index];
+
+    if (slot->ptr)
+    {
+      CHECK(verify(slot->ptr, slot->size, index), "chunk %d was overwritten", index);
+      pos_free(&alloc, slot->ptr, slot->size);
+      slot->ptr = NULL;
+    }
+    else
+    {
+      int size = 1 + rand() % ((rand() % 8) == 0 ? 8192 : 256);
+      int align = (rand() % 4) == 0 ? 1 << (2 + rand() % 10) : 0;
+
+      slot->ptr = align ? pos_alloc_align(&alloc, size, align) : pos_alloc(&alloc, size);
+      if (slot->ptr)
+      {
+        CHECK((char *)slot->ptr >= (char *)heap && (char *)slot->ptr + size <= (char *)heap + heap_size, "chunk %d is out of the heap", index);
+        CHECK(!align || ((uintptr_t)slot->ptr & (align - 1)) == 0, "chunk %d is not aligned on %d", index, align);
+        slot->size = size;
+        fill(slot->ptr, size, index);
+      }
+    }
+  }
+
+  for (int i=0; i<NB_CHECK_SLOTS; i++)
+  {
+    if (slots[i].ptr)
+    {
+      CHECK(verify(slots[i].ptr, slots[i].size, i), "chunk %d was overwritten", i);
+      pos_free(&alloc, slots[i].ptr, slots[i].size);
+    }
+  }
+
+  pos_alloc_get_stats(&alloc, &stats);
+  CHECK(stats.free_size == initial_size, "free memory leaked (%d instead of %d)", stats.free_size, initial_size);
+  CHECK(stats.nb_free_chunks == 1, "free blocks were not coalesced (%d blocks)", stats.nb_free_chunks);
+
+  free(heap);
+}
+
+static trace_op_t *load_trace(const char *path, int *nb_ops, int *max_id)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    printf("Unable to open trace %s\n", path);
+    return NULL;
+  }
+
+  int capacity = 1024;
+  trace_op_t *ops = malloc(capacity * sizeof(trace_op_t));
+  char line[256];
+
+  *nb_ops = 0;
+  *max_id = 0;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    trace_op_t op = { 0 };
+    char kind;
+
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+
+    int nb_fields = sscanf(line, "%c %d %d %d", &kind, &op.id, &op.size, &op.align);
+    if ((kind != 'a' && kind != 'f') || nb_fields < (kind == 'a' ? 3 : 2) || op.id < 0)
+    {
+      printf("Invalid trace line: %s", line);
+      continue;
+    }
+
+    op.op = kind;
+    if (op.id > *max_id)
+      *max_id = op.id;
+
+    if (*nb_ops == capacity)
+    {
+      capacity *= 2;
+      ops = realloc(ops, capacity * sizeof(trace_op_t));
+    }
+    ops[(*nb_ops)++] = op;
+  }
+
+  fclose(file);
+
+  return ops;
+}
+
+static void replay_trace(trace_op_t *ops, int nb_ops, int max_id, int heap_size)
+{
+  void *heap = malloc(heap_size);
+  slot_t *slots = malloc((max_id + 1) * sizeof(slot_t));
+  pos_alloc_stats_t stats;
+  int max_fragmentation = 0;
+  int max_free_chunks = 0;
+  unsigned int nb_alloc = 0, nb_free = 0, nb_failed = 0;
+  unsigned int alloc_total = 0, alloc_max = 0, free_total = 0, free_max = 0;
+
+  for (int iter=0; iter<NB_REPLAY; iter++)
+  {
+    pos_alloc_t alloc;
+    pos_alloc_init(&alloc, heap, heap_size);
+    memset(slots, 0, (max_id + 1) * sizeof(slot_t));
+
+    for (int i=0; i<nb_ops; i++)
+    {
+      trace_op_t *op = &ops[i];
+      slot_t *slot = &slots[op->id];
+
+      if (op->op == 'a')
+      {
+        if (slot->ptr)
+          continue;
+
+        slot->ptr = op->align ? pos_alloc_align(&alloc, op->size, op->align) : pos_alloc(&alloc, op->size);
+        slot->size = op->size;
+      }
+      else if (slot->ptr)
+      {
+        pos_free(&alloc, slot->ptr, slot->size);
+        slot->ptr = NULL;
+      }
+
+      if (iter == 0)
+      {
+        pos_alloc_get_stats(&alloc, &stats);
+        if (stats.fragmentation > max_fragmentation)
+          max_fragmentation = stats.fragmentation;
+        if (stats.nb_free_chunks > max_free_chunks)
+          max_free_chunks = stats.nb_free_chunks;
+      }
+    }
+
+    pos_alloc_get_stats(&alloc, &stats);
+    nb_alloc += stats.nb_alloc;
+    nb_free += stats.nb_free;
+    nb_failed += stats.nb_failed;
+    alloc_total += stats.alloc_cycles_total;
+    free_total += stats.free_cycles_total;
+    if (stats.alloc_cycles_max > alloc_max)
+      alloc_max = stats.alloc_cycles_max;
+    if (stats.free_cycles_max > free_max)
+      free_max = stats.free_cycles_max;
+  }
+
+  printf("[%-9s] allocs: %u (failed: %u), frees: %u\n", BACKEND, nb_alloc / NB_REPLAY, nb_failed / NB_REPLAY, nb_free / NB_REPLAY);
+  printf("[%-9s] alloc latency: avg %u ns, max %u ns\n", BACKEND, nb_alloc ? alloc_total / nb_alloc : 0, alloc_max);
+  printf("[%-9s] free latency:  avg %u ns, max %u ns\n", BACKEND, nb_free ? free_total / nb_free : 0, free_max);
+  printf("[%-9s] peak fragmentation: %d.%d%%, peak free blocks: %d\n", BACKEND, max_fragmentation / 10, max_fragmentation % 10, max_free_chunks);
+
+  free(slots);
+  free(heap);
+}
+
+int main(int argc, char *argv[])
+{
+  int heap_size = argc > 2 ? atoi(argv[2]) : 512*1024;
+
+  check_heap(64*1024);
+  check_heap(heap_size);
+
+  if (argc > 1)
+  {
+    int nb_ops, max_id;
+    trace_op_t *ops = load_trace(argv[1], &nb_ops, &max_id);
+    if (ops == NULL)
+      return -1;
+
+    replay_trace(ops, nb_ops, max_id, heap_size);
+    free(ops);
+  }
+
+  if (errors)
+    printf("[%-9s] %d errors\n", BACKEND, errors);
+  else
+    printf("[%-9s] checks passed\n", BACKEND);
+
+  return errors != 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Minimal replacement of pmsis.h so that the pulpos allocators can be
+ * compiled and benchmarked natively on the host.
+ */
+
+#ifndef __HOST_PMSIS_H__
+#define __HOST_PMSIS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct { int dummy; } pi_task_t;
+typedef struct pi_cl_alloc_req_s pi_cl_alloc_req_t;
+typedef struct pi_cl_free_req_s pi_cl_free_req_t;
+
+#define POS_EVENT_CLUSTER_CALL_EVT 0
+#define eu_evt_maskWaitAndClr(mask)
+
+#define ALLOC_TRACE(level, x...)
+
+static inline unsigned int host_timestamp()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned int)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+// Latency statistics are reported in nanoseconds instead of cycles
+#define POS_ALLOC_TIMESTAMP() host_timestamp()
+
+#include "pos/data/alloc.h"
+#include "pos/implem/alloc.h"
+
+#endif
@@ -0,0 +1,204 @@
+/* 
+ * Copyright (C) 2019 GreenWaves Technologies
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD license.  See the LICENSE file for details.
+ */
+
+/*
+ * Checks the cluster barriers, barrier reductions and ticket locks, and
+ * reports the cycles per synchronization compared to the team barrier.
+ * The last event unit barrier is reserved for the cluster barriers.
+ */
+
+#include "pmsis.h"
+#include "stdio.h"
+
+#define NB_ITER 64
+#define HW_BARRIER (ARCHI_EU_NB_HW_BARRIERS - 1)
+
+static PI_CL_L1 pi_cl_barrier_t barrier;
+static PI_CL_L1 pi_cl_barrier_t odd_barrier;
+static PI_CL_L1 pi_cl_ticket_lock_t ticket_lock;
+static PI_CL_L1 int counter;
+static PI_CL_L1 int inside;
+static PI_L2 int errors;
+static PI_L2 uint32_t cycles[4];
+
+enum {
+  BENCH_TEAM_BARRIER,
+  BENCH_SW_BARRIER,
+  BENCH_HW_BARRIER,
+  BENCH_REDUCE,
+};
+
+static const char *bench_names[] = {
+  "team barrier", "sw barrier", "hw barrier", "reduce add"
+};
+
+static void error()
+{
+  pi_cl_team_critical_enter();
+  errors++;
+  pi_cl_team_critical_exit();
+}
+
+static uint32_t start_bench()
+{
+  pi_cl_team_barrier();
+  return pi_perf_cl_read(PI_PERF_CYCLES);
+}
+
+static void end_bench(int bench, uint32_t start)
+{
+  uint32_t end = pi_perf_cl_read(PI_PERF_CYCLES);
+  if (pi_core_id() == 0)
+    cycles[bench] = (end - start) / NB_ITER;
+}
+
+static void check_entry(void *arg)
+{
+  int core_id = pi_core_id();
+  int nb_cores = pi_cl_cluster_nb_cores();
+
+  for (int i=0; i<NB_ITER; i++)
+  {
+    if (pi_cl_barrier_reduce_add_i32(&barrier, core_id + i) != nb_cores*(nb_cores-1)/2 + nb_cores*i)
+      error();
+
+    if (pi_cl_barrier_reduce_max_i32(&barrier, core_id * i) != (nb_cores - 1) * i)
+      error();
+
+    if (core_id & 1)
+    {
+      if (pi_cl_barrier_reduce_add_f32(&odd_barrier, 1.0f) != (float)(nb_cores / 2))
+        error();
+    }
+
+    pi_cl_ticket_lock(&ticket_lock);
+    if (inside++)
+      error();
+    counter++;
+    inside--;
+    pi_cl_ticket_unlock(&ticket_lock);
+  }
+}
+
+static void bench_entry(void *arg)
+{
+  uint32_t start;
+
+  start = start_bench();
+  for (int i=0; i<NB_ITER; i++)
+  {
+    pi_cl_team_barrier();
+  }
+  end_bench(BENCH_TEAM_BARRIER, start);
+
+  start = start_bench();
+  for (int i=0; i<NB_ITER; i++)
+  {
+    pi_cl_barrier_wait(&barrier);
+  }
+  end_bench(BENCH_SW_BARRIER, start);
+
+  start = start_bench();
+  for (int i=0; i<NB_ITER; i++)
+  {
+    pi_cl_barrier_reduce_add_i32(&barrier, i);
+  }
+  end_bench(BENCH_REDUCE, start);
+}
+
+static void hw_bench_entry(void *arg)
+{
+  uint32_t start = start_bench();
+  for (int i=0; i<NB_ITER; i++)
+  {
+    pi_cl_barrier_wait(&barrier);
+  }
+  end_bench(BENCH_HW_BARRIER, start);
+}
+
+static void cluster_entry(void *arg)
+{
+  int nb_cores = pi_cl_cluster_nb_cores();
+  uint32_t core_mask = (1 << nb_cores) - 1;
+
+  errors = 0;
+  counter = 0;
+  inside = 0;
+
+  pi_cl_barrier_init(&barrier, core_mask, -1);
+  pi_cl_barrier_init(&odd_barrier, core_mask & 0xAAAAAAAA, -1);
+  pi_cl_ticket_lock_init(&ticket_lock);
+
+  pi_cl_team_fork(nb_cores, check_entry, NULL);
+
+  if (counter != nb_cores * NB_ITER)
+  {
+    printf("Ticket lock counter is %d instead of %d\n", counter, nb_cores * NB_ITER);
+    errors++;
+  }
+
+  pi_perf_conf(1 << PI_PERF_CYCLES);
+  pi_perf_reset();
+  pi_perf_start();
+
+  pi_cl_team_fork(nb_cores, bench_entry, NULL);
+
+  if (pi_cl_barrier_init(&barrier, core_mask, HW_BARRIER))
+  {
+    printf("Invalid HW barrier %d\n", HW_BARRIER);
+    errors++;
+    return;
+  }
+  pi_cl_team_fork(nb_cores, check_entry, NULL);
+  pi_cl_team_fork(nb_cores, hw_bench_entry, NULL);
+
+  pi_perf_stop();
+}
+
+static int test_entry()
+{
+  struct pi_device cluster_dev;
+  struct pi_cluster_conf conf;
+  struct pi_cluster_task cluster_task;
+
+  pi_cluster_conf_init(&conf);
+  pi_open_from_conf(&cluster_dev, &conf);
+  if (pi_cluster_open(&cluster_dev))
+    return -1;
+
+  pi_cluster_task(&cluster_task, cluster_entry, NULL);
+  pi_cluster_send_task_to_cl(&cluster_dev, &cluster_task);
+
+  pi_cluster_close(&cluster_dev);
+
+  for (int i=0; i<4; i++)
+  {
+    printf("%-12s: %d cycles\n", bench_names[i], cycles[i]);
+  }
+
+  if (errors)
+  {
+    printf("TEST FAILURE: %d errors\n", errors);
+    return -1;
+  }
+
+  printf("TEST SUCCESS\n");
+
+  return 0;
+}
+
+static void test_kickoff(void *arg)
+{
+  int ret = test_entry();
+  pmsis_exit(ret);
+}
+
+int main()
+{
+  return pmsis_kickoff((void *)test_kickoff);
+}
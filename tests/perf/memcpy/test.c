@@ -0,0 +1,232 @@
+/* 
+ * Copyright (C) 2019 GreenWaves Technologies
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD license.  See the LICENSE file for details.
+ */
+
+/*
+ * Cycles per byte of the libc memory routines, for each size class, on the
+ * fabric controller and on a cluster core. On the cluster, the copies
+ * between L2 and L1 above the threshold are done by the DMA.
+ * A copy bigger than a DMA command is also checked in both directions.
+ */
+
+#include "pmsis.h"
+#include "stdio.h"
+#include "string.h"
+
+#define NB_ITER   8
+#define MAX_SIZE  4096
+#define NB_SIZES  (sizeof(sizes) / sizeof(sizes[0]))
+// Bigger than the DMA commands of the memcpy, which are split in chunks
+// of 32KB. The cluster L1 is only 64KB, so this is the biggest copy
+// which leaves enough room for the stacks.
+#define LARGE_SIZE (40*1024 + 12)
+
+static const int sizes[] = { 4, 16, 64, 256, 1024, 4096 };
+
+static PI_L2 char l2_src[MAX_SIZE + 8];
+static PI_L2 char l2_dst[MAX_SIZE + 8];
+static PI_CL_L1 char l1_buffer[MAX_SIZE + 8];
+
+static int errors;
+
+enum {
+  BENCH_MEMCPY,
+  BENCH_MEMCPY_UNALIGNED,
+  BENCH_MEMSET,
+  BENCH_MEMMOVE,
+  BENCH_MEMMOVE_ALIGNED,
+  BENCH_MEMCPY_TO_L1,
+  BENCH_MEMCPY_FROM_L1,
+  NB_BENCH
+};
+
+static const char *bench_names[] = {
+  "memcpy", "memcpy unaligned", "memset", "memmove", "memmove aligned", "memcpy L2->L1", "memcpy L1->L2"
+};
+
+static void run_bench(int bench, int size, char *dst, char *src)
+{
+  switch (bench)
+  {
+    case BENCH_MEMCPY:
+    case BENCH_MEMCPY_TO_L1:
+    case BENCH_MEMCPY_FROM_L1:
+      memcpy(dst, src, size); break;
+    case BENCH_MEMCPY_UNALIGNED:
+      memcpy(dst + 1, src + 2, size); break;
+    case BENCH_MEMSET:
+      memset(dst, 0x5a, size); break;
+    case BENCH_MEMMOVE:
+      memmove(src + 3, src, size); break;
+    // Same alignment for both buffers, to go through the backward copy
+    // by words
+    case BENCH_MEMMOVE_ALIGNED:
+      memmove(src + 4, src, size); break;
+  }
+}
+
+static void check_bench(int bench, int size, char *dst, char *src)
+{
+  // The unaligned copy reads a few bytes after the size
+  for (int i=0; i<size+8; i++)
+  {
+    src[i] = i * 7;
+  }
+
+  run_bench(bench, size, dst, src);
+
+  for (int i=0; i<size; i++)
+  {
+    char expected, value;
+
+    switch (bench)
+    {
+      case BENCH_MEMCPY_UNALIGNED:
+        expected = (char)((i + 2) * 7); value = dst[i+1]; break;
+      case BENCH_MEMSET:
+        expected = 0x5a; value = dst[i]; break;
+      case BENCH_MEMMOVE:
+        expected = (char)(i * 7); value = src[i+3]; break;
+      case BENCH_MEMMOVE_ALIGNED:
+        expected = (char)(i * 7); value = src[i+4]; break;
+      default:
+        expected = (char)(i * 7); value = dst[i]; break;
+    }
+
+    if (value != expected)
+    {
+      printf("%s of %d bytes, error at index %d: expecting 0x%x, got 0x%x\n", bench_names[bench], size, i, expected, value);
+      errors++;
+      return;
+    }
+  }
+}
+
+static void bench_all(int first, int last)
+{
+  pi_perf_conf(1 << PI_PERF_CYCLES);
+
+  for (int bench=first; bench<=last; bench++)
+  {
+    char *dst = bench == BENCH_MEMCPY_TO_L1 ? l1_buffer : l2_dst;
+    char *src = bench == BENCH_MEMCPY_FROM_L1 ? l1_buffer : l2_src;
+
+    for (int i=0; i<NB_SIZES; i++)
+    {
+      int size = sizes[i];
+
+      check_bench(bench, size, dst, src);
+
+      pi_perf_reset();
+      pi_perf_start();
+
+      for (int j=0; j<NB_ITER; j++)
+      {
+        run_bench(bench, size, dst, src);
+      }
+
+      pi_perf_stop();
+
+      // In hundredths of cycles per byte
+      int cpb = pi_perf_read(PI_PERF_CYCLES) * 100 / (NB_ITER * size);
+
+      printf("[%s] %-16s %4d bytes: %d.%02d cycles/byte\n", pi_is_fc() ? "FC" : "CL", bench_names[bench], size, cpb / 100, cpb % 100);
+    }
+  }
+}
+
+static void check_large(char *l1, char *l2, int size)
+{
+  for (int i=0; i<size; i++)
+  {
+    l2[i] = i * 13;
+  }
+
+  memset(l1, 0, size);
+  memcpy(l1, l2, size);
+
+  for (int i=0; i<size; i++)
+  {
+    if (l1[i] != (char)(i * 13))
+    {
+      printf("memcpy L2->L1 of %d bytes, error at index %d: expecting 0x%x, got 0x%x\n", size, i, (char)(i * 13), l1[i]);
+      errors++;
+      return;
+    }
+  }
+
+  memset(l2, 0, size);
+  memcpy(l2, l1, size);
+
+  for (int i=0; i<size; i++)
+  {
+    if (l2[i] != (char)(i * 13))
+    {
+      printf("memcpy L1->L2 of %d bytes, error at index %d: expecting 0x%x, got 0x%x\n", size, i, (char)(i * 13), l2[i]);
+      errors++;
+      return;
+    }
+  }
+}
+
+static void cluster_entry(void *arg)
+{
+  char **large = (char **)arg;
+
+  bench_all(BENCH_MEMCPY, NB_BENCH - 1);
+  check_large(large[0], large[1], LARGE_SIZE);
+}
+
+static int test_entry()
+{
+  struct pi_device cluster_dev;
+  struct pi_cluster_conf conf;
+  struct pi_cluster_task cluster_task;
+
+  char *large[2];
+
+  bench_all(BENCH_MEMCPY, BENCH_MEMMOVE_ALIGNED);
+
+  pi_cluster_conf_init(&conf);
+  pi_open_from_conf(&cluster_dev, &conf);
+  if (pi_cluster_open(&cluster_dev))
+    return -1;
+
+  large[0] = pi_cl_l1_malloc(&cluster_dev, LARGE_SIZE);
+  large[1] = pi_l2_malloc(LARGE_SIZE);
+  if (large[0] == NULL || large[1] == NULL)
+    return -1;
+
+  pi_cluster_task(&cluster_task, cluster_entry, large);
+  pi_cluster_send_task_to_cl(&cluster_dev, &cluster_task);
+
+  pi_cl_l1_free(&cluster_dev, large[0], LARGE_SIZE);
+  pi_l2_free(large[1], LARGE_SIZE);
+
+  pi_cluster_close(&cluster_dev);
+
+  if (errors)
+  {
+    printf("TEST FAILURE: %d errors\n", errors);
+    return -1;
+  }
+
+  printf("TEST SUCCESS\n");
+
+  return 0;
+}
+
+static void test_kickoff(void *arg)
+{
+  int ret = test_entry();
+  pmsis_exit(ret);
+}
+
+int main()
+{
+  return pmsis_kickoff((void *)test_kickoff);
+}
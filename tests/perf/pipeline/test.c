@@ -0,0 +1,128 @@
+/* 
+ * Copyright (C) 2019 GreenWaves Technologies
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD license.  See the LICENSE file for details.
+ */
+
+#include "pmsis.h"
+#include "pipeline.h"
+#include "stdio.h"
+
+#ifndef NB_STAGES
+#define NB_STAGES 3
+#endif
+
+#define NB_TILES  16
+#define TILE_SIZE 1024
+
+static char ext_in[NB_TILES*TILE_SIZE];
+static char ext_out[NB_TILES*TILE_SIZE];
+static pi_cl_pipeline_t pipe;
+
+static int load(void *arg, int tile, void *buffer, pi_cl_dma_cmd_t *cmds)
+{
+  pi_cl_dma_cmd((uint32_t)&ext_in[tile*TILE_SIZE], (uint32_t)buffer, TILE_SIZE, PI_CL_DMA_DIR_EXT2LOC, &cmds[0]);
+  return 1;
+}
+
+static void compute_core(void *arg)
+{
+  char **buffers = (char **)arg;
+  int chunk = TILE_SIZE / pi_cl_team_nb_cores();
+  int first = pi_core_id() * chunk;
+
+  for (int i=first; i<first+chunk; i++)
+  {
+    buffers[1][i] = (char)(buffers[0][i] * 3);
+  }
+}
+
+static void compute(void *arg, int tile, void *in, void *out)
+{
+  void *buffers[2] = { in, out };
+  pi_cl_team_fork(pi_cl_cluster_nb_cores(), compute_core, buffers);
+}
+
+static int store(void *arg, int tile, void *buffer, pi_cl_dma_cmd_t *cmds)
+{
+  pi_cl_dma_cmd((uint32_t)&ext_out[tile*TILE_SIZE], (uint32_t)buffer, TILE_SIZE, PI_CL_DMA_DIR_LOC2EXT, &cmds[0]);
+  return 1;
+}
+
+static void cluster_entry(void *arg)
+{
+  pi_perf_conf(1 << PI_PERF_CYCLES);
+  pi_perf_reset();
+  pi_perf_start();
+
+  pi_cl_pipeline_run(&pipe);
+
+  pi_perf_stop();
+}
+
+static int test_entry()
+{
+  struct pi_device cluster_dev;
+  struct pi_cluster_conf conf;
+  struct pi_cluster_task cluster_task;
+  pi_cl_pipeline_conf_t pipe_conf;
+  pi_cl_pipeline_stats_t stats;
+
+  pi_cluster_conf_init(&conf);
+  pi_open_from_conf(&cluster_dev, &conf);
+  if (pi_cluster_open(&cluster_dev))
+    return -1;
+
+  for (int i=0; i<NB_TILES*TILE_SIZE; i++)
+  {
+    ext_in[i] = i;
+  }
+
+  pi_cl_pipeline_conf_init(&pipe_conf);
+  pipe_conf.nb_tiles = NB_TILES;
+  pipe_conf.nb_stages = NB_STAGES;
+  pipe_conf.in_size = TILE_SIZE;
+  pipe_conf.out_size = TILE_SIZE;
+  pipe_conf.load = load;
+  pipe_conf.compute = compute;
+  pipe_conf.store = store;
+  pipe_conf.stats = 1;
+
+  if (pi_cl_pipeline_open(&pipe, &cluster_dev, &pipe_conf))
+    return -1;
+
+  pi_cluster_task(&cluster_task, cluster_entry, NULL);
+  pi_cluster_send_task_to_cl(&cluster_dev, &cluster_task);
+
+  pi_cl_pipeline_get_stats(&pipe, &stats);
+  pi_cl_pipeline_close(&pipe);
+  pi_cluster_close(&cluster_dev);
+
+  printf("Stages: %d, total: %d cycles, compute: %d, load stalls: %d, store stalls: %d\n",
+    NB_STAGES, stats.total_cycles, stats.compute_cycles, stats.load_stall_cycles, stats.store_stall_cycles);
+
+  for (int i=0; i<NB_TILES*TILE_SIZE; i++)
+  {
+    if (ext_out[i] != (char)(i * 3)) {
+      printf("ERROR at index %d: expecting 0x%x, got 0x%x\n", i, (char)(i*3), ext_out[i]);
+      return -1;
+    }
+  }
+
+  printf("TEST SUCCESS\n");
+
+  return 0;
+}
+
+static void test_kickoff(void *arg)
+{
+  int ret = test_entry();
+  pmsis_exit(ret);
+}
+
+int main()
+{
+  return pmsis_kickoff((void *)test_kickoff);
+}
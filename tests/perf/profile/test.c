@@ -0,0 +1,110 @@
+/* 
+ * Copyright (C) 2019 GreenWaves Technologies
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms
+ * of the BSD license.  See the LICENSE file for details.
+ */
+
+/*
+ * Profiles a small vector kernel on all the cluster cores. The region
+ * collects more events than the core counters can count at once, so it is
+ * run enough times for each group of events, and then dumped from the FC.
+ */
+
+#include "pmsis.h"
+#include "profile.h"
+#include "stdio.h"
+
+#define NB_ELEM  1024
+#define NB_RUNS  16
+#define NB_WARMUP 2
+
+static PI_CL_L1 int vector[NB_ELEM];
+static PI_CL_L1 int result[ARCHI_CLUSTER_NB_PE];
+
+PI_CL_PROFILE_REGION(kernel_region, "kernel",
+  (1 << PI_PERF_INSTR) | (1 << PI_PERF_LD_STALL) | (1 << PI_PERF_IMISS) |
+  (1 << PI_PERF_LD) | (1 << PI_PERF_TCDM_CONT), NB_WARMUP);
+
+static void kernel(void *arg)
+{
+  int core_id = pi_core_id();
+  int chunk = NB_ELEM / pi_cl_cluster_nb_cores();
+
+  for (int run=0; run<NB_RUNS; run++)
+  {
+    pi_cl_profile_begin(&kernel_region);
+
+    int sum = 0;
+    for (int i=core_id*chunk; i<(core_id+1)*chunk; i++)
+    {
+      sum += vector[i];
+    }
+    result[core_id] = sum;
+
+    pi_cl_profile_end(&kernel_region);
+
+    pi_cl_team_barrier();
+  }
+}
+
+static void cluster_entry(void *arg)
+{
+  for (int i=0; i<NB_ELEM; i++)
+  {
+    vector[i] = i;
+  }
+
+  pi_cl_team_fork(pi_cl_cluster_nb_cores(), kernel, NULL);
+}
+
+static int test_entry()
+{
+  struct pi_device cluster_dev;
+  struct pi_cluster_conf conf;
+  struct pi_cluster_task cluster_task;
+  int errors = 0;
+
+  pi_cluster_conf_init(&conf);
+  pi_open_from_conf(&cluster_dev, &conf);
+  if (pi_cluster_open(&cluster_dev))
+    return -1;
+
+  pi_cluster_task(&cluster_task, cluster_entry, NULL);
+  pi_cluster_send_task_to_cl(&cluster_dev, &cluster_task);
+
+  pi_cluster_close(&cluster_dev);
+
+  pi_cl_profile_dump(&kernel_region);
+
+  for (int i=0; i<ARCHI_CLUSTER_NB_PE; i++)
+  {
+    if (kernel_region.runs[i] != 0 && kernel_region.runs[i] != NB_RUNS)
+    {
+      printf("Core %d did %d runs instead of %d\n", i, kernel_region.runs[i], NB_RUNS);
+      errors++;
+    }
+  }
+
+  if (errors)
+  {
+    printf("TEST FAILURE: %d errors\n", errors);
+    return -1;
+  }
+
+  printf("TEST SUCCESS\n");
+
+  return 0;
+}
+
+static void test_kickoff(void *arg)
+{
+  int ret = test_entry();
+  pmsis_exit(ret);
+}
+
+int main()
+{
+  return pmsis_kickoff((void *)test_kickoff);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Minimal replacement of pmsis.h so that the pulpos timing wheel can be
+ * compiled and checked natively on the host. The FC timer is simulated by the
+ * test, which moves the counter forward and calls the timer handler when the
+ * comparator is reached.
+ */
+
+#ifndef __HOST_PMSIS_H__
+#define __HOST_PMSIS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PI_FC_L1
+
+#define ARCHI_REF_CLOCK 32768
+#define ARCHI_HAS_FC 1
+#define ARCHI_FC_EVT_TIMER0_HI 11
+#define PULP_CHIP_FAMILY 0
+#define CHIP_USOC_V1 1
+
+struct pi_task_implem
+{
+    uint32_t time;
+    uint32_t period;
+    struct pi_task *timer_next;
+    struct pi_task **timer_pprev;
+    uint8_t queued;
+};
+
+typedef struct pi_task
+{
+    int id;
+    struct pi_task_implem implem;
+} pi_task_t;
+
+typedef struct { int dummy; } pos_cbsys_t;
+
+#define POS_CBSYS_POWEROFF 0
+#define POS_CBSYS_POWERON  1
+
+// Simulated FC timer, owned by the test
+extern uint32_t host_timer_count;
+extern uint32_t host_timer_cmp;
+extern int host_timer_irqen;
+
+#define TIMER_CFG_LO_ENABLE(val) ((val) << 0)
+#define TIMER_CFG_LO_RESET(val)  ((val) << 1)
+#define TIMER_CFG_LO_IRQEN(val)  ((val) << 2)
+#define TIMER_CFG_LO_CCFG(val)   ((val) << 7)
+
+static inline int timer_base_fc(int cid, int sub) { return 0; }
+static inline uint32_t timer_count_get(int base) { return host_timer_count; }
+static inline void timer_count_set(int base, uint32_t value) { host_timer_count = value; }
+static inline void timer_cmp_set(int base, uint32_t value) { host_timer_cmp = value; }
+
+static inline void timer_conf_set(int base, uint32_t value)
+{
+    if (value & TIMER_CFG_LO_RESET(1))
+        host_timer_count = 0;
+    host_timer_irqen = (value & TIMER_CFG_LO_IRQEN(1)) != 0;
+}
+
+static inline int hal_irq_disable() { return 0; }
+static inline void hal_irq_restore(int irq) {}
+static inline void pos_irq_clr(uint32_t mask) {}
+static inline void pos_irq_mask_set(uint32_t mask) {}
+static inline void pos_irq_set_handler(int irq, void (*handler)()) {}
+static inline void pos_cbsys_add(pos_cbsys_t *cbsys, int id, int (*cb)(void *), void *arg) {}
+
+static inline pi_task_t *pi_task_block(pi_task_t *task) { task->implem.timer_pprev = NULL; return task; }
+static inline void pi_task_wait_on(pi_task_t *task) {}
+
+// Called by the wheel when a task expires, implemented by the test
+void pos_task_push_locked(pi_task_t *task);
+
+void pos_time_init();
+void pos_time_timer_handler();
+void pi_task_push_delayed_us(pi_task_t *task, uint32_t us);
+void pi_task_push_periodic_us(pi_task_t *task, uint32_t period_us);
+int pi_task_cancel_delayed(pi_task_t *task);
+
+#endif
@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2019 GreenWaves Technologies
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host checks of the pulpos delayed tasks timing wheel.
+ *
+ * The FC timer is simulated with a 32 bits counter which is moved forward by
+ * the test, and the timer handler is called each time the counter reaches the
+ * comparator while the interrupt is enabled. Every task is compared against a
+ * brute-force model which knows the exact tick at which it must expire.
+ */
+
+#include "pmsis.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NB_TASKS 512
+#define NB_RANDOM_ITER 400000
+#define NB_WRAP_TASKS 64
+
+// The wheel rounds up to this number of us per tick with a 32768Hz ref clock
+#define US_PER_TICK (1000000 / ARCHI_REF_CLOCK)
+
+uint32_t host_timer_count;
+uint32_t host_timer_cmp;
+int host_timer_irqen;
+
+static uint64_t now;
+static uint64_t last_expired;
+static int errors;
+
+static pi_task_t tasks[NB_TASKS];
+static uint64_t expected[NB_TASKS];
+static int waiting[NB_TASKS];
+static int nb_expired;
+
+
+static uint32_t us_to_ticks(uint32_t us)
+{
+    return us / US_PER_TICK + 1;
+}
+
+
+void pos_task_push_locked(pi_task_t *task)
+{
+    int id = task->id;
+
+    nb_expired++;
+
+    if (!waiting[id])
+    {
+        printf("Task %d expired while not waiting (now %llu)\n", id, (unsigned long long)now);
+        errors++;
+        return;
+    }
+
+    if (now != expected[id])
+    {
+        printf("Task %d expired at %llu instead of %llu\n", id, (unsigned long long)now,
+            (unsigned long long)expected[id]);
+        errors++;
+    }
+
+    if (now < last_expired)
+    {
+        printf("Task %d expired out of order (now %llu, previous %llu)\n", id,
+            (unsigned long long)now, (unsigned long long)last_expired);
+        errors++;
+    }
+
+    last_expired = now;
+
+    if (task->implem.period)
+    {
+        // The test is the scheduler, so the periodic task has already been
+        // executed when the next occurrence comes.
+        expected[id] += task->implem.period;
+        task->implem.queued = 0;
+    }
+    else
+    {
+        waiting[id] = 0;
+    }
+}
+
+
+// Check that no task has been missed by the wheel
+static void check_missed()
+{
+    for (int i=0; i<NB_TASKS; i++)
+    {
+        if (waiting[i] && expected[i] < now)
+        {
+            printf("Task %d missed, expected at %llu (now %llu)\n", i,
+                (unsigned long long)expected[i], (unsigned long long)now);
+            errors++;
+            waiting[i] = 0;
+        }
+    }
+}
+
+
+// Move the simulated timer forward and raise the timer interrupt each time
+// the comparator is reached.
+static void advance(uint64_t ticks)
+{
+    while (1)
+    {
+        uint32_t to_cmp = host_timer_cmp - host_timer_count;
+
+        if (host_timer_irqen && to_cmp != 0 && to_cmp <= ticks)
+        {
+            host_timer_count += to_cmp;
+            now += to_cmp;
+            ticks -= to_cmp;
+            pos_time_timer_handler();
+            check_missed();
+        }
+        else
+        {
+            // Never move further than the comparator range to not hide wraps
+            uint32_t step = ticks > 0x7fffffff ? 0x7fffffff : ticks;
+            host_timer_count += step;
+            now += step;
+            ticks -= step;
+            if (ticks == 0)
+                break;
+        }
+    }
+}
+
+
+static void reset(uint32_t count)
+{
+    pos_time_init();
+    host_timer_count = count;
+    now = count;
+    last_expired = 0;
+    nb_expired = 0;
+
+    // The timer must not rely on the state of a task which is pushed
+    for (int i=0; i<NB_TASKS; i++)
+    {
+        memset(&tasks[i], 0xa5, sizeof(tasks[i]));
+        tasks[i].id = i;
+        waiting[i] = 0;
+    }
+}
+
+
+static void push_delayed(int id, uint32_t us)
+{
+    pi_task_push_delayed_us(&tasks[id], us);
+    expected[id] = now + us_to_ticks(us);
+    waiting[id] = 1;
+}
+
+
+static void push_periodic(int id, uint32_t us)
+{
+    pi_task_push_periodic_us(&tasks[id], us);
+    expected[id] = now + us_to_ticks(us);
+    waiting[id] = 1;
+}
+
+
+// Tasks pushed just before the 32 bits counter wraps and expiring before and
+// after it must expire in order and at their exact tick.
+static void check_wrap_ordering()
+{
+    reset(0xffffffff - 1000);
+
+    for (int i=0; i<NB_WRAP_TASKS; i++)
+    {
+        // Interleave tasks expiring before and after the wrap, and push them
+        // in reverse order of expiration
+        uint32_t us = (NB_WRAP_TASKS - i) * 997 * US_PER_TICK / 16;
+        push_delayed(i, us);
+    }
+
+    advance(0x100000000ULL);
+    check_missed();
+
+    if (nb_expired != NB_WRAP_TASKS)
+    {
+        printf("Only %d tasks expired across the wrap out of %d\n", nb_expired, NB_WRAP_TASKS);
+        errors++;
+    }
+
+    if (now >> 32 == 0)
+    {
+        printf("The counter did not wrap\n");
+        errors++;
+    }
+}
+
+
+// A periodic task whose interrupt is handled late expires once and then
+// skips the occurrences it missed.
+static void check_late_periodic()
+{
+    reset(0);
+
+    uint32_t period = us_to_ticks(1000);
+    push_periodic(0, 1000);
+    uint64_t first = expected[0];
+
+    // Handle the interrupt ten and a half periods late
+    uint64_t late = first + period * 10 + period / 2;
+    host_timer_count += late - now;
+    now = late;
+    expected[0] = now;
+    pos_time_timer_handler();
+
+    if (nb_expired != 1)
+    {
+        printf("Late periodic task expired %d times instead of once\n", nb_expired);
+        errors++;
+    }
+
+    expected[0] = first + period * 11;
+    advance(period * 3);
+    check_missed();
+
+    if (nb_expired != 4)
+    {
+        printf("Late periodic task expired %d times after catching up instead of 3\n", nb_expired - 1);
+        errors++;
+    }
+
+    if (pi_task_cancel_delayed(&tasks[0]))
+    {
+        printf("Failed to cancel the late periodic task\n");
+        errors++;
+    }
+    waiting[0] = 0;
+}
+
+
+// Random mix of delays from a few ticks to the full uint32 range in us,
+// periodic tasks and cancellations, going through many counter wraps.
+static void check_random()
+{
+    reset(0);
+    srand(1);
+
+    for (int i=0; i<NB_TASKS; i++)
+        pi_task_block(&tasks[i]);
+
+    for (int iter=0; iter<NB_RANDOM_ITER; iter++)
+    {
+        int id = rand() % NB_TASKS;
+        int op = rand() % 10;
+
+        if (op < 6 && !waiting[id])
+        {
+            uint32_t us = rand() % 4 == 0 ? (uint32_t)rand() * 3U : rand() % 200000;
+            push_delayed(id, us);
+        }
+        else if (op == 6 && !waiting[id] && id % 16 == 0)
+        {
+            push_periodic(id, 100000 + rand() % 1000000);
+        }
+        else if (op == 7 && waiting[id])
+        {
+            if (pi_task_cancel_delayed(&tasks[id]))
+            {
+                printf("Failed to cancel task %d\n", id);
+                errors++;
+            }
+            waiting[id] = 0;
+        }
+        else if (op == 8 && !waiting[id])
+        {
+            if (pi_task_cancel_delayed(&tasks[id]) == 0)
+            {
+                printf("Cancelled task %d while not waiting\n", id);
+                errors++;
+            }
+        }
+
+        uint64_t ticks = rand() % 500 + 1;
+        if (rand() % 100 == 0)
+            ticks = rand() % (1 << 25);
+
+        advance(ticks);
+    }
+
+    printf("Simulated %llu ticks, %llu counter wraps\n", (unsigned long long)now,
+        (unsigned long long)(now >> 32));
+}
+
+
+int main()
+{
+    check_wrap_ordering();
+    check_late_periodic();
+    check_random();
+
+    if (errors)
+        printf("Test failure (%d errors)\n", errors);
+    else
+        printf("Test success\n");
+
+    return errors != 0;
+}
@@ -8,6 +8,7 @@ class Telnet_proxy
 {
   public:
     void pop_byte(uint8_t*);
+    int pop_bytes(uint8_t *buffer, int size);
     void push_byte(uint8_t*);
     Telnet_proxy(int);
     
@@ -20,6 +20,13 @@
 
 #include "dpi/models.hpp"
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #ifdef __MAGICK__
 #include <Magick++.h>
 #endif
@@ -61,40 +68,65 @@ private:
 };
 
 
+// Frames are decoded on a separate thread into a ring of frame buffers which
+// already contain the bytes in the order they are sent on the CPI interface,
+// so that the pixel clock only has to index a byte array.
 class Camera_stream {
 
 public:
-  Camera_stream(Camera *top, string path, int color_mode);
-  bool fetch_image();
-  unsigned int get_pixel();
+  Camera_stream(Camera *top, string path, string format, int color_mode, int nb_buffers);
+  ~Camera_stream();
   void set_image_size(int width, int height);
+  void start();
+  void stop();
+  uint8_t *get_frame();
+  void release_frame();
+  int get_frame_size() { return this->frame_size; }
 
 private:
+  void decoder_task();
+  bool decode_frame(uint8_t *frame);
+  bool decode_image(uint8_t *frame);
+  bool decode_raw(uint8_t *frame);
+  void convert_line(uint8_t *dst, uint8_t *rgb, int line);
+
   Camera *top;
   string stream_path;
+  string format;
   int frame_index;
 #ifdef __MAGICK__
   Image image;
 #endif
+  FILE *raw_file;
   int width;
   int height;
-#ifdef __MAGICK__
-  PixelPacket *image_buffer;
-#endif
-  int current_pixel;
-  int nb_pixel;
   int color_mode;
+  int frame_size;
+
+  std::vector<uint8_t *> buffers;
+  std::vector<uint8_t> rgb_line;
+  int nb_buffers;
+  int read_index;
+  int write_index;
+  int nb_ready;
+  bool stopping;
+  string error;
+  std::thread *decoder_thread;
+  std::mutex mutex;
+  std::condition_variable cond;
 };
 
 
 class Camera : public Dpi_model
 {
   friend class Camera_i2c_slave;
+  friend class Camera_stream;
 
 public:
   Camera(js::config *config, void *handle);
 
   void start();
+  void stop();
 
   void i2c_tx_edge(int64_t timestamp, int scl, int sda);
 
@@ -116,17 +148,15 @@ private:
   int width;
   int height;
 
-  int nb_images;
-
   int color_mode;
   int pclk_value;
   int state;
   int cnt;
   int targetcnt;
-  int lineptr;
-  int colptr;
-  int bytesel;
-  int framesel;
+
+  uint8_t *frame;
+  int frame_pos;
+  int frame_size;
 
   int vsync;
   int href;
@@ -179,19 +209,31 @@ Camera::Camera(js::config *config, void *handle) : Dpi_model(config, handle)
   std::string color_mode = config->get_child_str("color-mode");
   if (color_mode == "raw")
     this->color_mode = COLOR_MODE_RAW;
+  else if (color_mode == "rgb565")
+    this->color_mode = COLOR_MODE_RGB565;
   else
     this->color_mode = COLOR_MODE_GRAY;
 
   this->width = 324;
   this->height = 244;
 
-  // Default color mode is 16bits RGB565
-  //color_mode = COLOR_MODE_RGB565;
   js::config *stream_config = config->get("image-stream");
   if (stream_config)
   {
     string stream_path = stream_config->get_str();
-    this->stream = new Camera_stream(this, stream_path.c_str(), this->color_mode);
+
+    // The stream is either a sequence of images (path containing %d) decoded
+    // with Magick, or a raw video file made of consecutive RGB888 frames.
+    string stream_format = config->get_child_str("image-stream-format");
+    if (stream_format == "")
+      stream_format = "images";
+
+    int nb_buffers = 4;
+    js::config *buffers_config = config->get("prefetch-frames");
+    if (buffers_config)
+      nb_buffers = buffers_config->get_int();
+
+    this->stream = new Camera_stream(this, stream_path, stream_format, this->color_mode, nb_buffers);
     this->stream->set_image_size(this->width, this->height);
   }
 
@@ -203,16 +245,28 @@ Camera::Camera(js::config *config, void *handle) : Dpi_model(config, handle)
 void Camera::start()
 {
   if (this->stream)
+  {
+    this->stream->start();
     create_periodic_handler(this->period/2, (void *)&Camera::dpi_task_stub, this);
+  }
 
   this->pclk_value = 0;
   this->state = STATE_INIT;
+  this->frame = NULL;
+  this->frame_pos = 0;
+  this->frame_size = 0;
 
   this->vsync = 0;
   this->href = 0;
   this->data = 0;
 }
 
+void Camera::stop()
+{
+  if (this->stream)
+    this->stream->stop();
+}
+
 void Camera::dpi_task_stub(Camera *_this)
 {
   _this->clock_gen();
@@ -230,8 +284,6 @@ void Camera::clock_gen()
         this->cnt = 0;
         this->targetcnt = 3*TLINE;
         this->state = STATE_SOF;
-        this->bytesel = 0;
-        this->framesel = 0;
         break;
 
       case STATE_SOF:
@@ -253,95 +305,35 @@ void Camera::clock_gen()
         this->cnt++;
         if (this->cnt == this->targetcnt) {
           this->state = STATE_SEND_LINE;
-          this->lineptr = 0;
-          this->colptr = 0;
+          this->frame_pos = 0;
+          if (this->stream)
+          {
+            this->frame = this->stream->get_frame();
+            this->frame_size = this->stream->get_frame_size();
+          }
         }
         break;
 
       case STATE_SEND_LINE: {
         this->href = 1;
 
-        if (this->color_mode == COLOR_MODE_GRAY)
-        {
-          this->bytesel = 1;
-          if (stream)
-          {
-            data = stream->get_pixel();
-          }
-
-          //if (stimImg != NULL) {
-          //  pixel = ((uint32_t *)stimImg[framesel])[(lineptr*width)+2*colptr+offset];
-          //}
-
-          //data = 0.2989 * ((pixel >> 16) & 0xff) +
-          //       0.5870 * ((pixel >>  8) & 0xff) +
-          //       0.1140 * ((pixel >>  0) & 0xff);
-        }
-        else if (this->color_mode == COLOR_MODE_RAW)
-        {
-          this->bytesel = 1;
-
-          int pixel  = 0;
-
-          if (stream)
-          {
-            pixel = stream->get_pixel();
-          }
-
-          // Raw bayer mode. Line 0: BGBG, Line 1: GRGR
-          int line = this->width - this->lineptr -1;
-          if (line & 1)
-          {
-            if (this->colptr & 1)
-              this->data = (pixel >> 16) & 0xff;
-            else
-              this->data = (pixel >> 8) & 0xff;
-          }
-          else
-          {
-            if (this->colptr & 1)
-              this->data = (pixel >> 8) & 0xff;
-            else
-              this->data = (pixel >> 0) & 0xff;
-          }
-        }
-        else
-        {
-          int pixel  = 0;
+        // The frame has been converted by the decoder to the bytes sent on
+        // the interface (1 byte per pixel for gray and raw bayer, 2 bytes per
+        // pixel for RGB565), so we just need to send them in order.
+        this->data = this->frame ? this->frame[this->frame_pos] : 0;
+        this->frame_pos++;
 
-          if (stream)
+        if (this->frame_pos >= this->frame_size) {
+          if (this->frame)
           {
-            pixel = stream->get_pixel();
+            this->stream->release_frame();
+            this->frame = NULL;
           }
-
-          //if (stimImg != NULL) {
-          //  ((uint32_t *)stimImg[framesel])[(lineptr*width)+colptr];
-          //}
-
-          // Coded with RGB565
-          if (bytesel) this->data = (((pixel >> 10) & 0x7) << 5) | (((pixel >> 3) & 0x1f) << 0);
-          else         this->data = (((pixel >> 19) & 0x1f) << 3) | (((pixel >> 13) & 0x7) << 0);
+          this->state = STATE_WAIT_EOF;
+          this->cnt = 0;
+          this->targetcnt = 10*TLINE;
         }
 
-        if (this->bytesel == 1) {
-          this->bytesel = 0;
-          if(this->colptr == (this->width-1)) {
-            this->colptr = 0;
-            if(this->lineptr == (this->height-1)) {
-              this->state = STATE_WAIT_EOF;
-              this->cnt = 0;
-              this->targetcnt = 10*TLINE;
-              this->lineptr = 0;
-            } else {
-              this->lineptr = this->lineptr + 1;
-            }
-          } else {
-            this->colptr = this->colptr + 1;
-          }
-
-        } else {
-          this->bytesel = 1;
-        }
         this->trace_msg(this->trace, 4, "State SEND_LINE (data: 0x%x)", data);
         break;
       }
@@ -355,8 +347,6 @@ void Camera::clock_gen()
           this->state = STATE_SOF;
           this->cnt = 0;
           this->targetcnt = 3*TLINE;
-          this->framesel++;
-          if (this->framesel == this->nb_images) this->framesel = 0;
         }
         break;
     }
@@ -376,47 +366,202 @@ void Camera::dpi_task()
 }
 
 
-Camera_stream::Camera_stream(Camera *top, string path, int color_mode)
- : top(top), stream_path(path), frame_index(0), current_pixel(0), nb_pixel(0), color_mode(color_mode)
+Camera_stream::Camera_stream(Camera *top, string path, string format, int color_mode, int nb_buffers)
+ : top(top), stream_path(path), format(format), frame_index(0), raw_file(NULL), width(0), height(0),
+   color_mode(color_mode), frame_size(0), nb_buffers(nb_buffers), read_index(0), write_index(0),
+   nb_ready(0), stopping(false), decoder_thread(NULL)
 {
-#ifdef __MAGICK__
-  image_buffer = NULL;
-#endif
+  if (this->nb_buffers < 2)
+    this->nb_buffers = 2;
+}
+
+Camera_stream::~Camera_stream()
+{
+  this->stop();
+
+  for (uint8_t *buffer: this->buffers)
+    delete[] buffer;
+
+  if (this->raw_file)
+    fclose(this->raw_file);
 }
 
 void Camera_stream::set_image_size(int width, int height)
 {
   this->width = width;
   this->height = height;
-  nb_pixel = width * height;
+
+  int bytes_per_pixel = this->color_mode == COLOR_MODE_RGB565 ? 2 : 1;
+  this->frame_size = width * height * bytes_per_pixel;
+  this->rgb_line.resize(width * 3);
 }
 
-bool Camera_stream::fetch_image()
+void Camera_stream::start()
 {
+  if (this->decoder_thread)
+    return;
+
+  for (int i=0; i<this->nb_buffers; i++)
+    this->buffers.push_back(new uint8_t[this->frame_size]);
+
+  if (this->format == "rgb24")
+  {
+    this->raw_file = fopen(this->stream_path.c_str(), "rb");
+    if (this->raw_file == NULL)
+    {
+      this->top->fatal("Unable to open camera stream (path: %s, error: %s)\n", this->stream_path.c_str(), strerror(errno));
+      return;
+    }
+  }
+
+  this->decoder_thread = new std::thread(&Camera_stream::decoder_task, this);
+}
+
+void Camera_stream::stop()
+{
+  if (this->decoder_thread == NULL)
+    return;
+
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->stopping = true;
+    this->cond.notify_all();
+  }
+
+  this->decoder_thread->join();
+  delete this->decoder_thread;
+  this->decoder_thread = NULL;
+}
+
+void Camera_stream::decoder_task()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  while(!this->stopping)
+  {
+    if (this->nb_ready == this->nb_buffers)
+    {
+      this->cond.wait(lock);
+      continue;
+    }
+
+    // The buffer at write_index is owned by the decoder until it is marked
+    // as ready, so the decoding itself can be done without the lock.
+    uint8_t *frame = this->buffers[this->write_index];
+    lock.unlock();
+    bool ok = this->decode_frame(frame);
+    lock.lock();
+
+    if (!ok)
+    {
+      this->stopping = true;
+      this->cond.notify_all();
+      break;
+    }
+
+    this->write_index = (this->write_index + 1) % this->nb_buffers;
+    this->nb_ready++;
+    this->cond.notify_all();
+  }
+}
+
+uint8_t *Camera_stream::get_frame()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+
+  // This only blocks the simulation if the decoder could not keep up with
+  // the pixel clock.
+  while (this->nb_ready == 0 && this->error == "" && !this->stopping)
+    this->cond.wait(lock);
+
+  if (this->error != "")
+  {
+    lock.unlock();
+    this->top->fatal("%s\n", this->error.c_str());
+    return NULL;
+  }
+
+  if (this->nb_ready == 0)
+    return NULL;
+
+  return this->buffers[this->read_index];
+}
+
+void Camera_stream::release_frame()
+{
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->read_index = (this->read_index + 1) % this->nb_buffers;
+  this->nb_ready--;
+  this->cond.notify_all();
+}
+
+bool Camera_stream::decode_frame(uint8_t *frame)
+{
+  if (this->format == "rgb24")
+    return this->decode_raw(frame);
+  else
+    return this->decode_image(frame);
+}
+
+bool Camera_stream::decode_raw(uint8_t *frame)
+{
+  int line_size = this->width * 3;
+  uint8_t *frame_start = frame;
+  bool rewound = false;
+
+  for (int line=0; line<this->height; line++)
+  {
+    if (fread(this->rgb_line.data(), 1, line_size, this->raw_file) != (size_t)line_size)
+    {
+      // Loop over the video, unless it does not even contain one frame.
+      // A trailing partial frame is dropped and the frame is restarted
+      // from the first one.
+      if (rewound)
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->error = "Camera stream does not contain a full frame (path: " + this->stream_path + ")";
+        return false;
+      }
+
+      rewound = true;
+      fseek(this->raw_file, 0, SEEK_SET);
+      frame = frame_start;
+      line = -1;
+      continue;
+    }
+
+    this->convert_line(frame, this->rgb_line.data(), line);
+    frame += this->frame_size / this->height;
+  }
+
+  return true;
+}
+
+bool Camera_stream::decode_image(uint8_t *frame)
+{
+#ifdef __MAGICK__
   char path[strlen(stream_path.c_str()) + 100];
   while(1)
   {
     sprintf(path, stream_path.c_str(), frame_index);
 
-#ifdef __MAGICK__
     try {
       image.read(path);
       break;
     }
     catch( Exception &error_ ) {
       if (frame_index == 0) {
-        throw;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->error = string("Unable to read camera image: ") + error_.what();
+        return false;
       }
     }
-#endif
 
     frame_index = 0;
   }
 
-  //dpi_print(top->handle, ("Opened image (path: " + string(path) + ")").c_str());
   frame_index++;
 
-#ifdef __MAGICK__
   image.extent(Geometry(width, height));
 
   if (color_mode == COLOR_MODE_GRAY)
@@ -426,41 +571,65 @@ bool Camera_stream::fetch_image()
     image.quantize( );
   }
 
+  const PixelPacket *pixels = image.getConstPixels(0, 0, width, height);
+  unsigned int shift = (sizeof(pixels->red) - 1)*8;
+
+  for (int line=0; line<this->height; line++)
+  {
+    uint8_t *rgb = this->rgb_line.data();
+    for (int i=0; i<this->width; i++)
+    {
+      const PixelPacket *pixel = &pixels[line*this->width + i];
+      rgb[i*3 + 0] = pixel->red >> shift;
+      rgb[i*3 + 1] = pixel->green >> shift;
+      rgb[i*3 + 2] = pixel->blue >> shift;
+    }
 
-  image_buffer = (PixelPacket*) image.getPixels(0, 0, width, height);
+    this->convert_line(frame, rgb, line);
+    frame += this->frame_size / this->height;
+  }
+#else
+  memset(frame, 0, this->frame_size);
 #endif
 
   return true;
 }
 
-unsigned int Camera_stream::get_pixel()
+void Camera_stream::convert_line(uint8_t *dst, uint8_t *rgb, int line)
 {
-#ifdef __MAGICK__
-  if (image_buffer == NULL) fetch_image();
-
-  PixelPacket *pixel = &image_buffer[current_pixel];
-  current_pixel++;
-  if (current_pixel == nb_pixel)
+  if (this->color_mode == COLOR_MODE_GRAY)
   {
-    current_pixel = 0;
-    image_buffer = NULL;
+    for (int i=0; i<this->width; i++)
+    {
+      unsigned int red = rgb[i*3], green = rgb[i*3+1], blue = rgb[i*3+2];
+      dst[i] = (77*red + 150*green + 29*blue) >> 8;
+    }
   }
-
-  unsigned int shift = (sizeof(pixel->red) - 1)*8;
-  if (color_mode == COLOR_MODE_GRAY)
+  else if (this->color_mode == COLOR_MODE_RAW)
   {
-    return pixel->red >> shift;
+    // Raw bayer mode. Line 0: BGBG, Line 1: GRGR
+    int bayer_line = this->width - line - 1;
+    for (int i=0; i<this->width; i++)
+    {
+      int component;
+      if (bayer_line & 1)
+        component = (i & 1) ? 0 : 1;
+      else
+        component = (i & 1) ? 1 : 2;
+
+      dst[i] = rgb[i*3 + component];
+    }
   }
   else
   {
-    unsigned char red = pixel->red >> shift;
-    unsigned char green = pixel->green >> shift;
-    unsigned char blue = pixel->blue >> shift;
-    return (red << 16) | (green << 8) | blue;
+    // Coded with RGB565, high byte first
+    for (int i=0; i<this->width; i++)
+    {
+      unsigned int red = rgb[i*3], green = rgb[i*3+1], blue = rgb[i*3+2];
+      dst[i*2 + 0] = (red & 0xf8) | (green >> 5);
+      dst[i*2 + 1] = ((green << 3) & 0xe0) | (blue >> 3);
+    }
   }
-#else
-  return 0;
-#endif
 }
 
 
@@ -20,6 +20,7 @@
 
 #include "dpi/models.hpp"
 #include <stdint.h>
+#include <vector>
 #ifdef USE_SNDFILE
 #include <sndfile.hh>
 #endif
@@ -90,28 +91,52 @@ class Stim {
 
 public:
   virtual long long getData(int64_t timestamp) = 0;
+  virtual void getBlock(int64_t timestamp, int64_t step, int nbSamples, long long *samples);
+  // Remember the current position, so that the stimuli can be rewound to it
+  virtual void mark() {}
+  virtual void rewind() {}
 
 };
 
 class Stim_txt : public Stim {
 
 public:
-  Stim_txt(Microphone *top, void *handle, std::string file, int width, int freq, bool raw=false, bool useLibsnd=false);
+  Stim_txt(Microphone *top, void *handle, std::string file, int width, int freq, bool raw=false, bool useLibsnd=false, int channel=0);
   long long getData(int64_t timestamp);
+  void getBlock(int64_t timestamp, int64_t step, int nbSamples, long long *samples);
+  void mark();
+  void rewind();
   long long getDataFromFile();
 
 private:
+  void fillBlock();
+  inline void advance(int64_t timestamp);
+
   Microphone *top;
   int width;
   FILE *stimFile;
   std::string filePath;
-  int period;
+  int64_t period;
   int64_t lastDataTime;
   long long lastData;
   int64_t nextDataTime;
   long long nextData;
   bool raw;
   bool useLibsnd;
+  int channel;
+  int nbChannels;
+  // Samples are read from the file by blocks to amortize the file accesses
+  std::vector<long long> block;
+  std::vector<int32_t> fileBlock;
+  size_t blockPos;
+  // Samples read from the file since the mark, read again after a rewind
+  bool marked;
+  std::vector<long long> replay;
+  size_t replayPos;
+  int64_t markLastDataTime;
+  long long markLastData;
+  int64_t markNextDataTime;
+  long long markNextData;
 #ifdef USE_SNDFILE
   SndfileHandle sndfile;
 #endif
@@ -121,26 +146,57 @@ private:
 class I2s_mic_channel {
 
 public:
-  I2s_mic_channel(int id, Microphone *top, void *handle, int width, std::string stimFile, bool pdm, int freq);
+  I2s_mic_channel(int id, Microphone *top, void *handle, int width, std::string stimFile, bool pdm, int freq, int stimChannel=0, int pdmChunk=4096);
   int popData(int64_t timestamp);
   void clrData(int64_t timestamp);
 
 private:
+  void pdmModulate(int64_t timestamp, int64_t step);
+  void pdmDiscard();
+
   Microphone *top;
-  bool pdm;
-  bool mic;
   int width;
   int pendingBits;
   Stim *stim;
+  bool pdm;
+  bool mic;
   unsigned long long currentValue;
   long long pdmError;
   int id;
+
+  // The PDM bitstream is computed by chunks, assuming the PDM clock is
+  // regular. The chunk is discarded as soon as an edge does not arrive at
+  // the expected time.
+  std::vector<long long> pdmSamples;
+  std::vector<uint8_t> pdmBits;
+  // Modulator error at the beginning of the chunk
+  long long pdmChunkError;
+  size_t pdmPos;
+  int64_t pdmStart;
+  int64_t pdmStep;
+  int64_t pdmLastTimestamp;
 };
 
 
 
-Stim_txt::Stim_txt(Microphone *top, void *handle, std::string file, int width, int freq, bool raw, bool useLibsnd)
-: top(top), width(width), filePath(file), raw(raw), useLibsnd(useLibsnd)
+#define STIM_BLOCK_SIZE 4096
+
+static inline int getSignedValue(unsigned long long val, int bits)
+{
+  return ((int)val) << (64-bits) >> (64-bits);
+}
+
+void Stim::getBlock(int64_t timestamp, int64_t step, int nbSamples, long long *samples)
+{
+  for (int i=0; i<nbSamples; i++)
+  {
+    samples[i] = this->getData(timestamp);
+    timestamp += step;
+  }
+}
+
+Stim_txt::Stim_txt(Microphone *top, void *handle, std::string file, int width, int freq, bool raw, bool useLibsnd, int channel)
+: top(top), width(width), stimFile(NULL), filePath(file), raw(raw), useLibsnd(useLibsnd), channel(channel), nbChannels(1), blockPos(0)
 {
   if (useLibsnd) {
 
@@ -149,6 +205,13 @@ Stim_txt::Stim_txt(Microphone *top, void *handle, std::string file, int width, i
     unsigned int pcm_width = width == 16 ? SF_FORMAT_PCM_16 : SF_FORMAT_PCM_32;
     sndfile = SndfileHandle (file, SFM_READ, SF_FORMAT_WAV | pcm_width) ;
     freq = sndfile.samplerate ();
+    this->nbChannels = sndfile.channels();
+
+    if (this->channel >= this->nbChannels)
+    {
+      top->fatal("Stimuli file does not have enough channels (file: %s, channel: %d, nb_channels: %d)\n", file.c_str(), channel, this->nbChannels);
+      return;
+    }
 
 #else
 
@@ -161,6 +224,26 @@ Stim_txt::Stim_txt(Microphone *top, void *handle, std::string file, int width, i
     stimFile = fopen(file.c_str(), "r");
     if (stimFile == NULL) {
       this->top->fatal("\033[1m\033[31mFailed to open stimuli file\033[0m: %s: %s", file.c_str(), strerror(errno));
+      return;
+    }
+
+    if (!raw)
+    {
+      // Text files are small, just parse them once
+      char *line = NULL;
+      size_t len = 0;
+      while(::getline(&line, &len, stimFile) != -1) {
+        unsigned long long data = strtol(line, NULL, 16);
+        this->block.push_back(getSignedValue(data, width));
+      }
+      free(line);
+      fclose(stimFile);
+      stimFile = NULL;
+
+      if (this->block.size() == 0) {
+        this->top->fatal("\033[1m\033[31mEmpty stimuli file\033[0m: %s", file.c_str());
+        return;
+      }
     }
   }
   if (freq) period = 1000000000000UL / freq;
@@ -168,71 +251,128 @@ Stim_txt::Stim_txt(Microphone *top, void *handle, std::string file, int width, i
 
   lastDataTime = -1;
   nextDataTime = -1;
+  marked = false;
+  replayPos = 0;
 }
 
-static inline int getSignedValue(unsigned long long val, int bits)
+void Stim_txt::fillBlock()
 {
-  return ((int)val) << (64-bits) >> (64-bits);
-}
+  this->blockPos = 0;
 
-long long Stim_txt::getDataFromFile()
-{
   if (useLibsnd) {
 
 #ifdef USE_SNDFILE
 
-    int32_t result;
-    if (this->width <= 16)
-    {
-      int16_t sample;
-      sndfile.read (&sample, 1);
-      result = (int32_t)sample;
-    }
-    else if (this->width <= 32)
+    // Frames are interleaved, read a block of them and keep our channel
+    this->fileBlock.resize(STIM_BLOCK_SIZE * this->nbChannels);
+    this->block.resize(STIM_BLOCK_SIZE);
+
+    sf_count_t nbFrames;
+    while(1)
     {
-      int32_t sample;
-      sndfile.read (&sample, 1);
-      result = (int32_t)sample;
+      if (this->width <= 16)
+      {
+        int16_t *samples = (int16_t *)this->fileBlock.data();
+        nbFrames = sndfile.readf(samples, STIM_BLOCK_SIZE);
+        for (int i=0; i<nbFrames; i++)
+          this->block[i] = samples[i*this->nbChannels + this->channel];
+      }
+      else
+      {
+        int32_t *samples = this->fileBlock.data();
+        nbFrames = sndfile.readf(samples, STIM_BLOCK_SIZE);
+        for (int i=0; i<nbFrames; i++)
+          this->block[i] = samples[i*this->nbChannels + this->channel];
+      }
+
+      if (nbFrames > 0)
+        break;
+
+      if (sndfile.seek(0, SEEK_SET) != 0 || sndfile.frames() == 0)
+      {
+        this->block[0] = 0;
+        nbFrames = 1;
+        break;
+      }
     }
 
-    return result;
+    this->block.resize(nbFrames);
+
 #else
-    return 0;
+    this->block.assign(1, 0);
 #endif
 
   } else if (raw) {
-    unsigned long long data = 0;
-    while(fread((void *)&data, 2, 1, stimFile) != 1)
+    int16_t samples[STIM_BLOCK_SIZE];
+    size_t nbSamples;
+    int retry = 0;
+    while((nbSamples = fread((void *)samples, 2, STIM_BLOCK_SIZE, stimFile)) == 0)
     {
       fclose(stimFile);
-      stimFile = fopen(filePath.c_str(), "r");    
+      stimFile = fopen(filePath.c_str(), "r");
+      if (stimFile == NULL || retry++)
+      {
+        this->top->fatal("\033[1m\033[31mFailed to read stimuli file\033[0m: %s", filePath.c_str());
+        return;
+      }
     }
 
-    long long result = getSignedValue(data, width);
+    this->block.resize(nbSamples);
+    for (size_t i=0; i<nbSamples; i++)
+      this->block[i] = getSignedValue((uint16_t)samples[i], width);
+  }
+  // Text files are fully loaded, just loop over them
+}
 
-    this->top->trace_msg(this->top->trace, 4, "Got new sample1 (value: 0x%x)", result);
-    return result;
-  } else {
-    char *line = NULL;
-    size_t len = 0;
-    while(::getline(&line, &len, stimFile) == -1) {
-      fclose(stimFile);
-      stimFile = fopen(filePath.c_str(), "r");    
-    }
-  
-    unsigned long long data = strtol(line, NULL, 16);
-    long long result = getSignedValue(data, width);
+long long Stim_txt::getDataFromFile()
+{
+  if (this->replayPos < this->replay.size())
+    return this->replay[this->replayPos++];
 
-    this->top->trace_msg(this->top->trace, 4, "Got new sample2 (value: 0x%x)", result);
-  
-    return result;
+  if (this->blockPos >= this->block.size())
+    this->fillBlock();
+
+  long long result = this->block[this->blockPos++];
+
+  this->top->trace_msg(this->top->trace, 4, "Got new sample (value: 0x%x)", result);
+
+  if (this->marked)
+  {
+    this->replay.push_back(result);
+    this->replayPos++;
   }
+
+  return result;
 }
 
-long long Stim_txt::getData(int64_t timestamp)
+void Stim_txt::mark()
 {
-  if (period == 0) return getDataFromFile();
+  // The samples read before are not needed anymore, only keep the ones
+  // which were read again after a rewind but not consumed yet
+  this->replay.erase(this->replay.begin(), this->replay.begin() + this->replayPos);
+  this->replayPos = 0;
+  this->marked = true;
+
+  this->markLastDataTime = this->lastDataTime;
+  this->markLastData = this->lastData;
+  this->markNextDataTime = this->nextDataTime;
+  this->markNextData = this->nextData;
+}
 
+void Stim_txt::rewind()
+{
+  if (!this->marked)
+    return;
+
+  this->replayPos = 0;
+  this->lastDataTime = this->markLastDataTime;
+  this->lastData = this->markLastData;
+  this->nextDataTime = this->markNextDataTime;
+  this->nextData = this->markNextData;
+}
+
+inline void Stim_txt::advance(int64_t timestamp)
+{
   if (lastDataTime == -1) {
     lastData = getDataFromFile();
     lastDataTime = timestamp;
@@ -250,6 +390,13 @@ long long Stim_txt::getData(int64_t timestamp)
     nextDataTime = lastDataTime + period;
     nextData = getDataFromFile();
   }
+}
+
+long long Stim_txt::getData(int64_t timestamp)
+{
+  if (period == 0) return getDataFromFile();
+
+  this->advance(timestamp);
 
   // Now do the interpolation between the 2 known samples
   float coeff = (float)(timestamp - lastDataTime) / (nextDataTime - lastDataTime);
@@ -264,10 +411,50 @@ long long Stim_txt::getData(int64_t timestamp)
   return (int)value;
 }
 
+void Stim_txt::getBlock(int64_t timestamp, int64_t step, int nbSamples, long long *samples)
+{
+  if (period == 0)
+  {
+    for (int i=0; i<nbSamples; i++)
+      samples[i] = getDataFromFile();
+    return;
+  }
 
-I2s_mic_channel::I2s_mic_channel(int id, Microphone *top, void *handle, int width, std::string stimFile, bool pdm, int freq)
- : width(width), pendingBits(0), stim(NULL), pdm(pdm), pdmError(0), id(id)
+  // Resample the stimuli to the consumer rate. The interpolation is done
+  // one input window at a time so that the inner loop has no dependency
+  // between iterations.
+  int i = 0;
+  while (i < nbSamples)
+  {
+    this->advance(timestamp);
+
+    int64_t windowEnd = nextDataTime;
+    float slope = (float)(nextData - lastData) / (nextDataTime - lastDataTime);
+    float base = (float)lastData + slope * (timestamp - lastDataTime);
+    float fstep = slope * step;
+
+    int count = (windowEnd - timestamp + step - 1) / step;
+    if (count > nbSamples - i)
+      count = nbSamples - i;
+
+    for (int j=0; j<count; j++)
+      samples[i + j] = (int)(base + fstep * j);
+
+    i += count;
+    timestamp += count * step;
+  }
+}
+I2s_mic_channel::I2s_mic_channel(int id, Microphone *top, void *handle, int width, std::string stimFile, bool pdm, int freq, int stimChannel, int pdmChunk)
+ : top(top), width(width), pendingBits(0), stim(NULL), pdm(pdm), pdmError(0), id(id),
+   pdmChunkError(0), pdmPos(0), pdmStart(-1), pdmStep(0), pdmLastTimestamp(-1)
 {
+  if (pdm)
+  {
+    this->pdmSamples.resize(pdmChunk);
+    this->pdmBits.resize(pdmChunk);
+    this->pdmPos = pdmChunk;
+  }
+
   if (stimFile != "") {
 
     char *ext = rindex((char *)stimFile.c_str(), '.');
@@ -282,7 +469,7 @@ I2s_mic_channel::I2s_mic_channel(int id, Microphone *top, void *handle, int widt
     } else if (strcmp(ext, ".raw") == 0) {
       stim = new Stim_txt(top, handle, stimFile, width, freq, true);
     } else if (strcmp(ext, ".wav") == 0) {
-      stim = new Stim_txt(top, handle, stimFile, width, freq, false, true);
+      stim = new Stim_txt(top, handle, stimFile, width, freq, false, true, stimChannel);
     } else {
       top->print("\033[1m\033[31mUnsupported file extension\033[0m  : %s", stimFile.c_str());
     }
@@ -295,6 +482,62 @@ void I2s_mic_channel::clrData(int64_t timestamp)
   pendingBits = 0;
 }
 
+void I2s_mic_channel::pdmModulate(int64_t timestamp, int64_t step)
+{
+  int nbBits = this->pdmBits.size();
+  long long *samples = this->pdmSamples.data();
+  uint8_t *bits = this->pdmBits.data();
+
+  // The chunk may be discarded before it is fully consumed, remember where
+  // it started to go back to the last consumed bit
+  this->stim->mark();
+  this->pdmChunkError = this->pdmError;
+
+  this->stim->getBlock(timestamp, step, nbBits, samples);
+
+  long long offset = 1LL << (width - 1);
+  long long maxVal = (1LL << width) - 1;
+
+  for (int i=0; i<nbBits; i++)
+    samples[i] += offset;
+
+  // First-order sigma-delta, the error feedback is the only serial part
+  long long error = this->pdmError;
+  for (int i=0; i<nbBits; i++)
+  {
+    error += samples[i];
+    int bit = error >= maxVal;
+    error -= bit ? maxVal : 0;
+    bits[i] = bit;
+  }
+  this->pdmError = error;
+
+  this->pdmPos = 0;
+  this->pdmStart = timestamp;
+  this->pdmStep = step;
+}
+
+// The stimuli and the modulator went through the whole chunk, bring them
+// back to the last consumed bit
+void I2s_mic_channel::pdmDiscard()
+{
+  if (this->pdmPos >= this->pdmBits.size())
+    return;
+
+  this->stim->rewind();
+
+  long long maxVal = (1LL << width) - 1;
+  long long error = this->pdmChunkError;
+  for (size_t i=0; i<this->pdmPos; i++)
+  {
+    error += this->pdmSamples[i];
+    error -= error >= maxVal ? maxVal : 0;
+  }
+  this->pdmError = error;
+
+  this->pdmPos = this->pdmBits.size();
+}
+
 int I2s_mic_channel::popData(int64_t timestamp)
 {
 
@@ -304,6 +547,32 @@ int I2s_mic_channel::popData(int64_t timestamp)
 
     // PDM mode, only transmit one modulated bit per sample
 
+    if (this->pdmPos < this->pdmBits.size())
+    {
+      int64_t expected = this->pdmStart + this->pdmStep * this->pdmPos;
+      int64_t delta = timestamp - expected;
+      if (delta < 0) delta = -delta;
+
+      if (delta <= this->pdmStep / 4)
+      {
+        this->pdmLastTimestamp = timestamp;
+        return this->pdmBits[this->pdmPos++];
+      }
+    }
+
+    this->pdmDiscard();
+
+    // Either the chunk is over or the clock changed, compute a new chunk
+    // using the period between the last 2 edges.
+    if (this->pdmLastTimestamp != -1 && timestamp > this->pdmLastTimestamp)
+    {
+      this->pdmModulate(timestamp, timestamp - this->pdmLastTimestamp);
+      this->pdmLastTimestamp = timestamp;
+      return this->pdmBits[this->pdmPos++];
+    }
+
+    this->pdmLastTimestamp = timestamp;
+
     long long sample = stim->getData(timestamp);
     unsigned long long value = sample + (1 << (width - 1));
 
@@ -494,6 +763,15 @@ flush_data(-1)
   this->freq = config->get_child_int("frequency");
   this->chain_size = config->get_child_int("chain_size");
 
+  // A single multi-channel WAV file can be used instead of one file per
+  // microphone, in which case microphone i takes channel i of the file.
+  std::string stimPath = config->get_child_str("stim");
+
+  int pdmChunk = 4096;
+  js::config *pdmChunkConfig = config->get("pdm_chunk");
+  if (pdmChunkConfig)
+    pdmChunk = pdmChunkConfig->get_int();
+
   this->trace = this->trace_new(config->get_child_str("name").c_str());
 
   if (this->chain_size <= 1)
@@ -501,22 +779,35 @@ flush_data(-1)
     this->stimLeftPath = config->get_child_str("stim_left");
     this->stimRightPath = config->get_child_str("stim_right");
 
+    int leftChannel = 0, rightChannel = 0;
+    if (stimPath != "")
+    {
+      if (this->stimLeftPath == "") { this->stimLeftPath = stimPath; leftChannel = 0; }
+      if (this->stimRightPath == "") { this->stimRightPath = stimPath; rightChannel = 1; }
+    }
+
     this->print("Instantiated I2S microphone model (i2s_microphone) (width: %d, stimLeft: %s, stimRight: %s)", this->width, this->stimLeftPath.c_str(), this->stimRightPath.c_str());
 
-    this->channels[0] = new I2s_mic_channel(0, this, handle, width, stimLeftPath, pdm, freq);
-    if (this->ddr || this->dual) this->channels[1] = new I2s_mic_channel(1, this, handle, width, stimRightPath, pdm, freq);
+    this->channels[0] = new I2s_mic_channel(0, this, handle, width, stimLeftPath, pdm, freq, leftChannel, pdmChunk);
+    if (this->ddr || this->dual) this->channels[1] = new I2s_mic_channel(1, this, handle, width, stimRightPath, pdm, freq, rightChannel, pdmChunk);
   }
   else
   {
     this->print("Instantiated I2S microphone chain model (i2s_microphone) (chain size: %d, width: %d)", this->chain_size, this->width);
 
-    this->channel_chain.reserve(this->chain_size);
+    this->channel_chain.resize(this->chain_size);
 
     for (int i=0; i<this->chain_size; i++)
     {
       std::string stim_path = config->get_child_str("stim_" + std::to_string(i));
+      int stim_channel = 0;
+      if (stim_path == "" && stimPath != "")
+      {
+        stim_path = stimPath;
+        stim_channel = i;
+      }
       this->print("Instantiated I2S microphone model (i2s_microphone) (width: %d, stim: %s)", this->width, stim_path.c_str());
-      this->channel_chain[i] = new I2s_mic_channel(i, this, handle, width, stim_path, false, freq);
+      this->channel_chain[i] = new I2s_mic_channel(i, this, handle, width, stim_path, false, freq, stim_channel);
     }
   }
 
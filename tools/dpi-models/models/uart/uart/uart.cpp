@@ -21,6 +21,7 @@
 #include "dpi/models.hpp"
 #include <stdint.h>
 #include <unistd.h>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -56,7 +57,9 @@ private:
 
   void dpi_task(void);
   bool rx_is_sampling(void);
+  bool rx_start_next(void);
   void stdin_task(void);
+  int rx_read_input(uint8_t *buffer, int size);
 
   bool open_telnet_socket(int);
   void telnet_listener(void);
@@ -89,6 +92,15 @@ private:
   bool telnet_error = false;
   uint8_t byte;
   FILE *tx_file = NULL;
+  FILE *rx_file = NULL;
+
+  // Characters coming from stdin, telnet or the RX file are pushed by the
+  // input thread into this ring buffer and popped by the sampling task.
+  std::vector<uint8_t> rx_fifo;
+  int rx_fifo_head = 0;
+  int rx_fifo_count = 0;
+  int rx_chunk_size;
+  std::condition_variable rx_fifo_cond;
 
   std::thread *stdin_thread;
 
@@ -131,6 +143,14 @@ Uart_tb::Uart_tb(js::config *config, void *handle) : Dpi_model(config, handle)
     telnet_port = config->get("telnet_port")->get_int();
   }
   std::string tx_filename = config->get("tx_file")->get_str();
+  std::string rx_filename = config->get_child_str("rx_file");
+
+  int rx_fifo_size = config->get_child_int("rx_fifo_size");
+  this->rx_fifo.resize(rx_fifo_size > 0 ? rx_fifo_size : 1024);
+  this->rx_chunk_size = config->get_child_int("rx_chunk_size");
+  if (this->rx_chunk_size <= 0 || this->rx_chunk_size > (int)this->rx_fifo.size())
+    this->rx_chunk_size = this->rx_fifo.size();
+
   period = 1000000000000UL/baudrate;
   print("Instantiated uart model (baudrate: %d, loopback: %d, stdout: %d, tx_file: %s)", baudrate, loopback, stdout, tx_filename.c_str());
   if (tx_filename != "")
@@ -141,13 +161,21 @@ Uart_tb::Uart_tb(js::config *config, void *handle) : Dpi_model(config, handle)
       print("Unable to open TX log file: %s", strerror(errno));
     }
   }
+  if (rx_filename != "")
+  {
+    rx_file = fopen(rx_filename.c_str(), (char *)"r");
+    if (rx_file == NULL)
+    {
+      print("Unable to open RX input file: %s", strerror(errno));
+    }
+  }
   uart = new Uart_tb_uart_itf(this);
   create_itf("uart", static_cast<Uart_itf *>(uart));
   if (this->telnet)
   {   
     this->telnet_proxy = new Telnet_proxy(this->telnet_port);
   }
-  if (this->stdin || this->telnet)
+  if (this->stdin || this->telnet || this->rx_file)
   {
     stdin_thread = new std::thread(&Uart_tb::stdin_task, this);
   }
@@ -193,7 +221,6 @@ void Uart_tb::tx_sampling()
 
 void Uart_tb::rx_sampling()
 {
-  rx_mutex.lock();
   this->current_rx = this->rx_bit_buffer & 0x1;
   this->rx_bit_buffer = this->rx_bit_buffer >> 1;
   //std::cerr << "Sampling bit " << current_rx << std::endl;
@@ -203,8 +230,11 @@ void Uart_tb::rx_sampling()
   if(rx_nb_bits == 10)
   {
     this->stop_rx_sampling();
+
+    // Directly chain the next character so that the line stays busy as long
+    // as there are pending characters.
+    this->rx_start_next();
   }
-  rx_mutex.unlock();
 }
 
 void Uart_tb::tx_edge(int64_t timestamp, int tx)
@@ -233,7 +263,6 @@ void Uart_tb::stop_tx_sampling(void)
   this->sampling_tx = 0;
 }
 
-// will be called protected by a mutex
 void Uart_tb::start_rx_sampling(int baudrate)
 {
   this->sampling_rx = 1;
@@ -251,6 +280,9 @@ void Uart_tb::dpi_task(void)
   {
     while(!(this->rx_is_sampling() || this->sampling_tx))
     { 
+      if (this->rx_start_next())
+        break;
+
       this->wait_event();
     }
 
@@ -274,41 +306,103 @@ void Uart_tb::dpi_task(void)
 
 bool Uart_tb::rx_is_sampling(void)
 {
-    rx_mutex.lock();
-    bool ret = this->sampling_rx;
-    rx_mutex.unlock();
-    return ret;
+  return this->sampling_rx;
 }
 
-void Uart_tb::stdin_task(void)
+// Pops the next character from the RX FIFO and starts sending it.
+// Returns false if there is no pending character.
+bool Uart_tb::rx_start_next(void)
 {
-  while(1)
+  uint8_t c;
+
+  {
+    std::unique_lock<std::mutex> lock(this->rx_mutex);
+    if (this->rx_fifo_count == 0)
+      return false;
+
+    c = this->rx_fifo[this->rx_fifo_head];
+    this->rx_fifo_head = (this->rx_fifo_head + 1) % this->rx_fifo.size();
+    this->rx_fifo_count--;
+
+    // Only wake-up the input thread once enough room is available for a
+    // full chunk, to limit the number of context switches.
+    if ((int)this->rx_fifo.size() - this->rx_fifo_count >= this->rx_chunk_size)
+      this->rx_fifo_cond.notify_one();
+  }
+
+  rx_bit_buffer = 0;
+  rx_bit_buffer |= ((uint32_t)c) << 1;
+  rx_bit_buffer |= 1 << 9;
+  rx_nb_bits = 0;
+  this->start_rx_sampling(baudrate);
+
+  return true;
+}
+
+int Uart_tb::rx_read_input(uint8_t *buffer, int size)
+{
+  if (this->rx_file)
   {
-    print("stdin task sampling\n");
-    uint8_t c = 0;
-    if (this->stdin)
+    size_t nb_bytes = fread(buffer, 1, size, this->rx_file);
+    if (nb_bytes == 0)
     {
-      c = getchar();
+      fclose(this->rx_file);
+      this->rx_file = NULL;
     }
-    else if (this->telnet)
+    return nb_bytes;
+  }
+  else if (this->stdin)
+  {
+    // Return as soon as some characters are available, to not delay
+    // interactive inputs
+    int nb_bytes = read(0, buffer, size);
+    return nb_bytes > 0 ? nb_bytes : -1;
+  }
+  else if (this->telnet)
+  {
+    return this->telnet_proxy->pop_bytes(buffer, size);
+  }
+
+  return -1;
+}
+
+void Uart_tb::stdin_task(void)
+{
+  std::vector<uint8_t> chunk(this->rx_chunk_size);
+
+  while(1)
+  {
+    int nb_bytes = this->rx_read_input(chunk.data(), this->rx_chunk_size);
+    if (nb_bytes < 0)
+      break;
+
+    int index = 0;
+    while (index < nb_bytes)
     {
-      this->telnet_proxy->pop_byte(&c);
-    }
-    print("got char:%c\n",c);
-    while(this->rx_is_sampling())
-    {// TODO: use cond instead
-      usleep(5);
+      bool was_empty;
+
+      {
+        std::unique_lock<std::mutex> lock(this->rx_mutex);
+        while (this->rx_fifo_count == (int)this->rx_fifo.size())
+        {
+          this->rx_fifo_cond.wait(lock);
+        }
+
+        was_empty = this->rx_fifo_count == 0;
+
+        int size = this->rx_fifo.size();
+        while (index < nb_bytes && this->rx_fifo_count < size)
+        {
+          this->rx_fifo[(this->rx_fifo_head + this->rx_fifo_count) % size] = chunk[index++];
+          this->rx_fifo_count++;
+        }
+      }
+
+      // The sampling task only needs to be woken up if it may be waiting
+      // for characters.
+      if (was_empty)
+        raise_event_from_ext();
     }
-    // TODO: use once atomic function for this instead
-    this->rx_mutex.lock();
-    rx_bit_buffer = 0;
-    rx_bit_buffer |= ((uint32_t)c) << 1;
-    rx_bit_buffer |= 1 << 9;
-    rx_nb_bits = 0;
-    this->start_rx_sampling(baudrate);
-    this->rx_mutex.unlock();
-    raise_event_from_ext();
-    printf("raised_event\n");
   }
 }
 
@@ -80,6 +80,26 @@ void Telnet_proxy::pop_byte(uint8_t *byte)
   rx_queue.pop();
 }
 
+/**
+ * Pop up to size bytes, blocking until at least one is available.
+ * Returns the number of bytes popped.
+ */
+int Telnet_proxy::pop_bytes(uint8_t *buffer, int size)
+{
+  std::unique_lock<std::mutex> lock(this->rx_mutex);
+  while(rx_queue.empty())
+  {
+    rx_cond.wait(lock);
+  }
+  int nb_bytes = 0;
+  while(nb_bytes < size && !rx_queue.empty())
+  {
+    buffer[nb_bytes++] = rx_queue.front();
+    rx_queue.pop();
+  }
+  return nb_bytes;
+}
+
 void Telnet_proxy::push_byte_from_proxy(uint8_t *byte)
 {
   std::unique_lock<std::mutex> lock(this->rx_mutex);
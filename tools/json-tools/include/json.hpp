@@ -28,15 +28,86 @@
 #include <stdio.h>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <mutex>
 #include "string.h"
 
 namespace js {
 
+  class config;
+
+  // Path parsed once so that it can be used for several lookups without
+  // splitting the string again.
+  class config_path
+  {
+
+  public:
+    explicit config_path(std::string path);
+
+    std::vector<std::string> names;
+    // Names joined with '/', used as key in the config index
+    std::string key;
+    bool has_wildcard;
+  };
+
+  // Index shared by all the objects of a sub-tree, with one entry per fully
+  // qualified key, plus a cache for the queries using wildcards.
+  class config_index
+  {
+
+  public:
+    std::unordered_map<std::string, config *> keys;
+    std::unordered_map<std::string, config *> wildcard_cache;
+    std::mutex wildcard_mutex;
+  };
+
+  // Memory for the nodes of an imported config, which are allocated by
+  // blocks and released all together.
+  class config_arena
+  {
+
+  public:
+    ~config_arena();
+    void *alloc(size_t size);
+
+  private:
+    std::vector<char *> blocks;
+    char *current = NULL;
+    size_t remaining = 0;
+  };
+
+  // Everything owned by an imported config: the JSON text, which strings
+  // and keys point to, and the arena holding the nodes.
+  class config_document
+  {
+
+  public:
+    config_document() : buffer(NULL), size(0), mapped(false) {}
+    ~config_document();
+
+    config_arena arena;
+    char *buffer;
+    size_t size;
+    bool mapped;
+  };
+
   class config
   {
 
   public:
 
+    // The nodes are owned by the arena of their document, deleting one only
+    // destroys it. The memory is released when the root is deleted.
+    // Nodes allocated without arena are freed when they are deleted.
+    static void *operator new(size_t size) { return alloc_node(size, NULL); }
+    static void *operator new(size_t size, config_arena *arena) { return alloc_node(size, arena); }
+    static void operator delete(void *ptr) { free_node(ptr); }
+    static void operator delete(void *ptr, config_arena *) { free_node(ptr); }
+
+    virtual ~config() {}
+
+    typedef std::vector<std::string>::const_iterator path_iterator;
+
     virtual std::string get_str() { return ""; }
     virtual long long int get_int() { return 0; }
     virtual long long int get_int(std::string name)
@@ -48,12 +119,23 @@ namespace js {
 
     virtual void dump(std::string indent="");
     virtual config *get(std::string) { return NULL; }
+    virtual config *get(const config_path &) { return NULL; }
     virtual config *get_elem(int) { return NULL; }
     virtual size_t get_size() { return 0; }
     virtual bool get_bool() { return false; }
-    virtual config *get_from_list(std::vector<std::string>) {
-      return NULL;
+    config *get_from_list(std::vector<std::string> name_list) {
+      return this->get_from_list(name_list.cbegin(), name_list.cend());
     }
+    virtual config *get_from_list(path_iterator first, path_iterator last) {
+      return first == last ? this : NULL;
+    }
+
+  private:
+    static void *alloc_node(size_t size, config_arena *arena);
+    static void free_node(void *ptr);
+
+  public:
+    virtual void build_index(config_index *, std::string) {}
 
     virtual int get_child_int(std::string) { return 0; }
     virtual bool get_child_bool(std::string) { return false; }
@@ -65,7 +147,7 @@ namespace js {
     virtual std::map<std::string, config *> get_childs() {
       return std::map<std::string, config *>();
     }
-    config *create_config(jsmntok_t *tokens, int *_size);
+    config *create_config(jsmntok_t *tokens, int *_size, config_arena *arena=NULL);
 
     std::map<std::string, config *> childs;
   };
@@ -74,10 +156,14 @@ namespace js {
   {
 
   public:
-    config_object(jsmntok_t *tokens, int *size=NULL);
+    config_object(jsmntok_t *tokens, int *size=NULL, config_arena *arena=NULL);
+    ~config_object() { this->delete_childs(); }
 
     config *get(std::string name);
-    config *get_from_list(std::vector<std::string> name_list);
+    config *get(const config_path &path);
+    using config::get_from_list;
+    config *get_from_list(path_iterator first, path_iterator last);
+    void build_index(config_index *index, std::string prefix);
     std::map<std::string, config *> get_childs() { return childs; }
 
     int get_child_int(std::string name);
@@ -86,14 +172,23 @@ namespace js {
 
     void dump(std::string indent="");
 
+  protected:
+    void delete_childs();
+
+  private:
+    config_index *index = NULL;
+    // Fully qualified key of this object in the index, with a trailing '/'
+    std::string prefix;
+
   };
 
   class config_array : public config
   {
 
   public:
-    config_array(jsmntok_t *tokens, int *size=NULL);
-    config *get_from_list(std::vector<std::string> name_list);
+    config_array(jsmntok_t *tokens, int *size=NULL, config_arena *arena=NULL);
+    ~config_array();
+    void build_index(config_index *index, std::string prefix);
 
     std::vector<config *> get_elems() { return elems; }
     config *get_elem(int index) { return elems[index]; }
@@ -104,6 +199,8 @@ namespace js {
 
   private:
     std::vector<config *> elems;
+    // Indexes of the objects of the array, which are not part of ours
+    std::vector<config_index *> indexes;
   };
 
 
@@ -112,15 +209,16 @@ namespace js {
 
   public:
     config_string(jsmntok_t *tokens);
-    config *get_from_list(std::vector<std::string> name_list);
-    std::string get_str() { return value; }
-    long long int get_int() { return strtoll(value.c_str(), NULL, 0); }
-    bool get_bool() { return strcmp(value.c_str(), "True") == 0 ||  strcmp(value.c_str(), "true") == 0; }
+    std::string get_str() { return std::string(value, size); }
+    long long int get_int() { return strtoll(get_str().c_str(), NULL, 0); }
+    bool get_bool() { return (size == 4 && strncmp(value, "True", 4) == 0) || (size == 4 && strncmp(value, "true", 4) == 0); }
 
     void dump(std::string indent="");
 
   private:
-    std::string value;
+    // Points to the JSON text owned by the config document, not terminated
+    const char *value;
+    size_t size;
   };
 
 
@@ -129,13 +227,18 @@ namespace js {
 
   public:
     config_number(jsmntok_t *tokens);
-    long long int get_int() { return (int)value; }
-    config *get_from_list(std::vector<std::string> name_list);
+    long long int get_int();
 
     void dump(std::string indent="");
 
   private:
+    // Integers are kept exact so that 64-bit addresses are not rounded.
+    // Positive integers above the long long range are kept as unsigned,
+    // and returned with the same bits.
     double value;
+    long long int int_value;
+    bool is_int;
+    bool is_uint;
 
   };
 
@@ -145,7 +248,6 @@ namespace js {
   public:
     config_bool(jsmntok_t *tokens);
     bool get_bool() { return (bool)value; }
-    config *get_from_list(std::vector<std::string> name_list);
 
     void dump(std::string indent="");
 
@@ -153,6 +255,24 @@ namespace js {
     bool value;
   };
 
+  // Top object of an imported config, which owns the document and the
+  // index. It is allocated on the heap, deleting it releases the whole
+  // config.
+  class config_root : public config_object
+  {
+
+  public:
+    config_root(jsmntok_t *tokens, config_document *document);
+    ~config_root();
+
+    static void *operator new(size_t size) { return ::operator new(size); }
+    static void operator delete(void *ptr) { ::operator delete(ptr); }
+
+  private:
+    config_document *document;
+    config_index *root_index;
+  };
+
   config *import_config_from_string(std::string config_string);
 
   config *import_config_from_file(std::string config_path);
@@ -27,6 +27,17 @@
 #include "string.h"
 #include <streambuf>
 #include <stdlib.h>
+#include <errno.h>
+#include <cstddef>
+#include <limits.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define CONFIG_ARENA_BLOCK_SIZE (64*1024)
 
 std::vector<std::string> split(const std::string& s, char delimiter)
 {
@@ -40,7 +51,75 @@ std::vector<std::string> split(const std::string& s, char delimiter)
    return tokens;
 }
 
-js::config *js::config::create_config(jsmntok_t *tokens, int *_size)
+static inline bool token_equals(jsmntok_t *token, const char *str)
+{
+  size_t len = strlen(str);
+  return (size_t)(token->end - token->start) == len && strncmp(token->str, str, len) == 0;
+}
+
+static inline std::string token_str(jsmntok_t *token)
+{
+  return std::string(token->str, token->end - token->start);
+}
+
+js::config_arena::~config_arena()
+{
+  for (auto x: this->blocks)
+    delete[] x;
+}
+
+void *js::config_arena::alloc(size_t size)
+{
+  size = (size + 15) & ~(size_t)15;
+
+  if (size > this->remaining)
+  {
+    size_t block_size = size > CONFIG_ARENA_BLOCK_SIZE ? size : CONFIG_ARENA_BLOCK_SIZE;
+    this->current = new char[block_size];
+    this->remaining = block_size;
+    this->blocks.push_back(this->current);
+  }
+
+  void *result = this->current;
+  this->current += size;
+  this->remaining -= size;
+  return result;
+}
+
+// Each node is preceded by a header telling if it comes from an arena, so
+// that deleting it knows if the memory must be freed
+static const size_t config_node_header = alignof(std::max_align_t);
+
+void *js::config::alloc_node(size_t size, config_arena *arena)
+{
+  char *node = (char *)(arena ? arena->alloc(size + config_node_header) : ::operator new(size + config_node_header));
+  *(bool *)node = arena != NULL;
+  return node + config_node_header;
+}
+
+void js::config::free_node(void *ptr)
+{
+  if (ptr == NULL)
+    return;
+
+  char *node = (char *)ptr - config_node_header;
+  if (!*(bool *)node)
+    ::operator delete(node);
+}
+
+js::config_document::~config_document()
+{
+#ifndef _WIN32
+  if (this->mapped)
+  {
+    munmap(this->buffer, this->size);
+    return;
+  }
+#endif
+  delete[] this->buffer;
+}
+
+js::config *js::config::create_config(jsmntok_t *tokens, int *_size, config_arena *arena)
 {
   jsmntok_t *current = tokens;
   config *config = NULL;
@@ -48,34 +127,34 @@ js::config *js::config::create_config(jsmntok_t *tokens, int *_size)
   switch (current->type)
   {
     case JSMN_PRIMITIVE:
-      if (strcmp(current->str, "True") == 0 || strcmp(current->str, "False") == 0 ||
-        strcmp(current->str, "true") == 0 || strcmp(current->str, "false") == 0)
+      if (token_equals(current, "True") || token_equals(current, "False") ||
+        token_equals(current, "true") || token_equals(current, "false"))
       {
-        config = new config_bool(current);
+        config = new (arena) config_bool(current);
       }
       else
       {
-        config = new config_number(current);
+        config = new (arena) config_number(current);
       }
       current++;
       break;
 
     case JSMN_OBJECT: {
       int size;
-      config = new config_object(current, &size);
+      config = new (arena) config_object(current, &size, arena);
       current += size;
       break;
     }
 
     case JSMN_ARRAY: {
       int size;
-      config = new config_array(current, &size);
+      config = new (arena) config_array(current, &size, arena);
       current += size;
       break;
     }
 
     case JSMN_STRING:
-      config = new config_string(current);
+      config = new (arena) config_string(current);
       current++;
       break;
 
@@ -95,32 +174,19 @@ void js::config::dump(std::string)
 {
 }
 
-js::config *js::config_string::get_from_list(std::vector<std::string> name_list)
-{
-  if (name_list.size() == 0) return this;
-  return NULL;
-}
-
 void js::config_string::dump(std::string)
 {
-  fprintf(stderr, "\"%s\"", this->value.c_str());
-}
-
-js::config *js::config_number::get_from_list(std::vector<std::string> name_list)
-{
-  if (name_list.size() == 0) return this;
-  return NULL;
+  fprintf(stderr, "\"%.*s\"", (int)this->size, this->value);
 }
 
 void js::config_number::dump(std::string)
 {
-  fprintf(stderr, "\"%f\"", this->value);
-}
-
-js::config *js::config_array::get_from_list(std::vector<std::string> name_list)
-{
-  if (name_list.size() == 0) return this;
-  return NULL;
+  if (this->is_uint)
+    fprintf(stderr, "\"%llu\"", (unsigned long long)this->int_value);
+  else if (this->is_int)
+    fprintf(stderr, "\"%lld\"", this->int_value);
+  else
+    fprintf(stderr, "\"%f\"", this->value);
 }
 
 void js::config_array::dump(std::string indent)
@@ -137,12 +203,6 @@ void js::config_array::dump(std::string indent)
   fprintf(stderr, "\n%s]\n", indent.c_str());
 }
 
-js::config *js::config_bool::get_from_list(std::vector<std::string> name_list)
-{
-  if (name_list.size() == 0) return this;
-  return NULL;
-}
-
 void js::config_bool::dump(std::string)
 {
   fprintf(stderr, "\"%s\"", this->value ? "true" : "false");
@@ -164,18 +224,18 @@ void js::config_object::dump(std::string indent)
   fprintf(stderr, "\n%s}\n", indent.c_str());
 }
 
-js::config *js::config_object::get_from_list(std::vector<std::string> name_list)
+js::config *js::config_object::get_from_list(path_iterator first, path_iterator last)
 {
-  if (name_list.size() == 0) return this;
+  if (first == last) return this;
 
   js::config *result = NULL;
   std::string name;
   int name_pos = 0;
 
-  for (auto& x: name_list) {
-    if (x != "*" && x != "**")
+  for (path_iterator it = first; it != last; it++) {
+    if (*it != "*" && *it != "**")
     {
-      name = x;
+      name = *it;
       break;
     }
     name_pos++;
@@ -185,18 +245,18 @@ js::config *js::config_object::get_from_list(std::vector<std::string> name_list)
 
     if (name == x.first)
     {
-      result = x.second->get_from_list(std::vector<std::string>(name_list.begin () + name_pos + 1, name_list.begin () + name_list.size()));
+      result = x.second->get_from_list(first + name_pos + 1, last);
       if (name_pos == 0 || result != NULL) return result;
 
     }
-    else if (name_list[0] == "*")
+    else if (*first == "*")
     {
-      result = x.second->get_from_list(std::vector<std::string>(name_list.begin () + 1, name_list.begin () + name_list.size()));
+      result = x.second->get_from_list(first + 1, last);
       if (result != NULL) return result;
     }
-    else if (name_list[0] == "**")
+    else if (*first == "**")
     {
-      result = x.second->get_from_list(name_list);
+      result = x.second->get_from_list(first, last);
       if (result != NULL) return result;
     }
   }
@@ -206,33 +266,152 @@ js::config *js::config_object::get_from_list(std::vector<std::string> name_list)
 
 js::config *js::config_object::get(std::string name)
 {
-  return get_from_list(split(name, '/'));
+  return this->get(config_path(name));
+}
+
+js::config *js::config_object::get(const config_path &path)
+{
+  if (path.names.size() == 0) return this;
+
+  if (this->index == NULL)
+    return get_from_list(path.names);
+
+  if (!path.has_wildcard)
+  {
+    auto it = this->index->keys.find(this->prefix + path.key);
+    return it == this->index->keys.end() ? NULL : it->second;
+  }
+
+  // Wildcard queries need to walk the tree, remember the result since the
+  // same queries are usually done many times on the same config.
+  std::string cache_key = this->prefix + '\n' + path.key;
+
+  std::unique_lock<std::mutex> lock(this->index->wildcard_mutex);
+  auto it = this->index->wildcard_cache.find(cache_key);
+  if (it != this->index->wildcard_cache.end())
+    return it->second;
+
+  js::config *result = get_from_list(path.names);
+  this->index->wildcard_cache[cache_key] = result;
+  return result;
+}
+
+void js::config_object::build_index(config_index *index, std::string prefix)
+{
+  this->index = index;
+  this->prefix = prefix;
+
+  for (auto& x: childs)
+  {
+    index->keys[prefix + x.first] = x.second;
+    x.second->build_index(index, prefix + x.first + "/");
+  }
+}
+
+void js::config_array::build_index(config_index *, std::string)
+{
+  // Lookups do not go through arrays, so each object inside an array is the
+  // root of its own index.
+  for (auto x: this->elems)
+  {
+    if (x != NULL)
+    {
+      this->indexes.push_back(new config_index());
+      x->build_index(this->indexes.back(), "");
+    }
+  }
+}
+
+js::config_path::config_path(std::string path)
+: has_wildcard(false)
+{
+  this->names = split(path, '/');
+
+  bool is_first = true;
+  for (auto& x: this->names)
+  {
+    if (x == "*" || x == "**")
+      this->has_wildcard = true;
+
+    if (!is_first)
+      this->key += '/';
+    this->key += x;
+    is_first = false;
+  }
 }
 
 js::config_string::config_string(jsmntok_t *tokens)
 {
-  value = std::string(tokens->str);
+  value = tokens->str;
+  size = tokens->end - tokens->start;
 }
 
 js::config_number::config_number(jsmntok_t *tokens)
 {
-  value = atof(tokens->str);
+  // Tokens are not null-terminated, numbers are short enough to be copied
+  char str[64];
+  int len = tokens->end - tokens->start;
+  if (len >= (int)sizeof(str))
+    len = sizeof(str) - 1;
+  memcpy(str, tokens->str, len);
+  str[len] = 0;
+
+  // Try first as an integer, either decimal or hexadecimal, and only fall
+  // back to a double if this is not an integer or if it does not fit.
+  const char *digits = str;
+  if (*digits == '-' || *digits == '+')
+    digits++;
+  int base = digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X') ? 16 : 10;
+
+  char *end;
+  errno = 0;
+  is_uint = false;
+  int_value = strtoll(str, &end, base);
+  if (errno == ERANGE && str[0] != '-')
+  {
+    errno = 0;
+    int_value = (long long)strtoull(str, &end, base);
+    is_uint = errno == 0;
+  }
+  is_int = len > 0 && *end == 0 && errno == 0;
+  is_uint = is_uint && is_int;
+  if (is_uint)
+    value = (double)(unsigned long long)int_value;
+  else
+    value = is_int ? (double)int_value : atof(str);
+}
+
+long long int js::config_number::get_int()
+{
+  if (this->is_int)
+    return this->int_value;
+
+  // Converting a double outside of the range is undefined, so it is clamped
+  if (this->value != this->value)
+    return 0;
+  if (this->value >= 9223372036854775808.0)
+    return LLONG_MAX;
+  if (this->value <= -9223372036854775808.0)
+    return LLONG_MIN;
+  return (long long int)this->value;
 }
 
 js::config_bool::config_bool(jsmntok_t *tokens)
 {
-  value = strcmp(tokens->str, "True") == 0 || strcmp(tokens->str, "true") == 0;
+  value = token_equals(tokens, "True") || token_equals(tokens, "true");
 }
 
-js::config_array::config_array(jsmntok_t *tokens, int *_size)
+js::config_array::config_array(jsmntok_t *tokens, int *_size, config_arena *arena)
 {
   jsmntok_t *current = tokens;
   jsmntok_t *top = current++;
   
+  elems.reserve(top->size);
+
   for (int i=0; i<top->size; i++)
   {
     int child_size;
-    elems.push_back(create_config(current, &child_size));
+    elems.push_back(create_config(current, &child_size, arena));
     current += child_size;
   }
 
@@ -242,7 +421,7 @@ js::config_array::config_array(jsmntok_t *tokens, int *_size)
   }
 }
 
-js::config_object::config_object(jsmntok_t *tokens, int *_size)
+js::config_object::config_object(jsmntok_t *tokens, int *_size, config_arena *arena)
 {
   jsmntok_t *current = tokens;
   jsmntok_t *t = current++;
@@ -251,12 +430,12 @@ js::config_object::config_object(jsmntok_t *tokens, int *_size)
   {
     jsmntok_t *child_name = current++;
     int child_size;
-    config *child_config = create_config(current, &child_size);
+    config *child_config = create_config(current, &child_size, arena);
     current += child_size;
 
     if (child_config != NULL)
     {
-      childs[child_name->str] = child_config;
+      childs[token_str(child_name)] = child_config;
 
     }
   }
@@ -266,40 +445,120 @@ js::config_object::config_object(jsmntok_t *tokens, int *_size)
   }
 }
 
-js::config *js::import_config_from_file(std::string config_path)
-{
-  std::ifstream t(config_path);
-  std::string str((std::istreambuf_iterator<char>(t)),
-                   std::istreambuf_iterator<char>());
-  return import_config_from_string(str);
-
-}
-
-js::config *js::import_config_from_string(std::string config_str)
+static js::config *import_config_from_document(js::config_document *document)
 {
-  const char *config_string = strdup(config_str.c_str());
   jsmn_parser parser;
   
-  jsmn_init(&parser);
-  int nb_tokens = jsmn_parse(&parser, config_string, strlen(config_string), NULL, 0);
-
-  std::vector<jsmntok_t> tokens(nb_tokens);
+  // Parse in a single pass, starting with an estimation of the number of
+  // tokens and growing the array if the parser runs out of tokens, which
+  // jsmn supports by resuming where it stopped.
+  std::vector<jsmntok_t> tokens(document->size / 16 + 64);
+  int nb_tokens;
 
   jsmn_init(&parser);
-  nb_tokens = jsmn_parse(&parser, config_string, strlen(config_string), &(tokens[0]), nb_tokens);
+  while(1)
+  {
+    nb_tokens = jsmn_parse(&parser, document->buffer, document->size, &(tokens[0]), tokens.size());
+    if (nb_tokens != JSMN_ERROR_NOMEM)
+      break;
+    tokens.resize(tokens.size() * 2);
+  }
+
+  if (nb_tokens <= 0 || tokens[0].type != JSMN_OBJECT)
+    return NULL;
 
-  char *str = strdup(config_string);
   for (int i=0; i<nb_tokens; i++)
   {
     jsmntok_t *tok = &(tokens[i]);
-    tok->str = &str[tok->start];
-    str[tok->end] = 0;
-      //printf("%d %d %d %d: %s\n", tokens[i].type, tokens[i].start, tokens[i].end, tokens[i].size, tok->str);
+    tok->str = &document->buffer[tok->start];
+  }
+
+  return new js::config_root(&(tokens[0]), document);
+}
+
+js::config_root::config_root(jsmntok_t *tokens, config_document *document)
+  : config_object(tokens, NULL, &document->arena), document(document), root_index(new config_index())
+{
+  this->build_index(this->root_index, "");
+}
+
+js::config_root::~config_root()
+{
+  // The nodes must be destroyed before their arena is released, which
+  // happens before the base destructor is called
+  this->delete_childs();
+  delete this->root_index;
+  delete this->document;
+}
+
+void js::config_object::delete_childs()
+{
+  for (auto &x: this->childs)
+    delete x.second;
+  this->childs.clear();
+}
+
+js::config_array::~config_array()
+{
+  for (auto x: this->elems)
+    delete x;
+  for (auto x: this->indexes)
+    delete x;
+}
+
+js::config *js::import_config_from_file(std::string config_path)
+{
+  js::config_document *document = new js::config_document();
+
+#ifndef _WIN32
+  // Map the file so that the config text is not copied, the strings of the
+  // config directly point to the mapped pages.
+  int fd = open(config_path.c_str(), O_RDONLY);
+  if (fd != -1)
+  {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    {
+      void *buffer = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (buffer != MAP_FAILED)
+      {
+        document->buffer = (char *)buffer;
+        document->size = file_stat.st_size;
+        document->mapped = true;
+      }
+    }
+    close(fd);
+  }
+#endif
+
+  if (!document->mapped)
+  {
+    std::ifstream t(config_path);
+    std::string str((std::istreambuf_iterator<char>(t)),
+                     std::istreambuf_iterator<char>());
+    document->size = str.size();
+    document->buffer = new char[str.size() + 1];
+    memcpy(document->buffer, str.c_str(), str.size() + 1);
   }
 
+  js::config *config = import_config_from_document(document);
+  if (config == NULL)
+    delete document;
+  return config;
+}
+
+js::config *js::import_config_from_string(std::string config_str)
+{
+  js::config_document *document = new js::config_document();
 
+  document->size = config_str.size();
+  document->buffer = new char[config_str.size() + 1];
+  memcpy(document->buffer, config_str.c_str(), config_str.size() + 1);
 
-  return new js::config_object(&(tokens[0]));
+  js::config *config = import_config_from_document(document);
+  if (config == NULL)
+    delete document;
+  return config;
 }
 
 int js::config_object::get_child_int(std::string name)